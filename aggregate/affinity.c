@@ -0,0 +1,326 @@
+/*
+ * File: affinity.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Placement of the pool workers on processors. The processors are those
+ * we may run on: the online ones of sysfs that our affinity mask allows
+ * (taskset, cpusets), or on Solaris the processor set we are bound to,
+ * else every online processor. They need not be numbered 0 .. n-1. The
+ * topology (package, core and hardware thread of each) is read from sysfs.
+ * The policies order the processors and worker i is bound to the i-th:
+ *
+ *   compact -- fill the hardware threads of a core, then the next core,
+ *              then the next package. Siblings share their L1 and L2.
+ *   scatter -- alternate packages, then cores, hardware threads last.
+ *   cores   -- one worker per physical core first, in package order,
+ *              then the second hardware thread of every core, and so on.
+ *
+ * Where sysfs is not available every processor counts as its own core.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* CPU_SET, pthread_setaffinity_np */
+#endif
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#else
+#include <sys/types.h>
+#include <sys/processor.h>
+#include <sys/procset.h>
+#include <sys/pset.h>
+#endif
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+/* Where a processor sits */
+typedef struct CpuInfo
+{
+  int cpu;
+  int package; /* physical_package_id */
+  int core; /* core_id, unique within the package */
+  int core_rank; /* index of the core within its package */
+  int smt; /* index of the hardware thread within its core */
+} CpuInfo;
+
+const char *AffinityName(AffinityPolicy policy)
+{
+  switch(policy)
+    {
+    case AFFINITY_NONE:
+      return "none";
+    case AFFINITY_COMPACT:
+      return "compact";
+    case AFFINITY_SCATTER:
+      return "scatter";
+    case AFFINITY_CORES:
+      return "cores";
+    }
+  return "unknown";
+}
+
+/* read one integer from a sysfs file, -1 if it isn't there */
+static int ReadTopology(int cpu, const char *name)
+{
+  char path[256];
+  int value = -1;
+  FILE *F;
+
+  sprintf(path, SYSFS_CPU "/cpu%d/topology/%s", cpu, name);
+  F = fopen(path, "r");
+  if(!F)
+    return -1;
+  if(fscanf(F, "%d", &value) != 1)
+    value = -1;
+  fclose(F);
+  return value;
+}
+
+/* is cpus[j] the lowest numbered hardware thread of its core? */
+static bool FirstOfCore(const CpuInfo *cpus, int j)
+{
+  register int k;
+  for(k = 0; k < j; k++)
+    if(cpus[k].package == cpus[j].package && cpus[k].core == cpus[j].core)
+      return false;
+  return true;
+}
+
+#ifdef __linux__
+/* the processors in the sysfs list at F ("0-3,8,10-11") that set allows */
+static int ParseCpuList(FILE *F, const cpu_set_t *set, int *list)
+{
+  int first, last, cpu, c, n = 0;
+
+  while(fscanf(F, "%d", &first) == 1)
+    {
+      last = first;
+      c = fgetc(F);
+      if(c == '-')
+	{
+	  if(fscanf(F, "%d", &last) != 1)
+	    break;
+	  c = fgetc(F);
+	}
+      for(cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+	if(CPU_ISSET(cpu, set))
+	  list[n++] = cpu;
+      if(c != ',')
+	break;
+    }
+  return n;
+}
+#endif /* __linux__ */
+
+/*
+ * The processors we may run on, in increasing order, into *list (to be
+ * freed by the caller). Returns how many there are.
+ */
+static int ListCpus(int **list)
+{
+  int n = 0;
+#ifdef __linux__
+  cpu_set_t set;
+  register int cpu;
+  FILE *F;
+
+  if(sched_getaffinity(0, sizeof(cpu_set_t), &set) != 0)
+    {
+      CPU_ZERO(&set);
+      for(cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++)
+	CPU_SET(cpu, &set);
+    }
+  *list = (int*)malloc(sizeof(int) * CPU_SETSIZE);
+  assert(*list);
+
+  F = fopen(SYSFS_CPU "/online", "r");
+  if(F)
+    {
+      n = ParseCpuList(F, &set, *list);
+      fclose(F);
+    }
+  if(n == 0)
+    /* no sysfs: whatever the mask allows */
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if(CPU_ISSET(cpu, &set))
+	(*list)[n++] = cpu;
+#else
+  psetid_t pset;
+  uint_t count;
+  processorid_t id, max_id = sysconf(_SC_CPUID_MAX);
+
+  *list = (int*)malloc(sizeof(int) * (max_id + 1));
+  assert(*list);
+
+  if(pset_bind(PS_QUERY, P_PID, P_MYID, &pset) == 0 && pset != PS_NONE)
+    {
+      count = max_id + 1;
+      if(pset_info(pset, NULL, &count, (processorid_t*)*list) == 0)
+	n = count;
+    }
+  if(n == 0)
+    for(id = 0; id <= max_id; id++)
+      if(p_online(id, P_STATUS) == P_ONLINE)
+	(*list)[n++] = id;
+#endif
+  assert(n > 0);
+  return n;
+}
+
+/* fill in the topology of the n processors in list */
+static void ReadCpus(CpuInfo *cpus, const int *list, int n)
+{
+  register int i, j;
+
+  for(i = 0; i < n; i++)
+    {
+      cpus[i].cpu = list[i];
+      cpus[i].package = ReadTopology(list[i], "physical_package_id");
+      cpus[i].core = ReadTopology(list[i], "core_id");
+      if(cpus[i].package < 0)
+	cpus[i].package = 0;
+      if(cpus[i].core < 0)
+	cpus[i].core = list[i]; /* no sysfs, no SMT that we know of */
+    }
+
+  /* rank hardware threads within cores and cores within packages */
+  for(i = 0; i < n; i++)
+    {
+      cpus[i].smt = 0;
+      cpus[i].core_rank = 0;
+      for(j = 0; j < n; j++)
+	{
+	  if(cpus[j].package != cpus[i].package)
+	    continue;
+	  if(cpus[j].core == cpus[i].core && j < i)
+	    cpus[i].smt ++;
+	  if(cpus[j].core < cpus[i].core && FirstOfCore(cpus, j))
+	    cpus[i].core_rank ++;
+	}
+    }
+}
+
+/* order processors by three keys each, then by number */
+static int CompareKeys(const int *keys_a, const int *keys_b,
+		       const CpuInfo *a, const CpuInfo *b)
+{
+  register int i;
+
+  for(i = 0; i < 3; i++)
+    if(keys_a[i] != keys_b[i])
+      return keys_a[i] - keys_b[i];
+  return a->cpu - b->cpu;
+}
+
+/* qsort comparators, one per policy */
+static int CompareCompact(const void *x, const void *y)
+{
+  const CpuInfo *a = (const CpuInfo*)x;
+  const CpuInfo *b = (const CpuInfo*)y;
+  const int keys_a[3] = {a->package, a->core_rank, a->smt};
+  const int keys_b[3] = {b->package, b->core_rank, b->smt};
+
+  return CompareKeys(keys_a, keys_b, a, b);
+}
+
+static int CompareScatter(const void *x, const void *y)
+{
+  const CpuInfo *a = (const CpuInfo*)x;
+  const CpuInfo *b = (const CpuInfo*)y;
+  const int keys_a[3] = {a->smt, a->core_rank, a->package};
+  const int keys_b[3] = {b->smt, b->core_rank, b->package};
+
+  return CompareKeys(keys_a, keys_b, a, b);
+}
+
+static int CompareCores(const void *x, const void *y)
+{
+  const CpuInfo *a = (const CpuInfo*)x;
+  const CpuInfo *b = (const CpuInfo*)y;
+  const int keys_a[3] = {a->smt, a->package, a->core_rank};
+  const int keys_b[3] = {b->smt, b->package, b->core_rank};
+
+  return CompareKeys(keys_a, keys_b, a, b);
+}
+
+/* Decide which processor every worker runs on. Fills a->cpu_of. */
+void AffinityPlan(Aggregate a)
+{
+  register int i;
+  int n, *list;
+  CpuInfo *cpus;
+
+  for(i = 0; i < MAX_THREADS; i++)
+    a->cpu_of[i] = -1;
+  if(a->opts.affinity == AFFINITY_NONE)
+    return;
+
+  n = ListCpus(&list);
+  cpus = (CpuInfo*)malloc(sizeof(CpuInfo) * n);
+  assert(cpus);
+
+  ReadCpus(cpus, list, n);
+  switch(a->opts.affinity)
+    {
+    case AFFINITY_COMPACT:
+      qsort(cpus, n, sizeof(CpuInfo), CompareCompact);
+      break;
+    case AFFINITY_SCATTER:
+      qsort(cpus, n, sizeof(CpuInfo), CompareScatter);
+      break;
+    default: /* AFFINITY_CORES */
+      qsort(cpus, n, sizeof(CpuInfo), CompareCores);
+      break;
+    }
+
+  /* more workers than processors wrap around */
+  for(i = 0; i < a->n_threads; i++)
+    a->cpu_of[i] = cpus[i % n].cpu;
+
+  free(cpus);
+  free(list);
+}
+
+/* The NUMA node of cpu, 0 if sysfs doesn't say */
+int AffinityNode(int cpu)
+{
+  char path[256];
+  register int node;
+
+  if(cpu < 0)
+    return 0;
+  for(node = 0; node < MAX_NODES; node++)
+    {
+      sprintf(path, SYSFS_NODE "/node%d/cpu%d", node, cpu);
+      if(access(path, F_OK) == 0)
+	return node;
+    }
+  return 0;
+}
+
+/* Bind the calling thread to cpu. Returns false if the OS refused. */
+bool AffinityPin(int cpu)
+{
+  if(cpu < 0)
+    return true;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+#else
+  return processor_bind(P_LWPID, P_MYID, cpu, NULL) == 0;
+#endif
+}
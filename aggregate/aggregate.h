@@ -17,12 +17,163 @@
 #include <stdio.h>
 #include <math.h>
 #include <mtmalloc.h>
+#include <sys/time.h>
 
 #include <libcpc.h>
 
 #define WARMUP 2000
 #define SAMPLE_SIZE 1500
 #define PRIVATE_BUCKET_SIZE 3
+#define N_MAX_ACCESS 7 /* number of top access counts in the contention model */
+#define DRIFT_PROBE 512 /* tuples probed to decide if a partition needs a resample */
+#define DRIFT_TOLERANCE 0.1 /* change in miss rate that counts as drift */
+#define SAMPLE_OVERHEAD (DRIFT_PROBE + WARMUP + SAMPLE_SIZE)
+#define MIN_PARTITION_SIZE (8 * SAMPLE_OVERHEAD) /* resample partitions */
+#define MIN_SAMPLED_PARTITION (2 * SAMPLE_OVERHEAD) /* smaller ones are not sampled */
+
+/* How threads combine their samples before choosing a strategy */
+typedef enum
+{
+  COOP_OFF,           /* every thread decides from its own sample */
+  COOP_CONSISTENT,    /* every thread follows the plan from the pooled sample */
+  COOP_HETEROGENEOUS  /* contention is decided globally, runs and locality per thread */
+} CoopMode;
+
+/* The strategies the adaptive engines can pick from */
+typedef enum
+{
+  STRATEGY_RUNS,
+  STRATEGY_HYBRID,
+  STRATEGY_ATOMIC,
+  STRATEGY_PARTITIONED /* independent tables, only chosen by the bandit */
+} Strategy;
+
+#define N_STRATEGIES 4
+
+#define FEEDBACK_BLOCK 16384 /* tuples between contention checks */
+#define FEEDBACK_THRESHOLD 0.05 /* waits per global table update that count as contended */
+
+#define MIN_MORSEL (WARMUP + SAMPLE_SIZE) /* a morsel can hold a full sample */
+#define MIN_RESAMPLE_MORSEL MIN_SAMPLED_PARTITION /* resample samples every morsel */
+
+#define INTERLEAVE_MAX 16 /* most global table lookups a thread keeps in flight */
+
+#define DOP_SPLIT 16 /* morsels per thread when choosing the thread count */
+#define DOP_ROUNDS 2 /* morsels per thread measured at each thread count */
+
+#define BANDIT_MORSEL 16384 /* tuples per bandit decision */
+#define BANDIT_ROUNDS 2 /* times every arm is tried before exploiting */
+#define BANDIT_EXPLORE_SHARE 10 /* explore at most 1/10 of the morsels */
+
+/* State of one thread's strategy bandit. See bandit.c */
+typedef struct BanditCDT
+{
+  unsigned int pulls[N_STRATEGIES]; /* morsels run with each arm */
+  double reward[N_STRATEGIES]; /* mean tuples per second of each arm */
+  unsigned int total; /* morsels so far */
+  unsigned int explored; /* morsels spent exploring after the first rounds */
+  unsigned int max_explore; /* exploration budget */
+  unsigned int seed;
+} BanditCDT;
+
+typedef BanditCDT *Bandit;
+
+/* How the pool workers are placed on processors. See affinity.c */
+typedef enum
+{
+  AFFINITY_NONE,    /* leave it to the OS */
+  AFFINITY_COMPACT, /* fill every hardware thread of a core first */
+  AFFINITY_SCATTER, /* spread over packages, then cores */
+  AFFINITY_CORES    /* one thread per physical core first */
+} AffinityPolicy;
+
+/* Locks of the global table cells. See lock.h */
+typedef enum
+{
+  LOCK_PTHREAD, /* pthread mutex */
+  LOCK_TTAS,    /* test and test and set spin lock with exponential backoff */
+  LOCK_TICKET,  /* FIFO spin lock: take a ticket, wait for it to be served */
+  LOCK_MCS,     /* queue lock, every waiter spins on its own node */
+  LOCK_FUTEX    /* spins a while, then sleeps in the kernel */
+} LockKind;
+
+/* Output formats for the decision trace */
+typedef enum
+{
+  TRACE_CSV,
+  TRACE_JSON
+} TraceFormat;
+
+/* Run time options. Strategies ignore the fields that don't apply to them. */
+typedef struct AggregateOptions
+{
+  CoopMode cooperative; /* combine samples across threads (adaptive only) */
+  bool drift; /* only resample when the distribution shifts (resample only) */
+  bool trace; /* record every sampling decision (adaptive and resample) */
+  bool bandit; /* pick strategies by measured throughput (adaptive only) */
+  bool feedback; /* leave the global table when it is measured to be contended (adaptive and resample) */
+  unsigned int morsel; /* tuples per morsel for work stealing; 0 for static chunks */
+  AffinityPolicy affinity; /* where the workers run */
+  bool numa; /* copy the input next to the threads that read it */
+  bool node_tables; /* one global table per node, merged at the end */
+  unsigned int nodes; /* pretend the workers are spread over this many nodes; 0 to detect */
+  bool pipelined; /* merge a thread's tables as soon as it finishes aggregating */
+  unsigned int interleave; /* global table lookups in flight per thread; 0 for one at a time */
+  bool auto_dop; /* pick the number of threads, up to n_threads, while running */
+  struct PoolCDT *pool; /* run on the workers of another aggregate instead of starting new ones */
+  LockKind lock; /* lock of the global table cells */
+} AggregateOptions;
+
+/*
+ * One thread's queue of morsels, [head, tail) packed in a single word
+ * with head in the high 32 bits so both ends move with one
+ * compare and swap. The owner takes from the head, thieves from the tail.
+ * See morsel.c
+ */
+typedef struct MorselQueue
+{
+  volatile uint64_t range;
+  unsigned int first; /* the owner's reserved first morsel */
+  bool first_taken;
+  char padding[48]; /* one cacheline per thread */
+} MorselQueue;
+
+/* Contention seen by one thread on the global table. See global_table.h */
+typedef struct ContentionStats
+{
+  uint64_t cas_failures; /* compare and swaps that lost to another thread */
+  uint64_t lock_waits; /* lock acquisitions that found the lock held */
+  uint64_t chain_retries; /* chain inserts that lost a race and started over */
+  uint64_t updates; /* inserts into and updates of the global table */
+  char padding[32]; /* one cacheline per thread */
+} ContentionStats;
+
+/* Statistics gathered from a sample, either by one thread or pooled */
+typedef struct SampleStats
+{
+  int hits; /* hits in the private table during the sample */
+  int num_runs; /* number of runs of the same key */
+  int n_samples; /* tuples in the sample (excluding warmup) */
+  int n_accesses; /* tuples in the sample and warmup */
+  unsigned int max[N_MAX_ACCESS]; /* largest bucket access counts */
+  unsigned int distinct; /* distinct keys seen in the private table(s) */
+  double estimate_sum; /* estimated contention */
+  double avg_run_length;
+  double missrate;
+} SampleStats;
+
+/* One sampling decision made by one thread */
+typedef struct TraceRecord
+{
+  int thread;
+  int partition; /* resample partition, morsel or bandit slice */
+  Strategy strategy; /* strategy used for the range */
+  bool resampled; /* false if a drift probe kept the previous plan */
+  unsigned int start; /* first tuple of the range, sample included */
+  unsigned int end; /* last tuple of the range */
+  double elapsed; /* seconds spent on the range, sampling included */
+  SampleStats sample; /* the statistics the decision was based on */
+} TraceRecord;
 
 /* The actual aggregate data */
 typedef struct AggregateValues
@@ -55,6 +206,27 @@ typedef struct PrivateHashBucket
   int padding[5]; /* Make the bucket equal a full 2 cachelines */
 } PrivateHashBucket;
 
+/* A waiter in an MCS queue. One per thread, on a cache line of its own */
+typedef struct McsNode
+{
+  struct McsNode * volatile next; /* who waits after us */
+  volatile unsigned int locked; /* cleared when the lock is handed to us */
+  char padding[64 - sizeof(void*) - sizeof(unsigned int)];
+} McsNode;
+
+/* A lock of any kind; which member is used depends on the LockKind */
+typedef union Lock
+{
+  pthread_mutex_t mutex;
+  volatile unsigned int word; /* ttas: 1 if held. futex: 0 free, 1 held, 2 held and maybe waiters */
+  struct
+  {
+    volatile unsigned int next; /* next ticket to hand out */
+    volatile unsigned int owner; /* ticket that holds the lock */
+  } ticket;
+  McsNode * volatile tail; /* last in the queue, NULL if free */
+} Lock;
+
 /* The HashCell structure for global tables*/
 typedef struct HashCell
 {
@@ -75,7 +247,7 @@ typedef struct HashCell
   volatile uint64_t sum4; /* accumulated sum for this cell */
   volatile uint64_t count4; /* accumulated count for this cell */
 
-  MUTEX_T lock; /* mutual exclusion lock. see global.h */
+  Lock lock; /* mutual exclusion lock. see lock.h */
   struct HashCell *next; /* pointer to the next cell in this chain */
 
 } HashCell;
@@ -108,8 +280,11 @@ typedef struct IndependentHashCell
 /* The Concrete datatype that holds aggregation data */
 typedef struct AggregateCDT
 {
-  Tuple *input;  /* the input relation. see global.h */
+  Tuple *input;  /* the input relation as rows, or NULL. see global.h */
+  InputColumns columns; /* the input as the kernels read it. see columns.c */
   HashCell *global_buckets; /* The global hash table */
+  HashCell *node_buckets[MAX_NODES]; /* per node global tables, [0] is global_buckets */
+  char *node_valid[MAX_NODES]; /* their valid vectors, [0] is valid */
   PrivateHashBucket **private_buckets; /* The local tables */  
   IndependentHashCell **independent_cells;
 
@@ -126,6 +301,82 @@ typedef struct AggregateCDT
   unsigned int resample_rate;
   unsigned int n_partitions;
   unsigned int current_partition;
+
+  AggregateOptions opts;
+
+  /* cooperative sampling state */
+  pthread_barrier_t sample_barrier;
+  SampleStats samples[MAX_THREADS]; /* published by each thread */
+  unsigned int *global_access; /* access counts summed over all private tables */
+  unsigned int distinct[MAX_THREADS]; /* distinct keys per slice of buckets */
+
+  /* drift detection state for the resample engine */
+  SampleStats last_sample[MAX_THREADS]; /* last full sample of each thread */
+  Strategy last_strategy[MAX_THREADS];
+  bool have_plan[MAX_THREADS];
+  unsigned int resamples[MAX_THREADS]; /* full samples taken in the last run */
+
+  /* decision trace, one list per thread */
+  TraceRecord *trace[MAX_THREADS];
+  unsigned int n_trace[MAX_THREADS];
+  unsigned int trace_capacity[MAX_THREADS];
+
+  /* measured contention of the current run, per thread */
+  ContentionStats contention[MAX_THREADS];
+  unsigned int feedback_switches[MAX_THREADS]; /* atomic ranges moved to hybrid */
+  McsNode lock_nodes[MAX_THREADS]; /* each thread's queue node for LOCK_MCS */
+
+  struct PoolCDT *pool; /* the worker threads, maybe shared. see pool.c */
+  struct StreamCDT *stream; /* input arriving while we run, or NULL. see stream.c */
+  int cpu_of[MAX_THREADS]; /* processor of each worker, -1 if not bound */
+
+  /* NUMA placement. see numa.c */
+  unsigned int n_nodes; /* nodes the workers are spread over */
+  unsigned int node_of[MAX_THREADS];
+  unsigned int n_tables; /* global tables: n_nodes with node_tables, else 1 */
+  unsigned int table_of[MAX_THREADS]; /* the global table each thread writes to */
+  void *placed_input; /* node local copy of the input rows or columns, or NULL */
+
+  /* chunks of the input with their statistics, to plan from instead of */
+  /* sampling, or NULL. see AggregateChunks */
+  const struct TupFileShard *chunks;
+  const struct TupFileShardStats *chunk_stats;
+  unsigned int n_chunks;
+
+  /* morsel scheduling state, reset by every AggregateRun */
+  MorselQueue queues[MAX_THREADS];
+  unsigned int morsel_size;
+  unsigned int n_morsels;
+  unsigned int steals[MAX_THREADS]; /* morsels taken from other threads */
+
+  /* automatic degree of parallelism. see dop.c */
+  pthread_mutex_t dop_lock;
+  pthread_cond_t dop_wake; /* dop changed or the input ran out */
+  unsigned int dop; /* workers with id < dop take morsels, the others wait */
+  int dop_level; /* thread count being measured, or -1 once settled */
+  unsigned int dop_done; /* morsels of this level finished */
+  uint64_t dop_tuples; /* and their tuples */
+  hrtime_t dop_start; /* when this level started */
+  bool dop_exhausted; /* no morsels left, waiting workers can leave */
+  int dop_of[MAX_THREADS]; /* level of each worker's current morsel, -1 if none */
+  unsigned int dop_size[MAX_THREADS]; /* tuples of each worker's current morsel */
+  double dop_throughput[MAX_THREADS+1]; /* tuples/s measured with k threads, 0 if not */
+
+  /* pipelined merge of the independent tables. see aggregate_partitioned.c */
+  volatile unsigned int merge_arrivals[MAX_THREADS]; /* threads done below each pair */
+
+  /* per thread state of the adaptive engine's bandit */
+  Bandit bandits[MAX_THREADS];
+  unsigned int bandit_slice[MAX_THREADS];
+
+  unsigned int merge_step; /* the merge step the pool is running */
+
+  /* concurrent execution with other aggregates. see sched.c */
+  volatile unsigned int sched_phase; /* 0 aggregating, then merge steps, then done */
+  volatile unsigned int sched_left; /* workers yet to finish the phase */
+  unsigned int sched_done[MAX_THREADS]; /* phases each worker has finished */
+  hrtime_t sched_start, sched_operated, sched_merged;
+  struct BatchCDT *batch; /* the batch this aggregate dispatched, or NULL */
 } AggregateCDT;
 
 typedef struct AggregateCDT *Aggregate;
@@ -143,10 +394,249 @@ typedef struct ThreadInfo
 #endif /* _PROFILE_ */
 } ThreadInfo;
 
+/* Worker threads that run every phase of an aggregate. See pool.c */
+typedef struct PoolCDT
+{
+  unsigned int n_threads;
+  pthread_t *threads;
+  ThreadInfo *info; /* one per worker, handed to the task */
+  void *(*task)(void *); /* the phase being run */
+  volatile bool quit; /* set to make the workers exit */
+  pthread_barrier_t start; /* workers wait here for the next phase */
+  pthread_barrier_t done; /* and here for the others to finish it */
+  bool pinned[MAX_THREADS]; /* did each worker's binding succeed */
+  unsigned int users; /* aggregates running on these workers */
+} PoolCDT;
+
+typedef PoolCDT *Pool;
+
+/*
+ * A bounded ring of input buffers between reader threads and the
+ * aggregation workers. The buffers are consecutive ranges of tuples, so
+ * the ring itself is the aggregate's input. See stream.c
+ */
+typedef struct StreamCDT
+{
+  Tuple *tuples; /* n_slots buffers of slot_size tuples */
+  unsigned int n_slots;
+  unsigned int slot_size;
+  unsigned int *count; /* tuples in each full buffer */
+  unsigned int *free_slots; /* stack of empty buffers */
+  unsigned int n_free;
+  unsigned int *full_slots; /* FIFO of buffers waiting to be aggregated */
+  unsigned int full_head;
+  unsigned int n_full;
+  int held[MAX_THREADS]; /* buffer each worker is aggregating, -1 if none */
+  unsigned int writers; /* readers that haven't closed yet */
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty; /* a buffer was filled or a reader closed */
+  pthread_cond_t not_full; /* a buffer was emptied */
+  uint64_t n_read; /* tuples published */
+  unsigned int n_buffers; /* buffers published */
+  unsigned int reader_waits; /* times a reader found no empty buffer */
+  unsigned int worker_waits; /* times a worker found no full buffer */
+  /* results emitted while running, see StreamEmit */
+  unsigned int workers; /* workers taking buffers */
+  unsigned int finished; /* workers that found the stream done */
+  bool pause; /* workers park at their next buffer */
+  unsigned int epoch; /* pauses so far */
+  unsigned int parked; /* workers parked in this pause */
+  pthread_cond_t parked_cond; /* a worker parked */
+  pthread_cond_t resume; /* the pause is over */
+  unsigned int n_emits; /* emissions written */
+} StreamCDT;
+
+typedef StreamCDT *Stream;
+
+/*
+ * Tuple files: a header that describes the columns, then the data, so a
+ * file can be mapped and used without parsing. A plain column is an
+ * array of 64 bit values starting at offset with stride bytes between
+ * values, so a file of Tuple records is just five columns with stride
+ * sizeof(Tuple). A packed column holds bits-bit numbers back to back in
+ * 64 bit words, plus one spare word; the numbers are the values minus
+ * base, or, for a dictionary column, codes into 2^bits values at
+ * dict_offset. A run-length encoded column holds the value of each of
+ * its base runs at offset and where each run ends (the index of the
+ * tuple after it) at dict_offset. From version 3 every shard (chunk) of
+ * the file also has statistics gathered when it was written, which the
+ * adaptive and resample engines can plan from instead of sampling. See
+ * tupfile.c
+ */
+#define TUPFILE_MAGIC "AGGTUPS" /* 8 bytes with the NUL */
+#define TUPFILE_VERSION (3)
+#define TUPFILE_OLDEST_VERSION (2) /* still read, without statistics */
+#define TUPFILE_BYTE_ORDER (0x01020304) /* reads differently on a foreign machine */
+#define TUPFILE_MAX_COLUMNS (8)
+#define TUPFILE_ALIGN (64) /* the data starts on a cache line */
+#define TUPFILE_MAX_DICT_BITS (24)
+#define TUPFILE_HEAVY (N_MAX_ACCESS) /* heavy hitters kept per shard */
+#define TUPFILE_SOCKET "unix:" /* TupFileAttach: receive the file over this socket */
+
+/* value types of a column */
+typedef enum
+{
+  TUPFILE_UINT64 = 1,
+  TUPFILE_PACKED = 2, /* bit-packed, minus base */
+  TUPFILE_DICT = 3, /* bit-packed codes into a dictionary */
+  TUPFILE_RLE = 4 /* run-length encoded: a value and an end per run */
+} TupFileType;
+
+typedef struct TupFileColumn
+{
+  char name[16]; /* group, value1 .. value4 */
+  uint32_t type; /* TupFileType */
+  uint32_t stride; /* plain: bytes from one value to the next */
+  uint64_t offset; /* of the first value or packed word, from the start of the file */
+  uint32_t bits; /* packed: bits per number */
+  uint32_t padding;
+  uint64_t base; /* TUPFILE_PACKED: added to every number; TUPFILE_RLE: runs */
+  uint64_t dict_offset; /* TUPFILE_DICT: of the 2^bits dictionary values; */
+                        /* TUPFILE_RLE: of the end of every run */
+} TupFileColumn;
+
+/* a range of tuples that was written as a unit, e.g. one input file */
+typedef struct TupFileShard
+{
+  uint64_t first;
+  uint64_t count;
+} TupFileShard;
+
+/* what a shard holds, counted over all of it when it was written */
+typedef struct TupFileShardStats
+{
+  uint64_t min_key;
+  uint64_t max_key;
+  uint64_t distinct; /* estimated distinct keys */
+  uint64_t runs; /* runs of the same key in consecutive tuples */
+  uint32_t sorted; /* are the keys in ascending order? */
+  uint32_t n_heavy; /* entries of heavy_key used */
+  uint64_t heavy_key[TUPFILE_HEAVY]; /* the most frequent keys, most frequent first */
+  uint64_t heavy_count[TUPFILE_HEAVY]; /* and their exact counts */
+} TupFileShardStats;
+
+/* followed by n_columns TupFileColumns, n_shards TupFileShards and, */
+/* from version 3, n_shards TupFileShardStats */
+typedef struct TupFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t n_tuples;
+  uint32_t n_columns;
+  uint32_t n_shards;
+  uint64_t header_size; /* bytes before the data, including the tables */
+} TupFileHeader;
+
+/* an open, mapped tuple file */
+typedef struct TupFileCDT
+{
+  char *map;
+  size_t size;
+  TupFileHeader *header;
+  TupFileColumn *columns;
+  TupFileShard *shards;
+  TupFileShardStats *stats; /* of every shard, NULL in version 2 files */
+  int field[5]; /* column of group, value1 .. value4, -1 if absent */
+} TupFileCDT;
+
+typedef TupFileCDT *TupFile;
+
+/* The input distributions of the paper, by their codes in main.c */
+typedef enum
+{
+  DIST_UNIFORM = 0,
+  DIST_SORTED = 1,
+  DIST_HEAVY_HITTER = 2, /* a fraction of the tuples has key 0 */
+  DIST_REPEATED_RUNS = 3, /* the sorted keys, GEN_REPEATS times over */
+  DIST_ZIPF = 4,
+  DIST_SELF_SIMILAR = 5, /* h = GEN_SELF_SIMILAR_H */
+  N_DISTRIBUTIONS
+} Distribution;
+
+#define GEN_REPEATS (8)
+#define GEN_SELF_SIMILAR_H (0.2)
+
+/*
+ * A seeded generator of tuples. Tuple i only depends on the seed and i,
+ * so any number of threads can fill any ranges and get the same input.
+ * See gen.c
+ */
+typedef struct GeneratorCDT
+{
+  Distribution distribution;
+  uint64_t n_tuples;
+  uint64_t n_groups;
+  uint64_t seed;
+  double theta; /* zipf skew */
+  double heavy; /* fraction of heavy hitters */
+  double *zipf_cdf; /* zipf: P(rank <= r), n_groups entries */
+} GeneratorCDT;
+
+typedef GeneratorCDT *Generator;
+
+/* a mapped file of delimited text, one tuple per line. See text.c */
+typedef struct TextFileCDT
+{
+  const char *path;
+  char *map;
+  size_t size;
+  size_t first; /* offset of the first line after the header, if any */
+  uint64_t n_tuples; /* once parsed */
+} TextFileCDT;
+
+typedef TextFileCDT *TextFile;
+
+#ifndef READER_BLOCK
+#define READER_BLOCK (1 << 20) /* bytes per read of the input files */
+#endif /* READER_BLOCK */
+#define READER_DEPTH (2) /* blocks per file: one is read while one is used */
+#define READER_ALIGN (8192) /* of direct I/O buffers, offsets and lengths */
+
+/*
+ * An input file read ahead of its user in large blocks. An I/O thread
+ * reads the next block while the user takes pairs out of the last one,
+ * bypassing the file system cache where it can. See reader.c
+ */
+typedef struct ReaderCDT
+{
+  int fd;
+  char *path; /* to reopen it if direct reads fail */
+  bool direct; /* reads bypass the file system cache */
+  uint64_t limit; /* bytes to read from the start of the file */
+  char *block[READER_DEPTH];
+  size_t size[READER_DEPTH]; /* bytes read into each full block, 0 at the end */
+  bool full[READER_DEPTH];
+  unsigned int using; /* block the user takes pairs from */
+  size_t pos; /* next byte of it */
+  bool holding; /* the user has block using */
+  bool ended; /* the user saw the end */
+  bool quit;
+  pthread_t io;
+  pthread_mutex_t lock;
+  pthread_cond_t filled; /* a block was read */
+  pthread_cond_t emptied; /* the user is done with a block */
+  uint64_t bytes; /* read so far */
+  hrtime_t busy; /* the I/O thread's time in reads */
+  hrtime_t wait; /* the user's time waiting for blocks */
+} ReaderCDT;
+
+typedef ReaderCDT *Reader;
+
+/* what reading the input files cost, summed over the files */
+typedef struct ReadStats
+{
+  uint64_t bytes;
+  double busy; /* seconds in reads */
+  double wait; /* seconds the users waited for a block */
+  unsigned int files;
+  unsigned int direct; /* files read with direct I/O */
+} ReadStats;
+
 
 /* * * Functions for Clients * * */
 
-extern Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate);
+extern Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate, const AggregateOptions *opts);
 
 extern double AggregateRun(Aggregate a);
 
@@ -160,19 +650,151 @@ extern void AggregateReset(Aggregate a);
 
 extern double AggregateMissRate(Aggregate a);
 
+extern void AggregateOptionsDefault(AggregateOptions *opts);
+
+extern void AggregateTraceWrite(Aggregate a, FILE *f, TraceFormat format);
+
+extern void AggregateContention(Aggregate a, ContentionStats *total);
+
+extern void AggregateReport(Aggregate a, FILE *f);
+
+extern Stream StreamCreate(unsigned int n_slots, unsigned int slot_size, unsigned int writers);
+
+extern Tuple *StreamAcquire(Stream s, unsigned int *slot);
+
+extern void StreamPublish(Stream s, unsigned int slot, unsigned int n);
+
+extern void StreamClose(Stream s);
+
+extern void StreamDelete(Stream s);
+
+extern void AggregateStream(Aggregate a, Stream s);
+
+extern bool StreamEmit(Aggregate a, FILE *f);
+
+extern void AggregateEmit(Aggregate a, FILE *f, unsigned int n, uint64_t tuples);
+
+extern void AggregateColumns(Aggregate a, const InputColumns *columns);
+
+extern void AggregateChunks(Aggregate a, const TupFileShard *chunks, 
+			    const TupFileShardStats *stats, unsigned int n_chunks);
+
+extern Generator GeneratorCreate(Distribution distribution, uint64_t n_tuples, uint64_t n_groups,
+				 uint64_t seed, double theta, double heavy);
+
+extern void GeneratorFill(Generator g, Tuple *tuples, uint64_t start, uint64_t end);
+
+extern Tuple *GeneratorInput(Generator g, int n_threads);
+
+extern void GeneratorColumns(Generator g, int n_threads, InputColumns *columns);
+
+extern void GeneratorDelete(Generator g);
+
+extern TupFile TupFileOpen(const char *path);
+
+extern TupFile TupFileAttach(const char *name);
+
+extern Tuple *TupFileInPlace(TupFile f);
+
+extern void TupFileRead(TupFile f, Tuple *dst, uint64_t start, uint64_t end);
+
+extern bool TupFileColumns(TupFile f, InputColumns *columns);
+
+extern void TupFileWrite(const char *path, const Tuple *tuples, uint64_t n_tuples, 
+			 bool rows, unsigned int n_shards, TupFileType key_type);
+
+extern void TupFileClose(TupFile f);
+
+extern TextFile TextOpen(const char *path);
+
+extern Tuple *TextInput(TextFile t, int n_threads);
+
+extern void TextColumns(TextFile t, int n_threads, InputColumns *columns);
+
+extern void TextClose(TextFile t);
+
+extern Reader ReaderOpen(const char *path, uint64_t limit);
+
+extern uint64_t ReaderPairs(Reader r, Tuple *dst, uint64_t n);
+
+extern void ReaderClose(Reader r, ReadStats *total);
+
+extern void AggregateRunConcurrent(Aggregate *queries, int n, double *exec, double *merge);
+
 /* * * Internal stuff  * * */
 /* TODO these functions, plus structures above could reside in a different header */
 extern Aggregate InitializeAggregate(int n_threads, Tuple *tups, int n_tups, 
-				       int n_groups);
+				       int n_groups, const AggregateOptions *opts);
 
 extern void InitializePrivateTables(Aggregate a);
 
+extern void MorselReset(Aggregate a, const unsigned int min_size);
+
+extern bool MorselNext(Aggregate a, const int id, 
+		       unsigned int *morsel, unsigned int *start, unsigned int *end);
+
+extern bool StreamNext(Aggregate a, const int id, 
+		       unsigned int *morsel, unsigned int *start, unsigned int *end);
+
+extern void DopInit(Aggregate a);
+
+extern void DopReset(Aggregate a);
+
+extern bool DopWait(Aggregate a, const int id);
+
+extern void DopStarted(Aggregate a, const int id, bool found, unsigned int tuples);
+
+extern const char *AffinityName(AffinityPolicy policy);
+
+extern const char *LockName(LockKind kind);
+
+extern void LockWait(Aggregate a, const int id, Lock *l);
+
+extern void LockWake(Aggregate a, const int id, Lock *l);
+
+extern void AffinityPlan(Aggregate a);
+
+extern bool AffinityPin(int cpu);
+
+extern int AffinityNode(int cpu);
+
+extern void NumaPlan(Aggregate a);
+
+extern void NumaPlaceInput(Aggregate a);
+
+extern void AggregateMergeNodes(Aggregate a, const int id);
+
+extern Pool PoolCreate(Aggregate a);
+
+extern void PoolRun(Aggregate a, void *(*task)(void *));
+
+extern double PoolMerge(Aggregate a);
+
+/* implemented by every strategy; see sched.c */
+extern void AggregatePrepare(Aggregate a);
+
+extern bool AggregateStep(Aggregate a, const int id);
+
+extern unsigned int AggregateMergeSteps(Aggregate a);
+
+extern void AggregateMergeStep(Aggregate a, const unsigned int step, const int id);
+
+extern void AggregateFlush(Aggregate a, const int id);
+
+extern void PoolDelete(Pool p);
+
 extern void AggregateAtomic(Aggregate a, const int id, 
 			    const int start, const int end);
 
 extern void AggregateMutex(Aggregate a, const int id, 
 			   const int start, const int end);
 
+extern void AggregateAtomicInterleaved(Aggregate a, const int id, 
+				       const int start, const int end);
+
+extern void AggregateMutexInterleaved(Aggregate a, const int id, 
+				      const int start, const int end);
+
 extern void AggregateHybrid(Aggregate a, const int id, 
 			  const int start, const int end);
 
@@ -182,12 +804,69 @@ extern void AggregateSample(Aggregate a, const int id,
 
 extern void AggregateMergeLite(Aggregate a, const int id);
 
+extern void AggregateMergePrivate(Aggregate a, const int id);
+
+extern void AggregateFlushPrivate(Aggregate a, const int id);
+
+extern void AggregateEstimate(Aggregate a, const int id, 
+			      int hits, int num_runs, 
+			      int n_samples, int n_accesses, SampleStats *s);
+
+extern bool AggregateEstimateChunks(Aggregate a, const unsigned int start, 
+				    const unsigned int end, SampleStats *s);
+
+extern void AggregateEstimateGlobal(Aggregate a, const int id, 
+				    SampleStats *s, SampleStats *global);
+
+extern Strategy AggregateChoose(const SampleStats *s);
+
+extern bool AggregateDrifted(const SampleStats *last, const SampleStats *probe);
+
+extern Strategy AggregateChooseCooperative(Aggregate a, const SampleStats *s, 
+					   const SampleStats *global);
+
+extern Strategy AggregateStrategy(Aggregate a, const int id, Strategy strategy,
+				  const int start, const int end);
+
+extern double ContentionRate(const ContentionStats *c);
+
+extern const char *StrategyName(Strategy strategy);
+
+extern void TraceAdd(Aggregate a, const int id, const int partition,
+		     Strategy strategy, bool resampled, const SampleStats *s,
+		     const int start, const int end, double elapsed);
+
+extern void TraceReset(Aggregate a);
+
+extern void TraceDelete(Aggregate a);
+
 extern void AggregateRuns(Aggregate a, const int id, 
 		   const int start, const int end);
 
 extern void AggregateRunsGlobal(Aggregate a, const int id, 
 		   const int start, const int end);
 
+extern void InitializeIndependentTables(Aggregate a);
+
+extern void ResetIndependentTables(Aggregate a);
+
+extern void AggregateIndependent(Aggregate a, const int id,
+				 const int start, const int end);
+
+extern void AggregateMergeIndependent(Aggregate a, const int id);
+
+extern void AggregateMergeIndependentTable(Aggregate a, const int id);
+
+extern void AggregateFlushIndependent(Aggregate a, const int id);
+
+extern Bandit BanditCreate(unsigned int seed, unsigned int n_morsels);
+
+extern Strategy BanditSelect(Bandit b);
+
+extern void BanditUpdate(Bandit b, Strategy arm, double throughput);
+
+extern void BanditDelete(Bandit b);
+
 extern void DeleteGlobalTable(Aggregate a);
 
 extern void ResetGlobalTable(Aggregate a);
@@ -11,6 +11,19 @@
  * (2) Hits in the table (i.e. items already in the table)
  * (3) Runs of same group-by key in consecutive tuples
  * From these statistics we determine: miss rate. contention. avg run length.
+ *
+ * Optionally the threads pool their samples first (see sample.c), so
+ * that contention is judged on the whole input rather than one chunk.
+ *
+ * Alternatively, each thread can skip the model and let a bandit pick
+ * between runs, hybrid, atomic and partitioned by the throughput each
+ * one reaches on slices of its input (see bandit.c).
+ *
+ * Threads take their input as morsels (see morsel.c). A thread samples
+ * its first morsel and runs its plan on every morsel it gets after that,
+ * including stolen ones. If the input came with chunk statistics (see
+ * AggregateChunks), nothing is sampled: every morsel is planned from the
+ * statistics of the chunks it overlaps.
  */
 
 #include "aggregate.h"
@@ -28,35 +41,71 @@
 
 #ifdef _PROFILE_
 #include <libcpc.h>
-#endif _PROFILE_
+#endif /* _PROFILE_ */
 
 /* Create a new aggregation object and return it to the caller */
-Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate /* ignored */)
+Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate /* ignored */, const AggregateOptions *opts)
 {
   register int i, j, k;
 
   Aggregate a;
 
-  a = InitializeAggregate(n_threads, tups, n_tups, n_groups);
+  a = InitializeAggregate(n_threads, tups, n_tups, n_groups, opts);
 
   InitializePrivateTables(a);
 
+  if(a->opts.cooperative != COOP_OFF)
+    {
+      /* threads meet after sampling to pool their statistics */
+      a->global_access = (unsigned int*)malloc(sizeof(unsigned int) * a->n_private_buckets);
+      assert(a->global_access);
+      pthread_barrier_init(&a->sample_barrier, NULL, a->n_threads);
+    }
+
+  if(a->opts.bandit)
+    InitializeIndependentTables(a); /* for the partitioned arm */
+
   return a;
 }
 
-/* static function that performs the aggregation for one thread */
-static void AggregateOperate(Aggregate a, const int id)
+/* Let the bandit of thread id choose the strategy for every */
+/* BANDIT_MORSEL tuples of a morsel */
+static void AggregateBandit(Aggregate a, const int id,
+			    const unsigned int start, const unsigned int end)
+{
+  unsigned int m, m_end;
+  hrtime_t begin;
+  double elapsed;
+  Strategy arm;
+  Bandit b = a->bandits[id];
+
+  for(m = start; m <= end; m = m_end + 1, a->bandit_slice[id]++)
+    {
+      m_end = (end - m < BANDIT_MORSEL) ? end : m + BANDIT_MORSEL - 1;
+      arm = BanditSelect(b);
+
+      begin = gethrtime();
+      AggregateStrategy(a, id, arm, m, m_end);
+      elapsed = (gethrtime() - begin)/1000000000.0;
+
+      if(elapsed > 0.0)
+	BanditUpdate(b, arm, (m_end - m + 1) / elapsed);
+      TraceAdd(a, id, a->bandit_slice[id], arm, false, NULL, m, m_end, elapsed);
+    }
+}
+
+/* sample the start of the first morsel, which is always our own, and */
+/* make the plan for the rest of it and every morsel after it */
+static void AggregatePlan(Aggregate a, const int id, const unsigned int morsel,
+			  const unsigned int start, const unsigned int end)
 {
-  register unsigned int i, j, k;
-  
   int hits = 0;
   int num_runs = 1;
-  
-  const unsigned int chunkSize = a->n_tups/a->n_threads;
-  const unsigned int start = id * chunkSize;
-  const unsigned int end = (id == a->n_threads-1) ? a->n_tups-1: chunkSize*(id+1)-1;
-  const int warmup_end = start + WARMUP; 
-  const int sample_end = warmup_end + SAMPLE_SIZE;
+  int warmup_end, sample_end;
+  hrtime_t begin = gethrtime();
+
+  warmup_end = (start + WARMUP > end + 1) ? end + 1 : start + WARMUP; 
+  sample_end = (warmup_end + SAMPLE_SIZE > end + 1) ? end + 1 : warmup_end + SAMPLE_SIZE;
 
   AggregateSample(a, id, 
 		  start, warmup_end-1, 
@@ -67,62 +116,145 @@ static void AggregateOperate(Aggregate a, const int id)
 		  warmup_end, sample_end - 1, 
 		  &hits, &num_runs);
 
-  /* calculate the max accesses */
-  int max[7];
-  for(i = 0; i < 7; i++)
-    max[i] = 0; //init to 0
-  for(i = 0; i < a->n_private_buckets; i++)    
-    for(j = 0; j < 7; j++)       
-      /* check all maxes */
-      if(max[j] < a->private_buckets[id][i].access_count)
-	{
-	  /* found this value's spot */
-	  /* slide all others down */
-	  for( k = 7-1; k > j; k--)
-	    max[k] = max[k-1];
-	  max[j] = a->private_buckets[id][i].access_count;
-	}
+  SampleStats stats, global;
+  Strategy strategy;
+
+  AggregateEstimate(a, id, hits, num_runs, sample_end - warmup_end, sample_end - start, &stats);
 
-  double estimate_sum = 0.0;
-  double f;
-  for(i = 0; i < 7; i++)
+  if(a->opts.cooperative != COOP_OFF)
     {
-      f = (double)max[i]/( SAMPLE_SIZE + WARMUP);
-      if( f >= 1.0/7.58)
-	{
-	  estimate_sum += 25.1 *f - 3.31;
-	}
-      else
+      /* pool the samples of all threads before deciding */
+      AggregateEstimateGlobal(a, id, &stats, &global);
+      strategy = AggregateChooseCooperative(a, &stats, &global);
+    }
+  else
+    {
+      strategy = AggregateChoose(&stats);
+    }
+
+  strategy = AggregateStrategy(a, id, strategy, sample_end, end);
+
+  TraceAdd(a, id, morsel, strategy, true, &stats, start, end, 
+	   (gethrtime() - begin)/1000000000.0);
+
+  a->last_sample[id] = stats;
+  a->last_strategy[id] = strategy;
+  a->have_plan[id] = true;
+  a->hits[id] = hits;
+}
+
+/* plan a morsel from the statistics of its chunks; false if there are none */
+static bool AggregatePlanChunks(Aggregate a, const int id, const unsigned int morsel,
+				const unsigned int start, const unsigned int end)
+{
+  SampleStats stats;
+  Strategy strategy;
+  hrtime_t begin = gethrtime();
+
+  if(!AggregateEstimateChunks(a, start, end, &stats))
+    return false;
+
+  strategy = AggregateStrategy(a, id, AggregateChoose(&stats), start, end);
+
+  TraceAdd(a, id, morsel, strategy, true, &stats, start, end, 
+	   (gethrtime() - begin)/1000000000.0);
+
+  if(!a->have_plan[id])
+    a->hits[id] = (1.0 - stats.missrate) * SAMPLE_SIZE;
+  a->last_sample[id] = stats;
+  a->last_strategy[id] = strategy;
+  a->have_plan[id] = true;
+  return true;
+}
+
+/*
+ * Aggregate one morsel as thread id. The first morsel a thread gets is
+ * sampled (or it starts its bandit); the rest, and any it steals, follow
+ * the same plan. When there are none left, finish the thread's part and
+ * return false.
+ */
+bool AggregateStep(Aggregate a, const int id)
+{
+  unsigned int morsel, start, end;
+  hrtime_t begin = gethrtime();
+
+  /* (a stream may run dry before every thread got a buffer) */
+  if(!MorselNext(a, id, &morsel, &start, &end))
+    {
+      if(a->opts.bandit)
+	BanditDelete(a->bandits[id]);
+      if(a->opts.pipelined)
 	{
-	  break; //no subsequent max will meet the threshold, either.
+	  /* don't wait for the stragglers, merge while they finish */
+	  AggregateMergePrivate(a, id);
+	  if(a->opts.bandit)
+	    AggregateMergeIndependentTable(a, id);
 	}
+      return false;
     }
 
-  double avg_run_length = (double)(SAMPLE_SIZE + WARMUP) / num_runs;
-  double missrate = ( (double)( SAMPLE_SIZE - hits) )/(SAMPLE_SIZE);
-
-  if(avg_run_length > 1.142857) // 8/7
+  if(a->opts.bandit)
+    AggregateBandit(a, id, start, end);
+  else if(a->chunks && AggregatePlanChunks(a, id, morsel, start, end))
+    ;
+  else if(!a->have_plan[id])
+    AggregatePlan(a, id, morsel, start, end);
+  else
     {
-      /* Runs are present */
-      AggregateRuns(a, id, sample_end, end);
+      a->last_strategy[id] = AggregateStrategy(a, id, a->last_strategy[id], start, end);
+      TraceAdd(a, id, morsel, a->last_strategy[id], false, &(a->last_sample[id]), start, end, 
+	       (gethrtime() - begin)/1000000000.0);
     }
-  //  else if(missrate < 0.5 || max > (SAMPLE_SIZE + WARMUP)/16)
-  else if (missrate < 0.5 || estimate_sum >= 1.0)
+  return true;
+}
+
+void AggregatePrepare(Aggregate a)
+{
+  register int i;
+
+  TraceReset(a);
+  MorselReset(a, MIN_MORSEL);
+  for(i = 0; i < a->n_threads; i++)
     {
-      /* locallity or contention */
-      AggregateHybrid(a, id, sample_end, end);
+      a->have_plan[i] = false;
+      a->hits[i] = 0;
+      if(a->opts.bandit)
+	{
+	  a->bandits[i] = BanditCreate(i + 1, (a->n_tups / a->n_threads) / BANDIT_MORSEL + 1);
+	  a->bandit_slice[i] = 0;
+	}
     }
-  else
+}
+
+/* private tables into the global table (unless pipelined runs already */
+/* did), then per node global tables into table 0 */
+unsigned int AggregateMergeSteps(Aggregate a)
+{
+  return (a->opts.pipelined ? 0 : 1) + ((a->n_tables > 1) ? 1 : 0);
+}
+
+void AggregateMergeStep(Aggregate a, const unsigned int step, const int id)
+{
+  if(step == 0 && !a->opts.pipelined)
     {
-      /* no locallity or contention, use global table */
-      AggregateAtomic(a, id, sample_end, end);
+      AggregateMergeLite(a, id);
+      if(a->opts.bandit)
+	AggregateMergeIndependent(a, id);
     }
-  
-  a->hits[id] = hits;
+  else
+    AggregateMergeNodes(a, id);
+}
+
+/* my private (and independent) table into the global table, see StreamEmit */
+void AggregateFlush(Aggregate a, const int id)
+{
+  AggregateFlushPrivate(a, id);
+  if(a->opts.bandit)
+    AggregateFlushIndependent(a, id);
 }
 
 /* stub for thread to start in */
-void * run_operate(void *v)
+static void * run_operate(void *v)
 {
   ThreadInfo* info = (ThreadInfo*)v;
 
@@ -144,7 +276,8 @@ void * run_operate(void *v)
   cpc_bind_curlwp(my_cpc, my_set, 0);
 #endif /* _PROFILE_ */
 
-  AggregateOperate(info->a, info->id);
+  while(AggregateStep(info->a, info->id))
+    ;
 
 #ifdef _PROFILE_
   cpc_set_sample(my_cpc, my_set, cpc_buffer);
@@ -161,57 +294,39 @@ void * run_operate(void *v)
   return NULL;
 }
 
-/* stub for thread to start in for table merge */
-void * run_merge(void *v)
-{
-  ThreadInfo* info = (ThreadInfo*)v;
-  AggregateMergeLite(info->a, info->id);
-  return NULL;
-}
-
 /* global entry point for running an aggregate */
-/* creates threads that acutally do the aggregate, then collects them */
+/* runs the aggregate on the worker pool */
 /* times aggregation */
 double AggregateRun(Aggregate a)
 {
-  int i, r;
+#ifdef _PROFILE_
+  int i;
+  ThreadInfo *info = a->pool->info;
+#endif /* _PROFILE_ */
   double elapsed;
   Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
 
   timer = TimerCreate();
 
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-
 #ifdef _PROFILE_
   cpc_t *my_cpc = cpc_open(CPC_VER_CURRENT);
   assert(my_cpc);
   char* event = "L2_dmiss_ld";
 #endif /* _PROFILE_ */
 
+  AggregatePrepare(a);
+
   TimerStart(timer);
 
-  /* set up thread info and start threads */  
+#ifdef _PROFILE_
   for(i = 0; i < a->n_threads; i++)
     {
-      info[i].id = i;
-      info[i].a = a;
-#ifdef _PROFILE_
       info[i].cpc = my_cpc;
       info[i].event = event;
-#endif /* _PROFILE_ */
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_operate, 
-			 &info[i]);
-      assert(r==0);
     }
-    /* join the theads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
+#endif /* _PROFILE_ */
+
+  PoolRun(a, run_operate);
 
   TimerStop(timer);
   elapsed = TimerElapsed(timer);
@@ -233,54 +348,13 @@ double AggregateRun(Aggregate a)
 #endif /* _PROFILE */
 
   TimerDelete(timer);
-  free(threads);
-  free(info);
 
   return elapsed;
 }
 
 double AggregateMerge(Aggregate a)
 {
-  int i, r;
-  double elapsed;
-  Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
-  
-  timer = TimerCreate();
-  
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-  
-  TimerStart(timer);
-  
-    /* respawn threads to do the merge */
-  for(i = 0; i < a->n_threads; i++)
-    {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_merge, 
-			 &info[i]);
-      assert(r==0);
-    }
-
-  /* join threads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
-
-
-  TimerStop(timer);
-  elapsed = TimerElapsed(timer);
-
-  /* clean up */
-  TimerDelete(timer);
-  free(threads);
-  free(info);
-
-  return elapsed;
+  return PoolMerge(a);
 }
 
 
@@ -317,13 +391,23 @@ void AggregateReset(Aggregate a)
 {
   ResetGlobalTable(a);
   ResetPrivateTables(a);
+  if(a->opts.bandit)
+    ResetIndependentTables(a);
 }
 
 /* Clean up and free the table */
 void AggregateDelete(Aggregate a)
 {
   /* TODO -- free chained buckets */
+  if(a->opts.cooperative != COOP_OFF)
+    {
+      pthread_barrier_destroy(&a->sample_barrier);
+      free(a->global_access);
+    }
+  TraceDelete(a);
   free(a->global_buckets);
+  free(a->placed_input);
+  PoolDelete(a->pool);
   free(a);
 }
 
@@ -21,136 +21,101 @@
 #include <mtmalloc.h>
 
 /* Create a new aggregation object and return it to the caller */
-Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate /* ignored */)
+Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate /* ignored */, const AggregateOptions *opts)
 {
   register int i, j, k;
 
   Aggregate a;
-  a = InitializeAggregate(n_threads, tups, n_tups, n_groups);
+  a = InitializeAggregate(n_threads, tups, n_tups, n_groups, opts);
 
   InitializePrivateTables(a);
 
   return a;
 }
 
-/* static function that performs the aggregation for one thread */
-static void AggregateOperate(Aggregate a, const int id)
+/* Aggregate one morsel as thread id. When there are none left, finish */
+/* the thread's part and return false. */
+bool AggregateStep(Aggregate a, const int id)
 {
-  register unsigned int i;
-  
-  const unsigned int chunkSize = a->n_tups/a->n_threads;
-  const unsigned int start = id * chunkSize;
-  const unsigned int end = (id == a->n_threads-1) ? a->n_tups-1: chunkSize*(id+1)-1;
+  unsigned int morsel, start, end;
 
-  AggregateHybrid(a, id, start, end);  
+  if(MorselNext(a, id, &morsel, &start, &end))
+    {
+      AggregateHybrid(a, id, start, end);
+      return true;
+    }
+  if(a->opts.pipelined)
+    {
+      /* don't wait for the stragglers, merge while they finish */
+      AggregateMergePrivate(a, id);
+    }
+  return false;
 }
 
-/* stub for thread to start in */
-void * run_operate(void *v)
+void AggregatePrepare(Aggregate a)
 {
-  ThreadInfo* info = (ThreadInfo*)v;
-  AggregateOperate(info->a, info->id);
-  return NULL;
+  MorselReset(a, MIN_MORSEL);
 }
 
-/* stub for thread to start in for table merge */
-void * run_merge(void *v)
+/* private tables into the global table (unless pipelined runs already */
+/* did), then per node global tables into table 0 */
+unsigned int AggregateMergeSteps(Aggregate a)
+{
+  return (a->opts.pipelined ? 0 : 1) + ((a->n_tables > 1) ? 1 : 0);
+}
+
+void AggregateMergeStep(Aggregate a, const unsigned int step, const int id)
+{
+  if(step == 0 && !a->opts.pipelined)
+    AggregateMergeLite(a, id);
+  else
+    AggregateMergeNodes(a, id);
+}
+
+/* my private table into the global table, see StreamEmit */
+void AggregateFlush(Aggregate a, const int id)
+{
+  AggregateFlushPrivate(a, id);
+}
+
+/* stub for thread to start in */
+static void * run_operate(void *v)
 {
   ThreadInfo* info = (ThreadInfo*)v;
-  AggregateMergeLite(info->a, info->id);
+  while(AggregateStep(info->a, info->id))
+    ;
   return NULL;
 }
 
 /* global entry point for running an aggregate */
-/* creates threads that acutally do the aggregate, then collects them */
+/* runs the aggregate on the worker pool */
 /* times aggregation */
 double AggregateRun(Aggregate a)
 {
-  int i, r;
   double elapsed;
   Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
 
   timer = TimerCreate();
 
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-
   //  printf("Aggregating!\n");
 
+  AggregatePrepare(a);
   TimerStart(timer);
 
-  /* set up thread info and start threads */  
-  for(i = 0; i < a->n_threads; i++)
-    {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_operate, 
-			 &info[i]);
-      assert(r==0);
-    }
-
-    /* join the theads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
+  PoolRun(a, run_operate);
 
   TimerStop(timer);
   elapsed = TimerElapsed(timer);
 
   /* clean up */
   TimerDelete(timer);
-  free(threads);
-  free(info);
 
   return elapsed;
 }
 
 double AggregateMerge(Aggregate a)
 {
-  int i, r;
-  double elapsed;
-  Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
-
-  timer = TimerCreate();
-
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-
-
-  TimerStart(timer);
-  /* spawn threads to do the merge */
-  for(i = 0; i < a->n_threads; i++)
-    {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_merge, 
-			 &info[i]);
-      assert(r==0);
-    }
-
-  /* join threads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
-
-
-  TimerStop(timer);
-  elapsed = TimerElapsed(timer);
-
-  /* clean up */
-  TimerDelete(timer);
-  free(threads);
-  free(info);
-
-  return elapsed;
+  return PoolMerge(a);
 }
 
 /* Print out the contents of the valid hash table buckets */
@@ -192,6 +157,8 @@ void AggregateDelete(Aggregate a)
 {
   /* TODO -- free chained buckets */
   free(a->global_buckets);
+  free(a->placed_input);
+  PoolDelete(a->pool);
   free(a);
 }
 
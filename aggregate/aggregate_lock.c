@@ -22,79 +22,79 @@
 
 
 /* Create a new aggregation object and return it to the caller */
-Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate /* ignored */)
+Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate /* ignored */, const AggregateOptions *opts)
 {
-  return InitializeAggregate(n_threads, tups, n_tups, n_groups);
+  return InitializeAggregate(n_threads, tups, n_tups, n_groups, opts);
 }
 
-/* static function that performs the aggregation for one thread */
-static void AggregateOperate(Aggregate a, const int id)
+/* Aggregate one morsel as thread id. False when there are none left. */
+bool AggregateStep(Aggregate a, const int id)
 {
-  // Processing chunks of tuples
-  const unsigned int chunkSize = a->n_tups/a->n_threads;
-  const unsigned int start = id * chunkSize;
-  const unsigned int end = (id == a->n_threads-1) ? a->n_tups-1: chunkSize*(id+1)-1;
-  
+  unsigned int morsel, start, end;
+
+  if(!MorselNext(a, id, &morsel, &start, &end))
+    return false;
   AggregateMutex(a, id, start, end);
+  return true;
+}
+
+void AggregatePrepare(Aggregate a)
+{
+  MorselReset(a, MIN_MORSEL);
+}
+
+/* only per node global tables need merging */
+unsigned int AggregateMergeSteps(Aggregate a)
+{
+  return (a->n_tables > 1) ? 1 : 0;
+}
+
+void AggregateMergeStep(Aggregate a, const unsigned int step, const int id)
+{
+  AggregateMergeNodes(a, id);
+}
+
+/* threads aggregate straight into the global table */
+void AggregateFlush(Aggregate a, const int id)
+{
 }
 
 /* stub for thread to start in */
-void * run_operate(void *v)
+static void * run_operate(void *v)
 {
   ThreadInfo* info = (ThreadInfo*)v;
-  AggregateOperate(info->a, info->id);
+  while(AggregateStep(info->a, info->id))
+    ;
   return NULL;
 }
 
 /* global entry point for running an aggregate */
-/* creates threads that acutally do the aggregate, then collects them */
+/* runs the aggregate on the worker pool */
 /* times aggregation */
 double AggregateRun(Aggregate a)
 {
-  int i, r;
   double elapsed;
   Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
 
   timer = TimerCreate();
 
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-
+  AggregatePrepare(a);
   TimerStart(timer);
 
-  /* set up thread info and start threads */  
-  for(i = 0; i < a->n_threads; i++)
-    {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_operate, 
-			 &info[i]);
-      assert(r==0);
-    }
-
-    /* join the theads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
+  PoolRun(a, run_operate);
 
   TimerStop(timer);
   elapsed = TimerElapsed(timer);
 
   /* clean up */
   TimerDelete(timer);
-  free(threads);
-  free(info);
 
   return elapsed;
 }
 
 double AggregateMerge(Aggregate a)
 {
-  return 0.0;
+  return PoolMerge(a);
 }
 
 /* Print out the contents of the valid hash table buckets */
@@ -136,6 +136,8 @@ void AggregateDelete(Aggregate a)
 {
   /* TODO -- free chained buckets */
   free(a->global_buckets);
+  free(a->placed_input);
+  PoolDelete(a->pool);
   free(a);
 }
 
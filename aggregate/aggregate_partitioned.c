@@ -10,6 +10,7 @@
 #include "global.h"
 #include "timer.h"
 
+#include <atomic.h>
 #include <thread.h>
 #include <pthread.h>
 #include <assert.h>
@@ -18,195 +19,36 @@
 #include <mtmalloc.h>
 #include <math.h>
 
-void * run_init(void *v)
-{
-  register int i;
-  ThreadInfo *info = (ThreadInfo*)v;
-  Aggregate a = info->a;
-  const int id = info->id;
-
-  for(i = 0 ; i < a->n_buckets; i++)
-    {
-      a->independent_cells[id][i].valid = 0;
-      a->independent_cells[id][i].next = NULL;
-    }
-
-  return NULL;
-}
-
 /* Create a new aggregation object and return it to the caller */
-Aggregate AggregateCreate(int n_threads, Tuple *tups, int n_tups, int n_groups, int resample_rate /* ignored */)
+Aggregate AggregateCreate(int n_threads, Tuple *tups, int n_tups, int n_groups, int resample_rate /* ignored */, const AggregateOptions *opts)
 {
-  register int i, j;
   Aggregate a;
   assert(n_threads > 0);
 
-  a = (Aggregate)malloc(sizeof(AggregateCDT));
+  a = (Aggregate)calloc(1, sizeof(AggregateCDT));
+  if(opts)
+    a->opts = *opts;
+  else
+    AggregateOptionsDefault(&(a->opts));
   a->n_threads = n_threads;
   a->n_tups = n_tups;
   a->input = tups;
+  if(tups)
+    a->columns = RowColumns(tups);
 
   // We assume that the number of groups is a power of 2
   //a->n_buckets = 1 << 17;
   a->n_buckets = (n_groups < 32) ? 32 : n_groups * 2;
   a->lg_buckets = log2(a->n_buckets);
 
-  /* allocate the pointers to the hash tables */
-  a->independent_cells = (IndependentHashCell**)malloc(sizeof(IndependentHashCell*) * a->n_threads);
-  assert(a->independent_cells);
-  char* ptr = (char*)malloc( (sizeof(IndependentHashCell)*a->n_buckets+8192+64) * a->n_threads); // we allocate extra to allow for setting the alignment.
-  assert(ptr);  
-
-  /* Initialize the table */
-  /* TODO: If we are going to include initialization time in the */
-  /*       running time, then this should be done in parallel */
-  for(i = 0; i < n_threads; i++)
-    {
-      /* Ken noticed that there is an alignment issue, this fixes it */
-      // align to the 64 byte L2 cache, choose a different offset in the 8K L1.
-      a->independent_cells[i] = (IndependentHashCell*) ((unsigned long)(ptr + (i * (a->n_buckets * sizeof(IndependentHashCell) + 8192 + 64) ) + i*(8192 / n_threads ) ) & (~63));
-      
-    }
-
-  if(a->n_buckets < 1000)
-    {
-      /* do serially */
-       for(i = 0; i < n_threads; i++)
-	 {
-	   
-	   for(j = 0 ; j < a->n_buckets; j++)
-	     {
-	       a->independent_cells[i][j].valid = 0;
-	       a->independent_cells[i][j].next = NULL;
-	     }
-	 }
-    }
-  else
-    {
-      /* do with all threads */
-      ThreadInfo *info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_buckets);
-      pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_buckets);
-      assert(info && threads);
-      
-      for(i = 0; i < a->n_threads; i++)
-	{
-	  info[i].id = i;
-	  info[i].a = a;
-	  pthread_create(&threads[i], NULL, run_init, &info[i]);
-	}
-      
-      for(i = 0; i < a->n_threads; i++)
-	pthread_join(threads[i], NULL);
-      free(info);
-      free(threads);
-    }
+  PoolCreate(a);
+  if(a->opts.numa)
+    NumaPlaceInput(a);
+  InitializeIndependentTables(a);
 
   return a;
 }
 
-/* static function that performs the aggregation for one thread */
-static void AggregateOperate(Aggregate a, const int id)
-{
-  register unsigned int i, index;
-  register IndependentHashCell *current, *prev;
-
-  /* place oft used info in local variables */
-  register const int lg_buckets = a->lg_buckets;
-  register const Tuple* input = a->input;
-  register IndependentHashCell *buckets = a->independent_cells[id];
-
-  const unsigned int chunkSize = a->n_tups/a->n_threads;
-  register const unsigned int start = id * chunkSize;
-  register const unsigned int end = (id == a->n_threads-1) ? a->n_tups-1: chunkSize*(id+1)-1;
-
-  for(i = start; i <= end; i++)
-    {
-      index = mhash(input[i].group, lg_buckets);
-      if(buckets[index].valid == 0)
-	{
-	  /* unused slot, add our info and we're done */
-	  buckets[index].key = input[i].group;
-
-	  buckets[index].sum1 = input[i].value1;
-	  buckets[index].count1 = 1;
-	  buckets[index].squares1 = input[i].value1 * input[i].value1;
-
-	  buckets[index].sum2 = input[i].value2;
-	  buckets[index].count2 = 1;
-	  buckets[index].squares2 = input[i].value2 * input[i].value2;
-
-	  buckets[index].sum3 = input[i].value3;
-	  buckets[index].count3 = 1;
-	  buckets[index].squares3 = input[i].value3 * input[i].value3;
-
-	  buckets[index].sum4 = input[i].value4;
-	  buckets[index].count4 = 1;
-
-	  buckets[index].next = NULL;
-	  buckets[index].valid = 1;
-	}	   
-      else
-	{
-	  /* the bucket is valid, so look at the chain*/
-	  current = &buckets[index];
-	  prev = NULL;
-
-	  /* is key already there? */
-	  while(current!=NULL && current->key != input[i].group)
-	    {
-	      prev = current;
-	      current = current->next;	      
-	    }
-	  
-	  if(current)
-	    {	   
-	      /* Found key -- update aggregate */
-	      current->sum1 += input[i].value1;	
-	      current->count1 ++;
-	      current->squares1 += input[i].value1 * input[i].value1;
-
-	      current->sum2 += input[i].value2;	
-	      current->count2 ++;
-	      current->squares2 += input[i].value2 * input[i].value2;
-
-	      current->sum3 += input[i].value3;	
-	      current->count3 ++;
-	      current->squares3 += input[i].value3 * input[i].value3;
-
-	      current->sum4 += input[i].value4;	
-	      current->count4 ++;
-
-	    }
-	  else
-	    {	 
-	      /* Didn't find key, allocate new cell */
-	      current  = (IndependentHashCell*)malloc(sizeof(IndependentHashCell));
-	      assert(current);
-	      current->key = input[i].group;
-
-	      current->sum1 = input[i].value1;
-	      current->count1 = 1;
-	      current->squares1 = input[i].value1 * input[i].value1;
-
-	      current->sum2 = input[i].value2;
-	      current->count2 = 1;
-	      current->squares2 = input[i].value2 * input[i].value2;
-
-	      current->sum3 = input[i].value3;
-	      current->count3 = 1;
-	      current->squares3 = input[i].value3 * input[i].value3;
-
-	      current->sum4 = input[i].value4;
-	      current->count4 = 1;
-
-	      //add to front
-	      current->next = buckets[index].next;	      
-	      buckets[index].next = current;
-	    } 
-	}    
-    }    
-}
-
 /* append or update the contents of p into d and its chain */
 static void update_or_append(IndependentHashCell *d, IndependentHashCell *p)
 {
@@ -322,109 +164,131 @@ static void Merge(Aggregate a, const int id)
     }
 }
 
-/* stub for thread to start in for aggregation */
-void * run_operate(void *v)
+/* put all of table src into table dst */
+static void MergeTable(Aggregate a, const int dst, const int src)
 {
-  ThreadInfo* info = (ThreadInfo*)v;
-  AggregateOperate(info->a, info->id);
-  return NULL;
-}
+  int bucket;
+  IndependentHashCell *p;
 
-/* stub for thread to start in for table merge */
-void * run_merge(void *v)
-{
-  ThreadInfo* info = (ThreadInfo*)v;
-  Merge(info->a, info->id);
-  return NULL;
+  for(bucket = 0; bucket < a->n_buckets; bucket++)
+    if(a->independent_cells[src][bucket].valid == 1)
+      for(p = &(a->independent_cells[src][bucket]); p != NULL; p = p->next)
+	update_or_append(&(a->independent_cells[dst][bucket]), p);
 }
 
-double AggregateRun(Aggregate a)
+/*
+ * Pipelined merge: the tables are reduced pairwise up a binary tree while
+ * slower threads are still aggregating. At the level with stride s, table
+ * lo (a multiple of 2s) absorbs table hi = lo + s. Every pair has an
+ * arrival counter, indexed by hi since hi identifies the pair. The two
+ * threads that finish the subtrees under a pair both bump it; the first
+ * one to arrive is done, the second merges hi into lo and carries lo up
+ * to the next level. Nobody waits, and table 0 holds the result once the
+ * last thread is done.
+ */
+static void MergeTree(Aggregate a, const int id)
 {
-  int i, r;
-  double elapsed;
-  Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
+  unsigned int mine = id, stride, lo, hi;
 
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-
-  timer = TimerCreate();
+  for(stride = 1; stride < a->n_threads; stride <<= 1)
+    {
+      if(mine & stride)
+	hi = mine;
+      else
+	hi = mine + stride;
+      if(hi >= a->n_threads)
+	continue; /* no partner at this level, carry my table up */
+      lo = hi - stride;
+
+      /* publish my table before the partner can see my arrival */
+      membar_producer();
+      if(atomic_inc_uint_nv(&(a->merge_arrivals[hi])) == 1)
+	return;
+      membar_consumer();
+
+      MergeTable(a, lo, hi);
+      mine = lo;
+    }
+}
 
-  TimerStart(timer);
+/* Aggregate one morsel as thread id. When there are none left, finish */
+/* the thread's part and return false. */
+bool AggregateStep(Aggregate a, const int id)
+{
+  unsigned int morsel, start, end;
 
-  /* set up thread info and start threads */
-  for(i = 0; i < a->n_threads; i++)
+  if(MorselNext(a, id, &morsel, &start, &end))
     {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_operate, 
-			 &info[i]);
-      assert(r==0);
+      AggregateIndependent(a, id, start, end);
+      return true;
     }
-  
-  /* join threads */
+  if(a->opts.pipelined)
+    MergeTree(a, id);
+  return false;
+}
+
+void AggregatePrepare(Aggregate a)
+{
+  int i;
+
+  MorselReset(a, MIN_MORSEL);
   for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
+    a->merge_arrivals[i] = 0;
+}
 
+/* pipelined runs reduced the tables while aggregating */
+unsigned int AggregateMergeSteps(Aggregate a)
+{
+  return a->opts.pipelined ? 0 : 1;
+}
 
+void AggregateMergeStep(Aggregate a, const unsigned int step, const int id)
+{
+  Merge(a, id);
+}
 
-  TimerStop(timer);
-  elapsed = TimerElapsed(timer);
+/* there is no global table to emit from; main doesn't stream unbounded */
+/* input into this strategy */
+void AggregateFlush(Aggregate a, const int id)
+{
+  assert(false);
+}
 
-  /* clean up */
-  TimerDelete(timer);
-  free(threads);
-  free(info);
-  
-  return elapsed;
+/* stub for thread to start in for aggregation */
+static void * run_operate(void *v)
+{
+  ThreadInfo* info = (ThreadInfo*)v;
+  while(AggregateStep(info->a, info->id))
+    ;
+  return NULL;
 }
 
-double AggregateMerge(Aggregate a)
+double AggregateRun(Aggregate a)
 {
-  int i, r;
   double elapsed;
   Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
-
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
 
   timer = TimerCreate();
 
+  AggregatePrepare(a);
   TimerStart(timer);
-  /* respawn threads to do the merge */
-  for(i = 0; i < a->n_threads; i++)
-    {    
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_merge, 
-			 &info[i]);
-      assert(r==0);
-    }
 
-  /* join threads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL); 
+  PoolRun(a, run_operate);
 
   TimerStop(timer);
   elapsed = TimerElapsed(timer);
-  
+
   /* clean up */
   TimerDelete(timer);
-  free(threads);
-  free(info);
   
   return elapsed;
 }
 
+double AggregateMerge(Aggregate a)
+{
+  return PoolMerge(a);
+}
+
 /* Print out the contents of the valid hash table buckets */
 void AggregatePrint(Aggregate a)
 {
@@ -456,29 +320,7 @@ void AggregatePrint(Aggregate a)
 
 void AggregateReset(Aggregate a)
 {
-  //TODO Delete memory...
-  for(int i = 0; i < a->n_threads; i++)
-    for(int j = 0; j < a->n_buckets; j++)
-    {
-      if(a->independent_cells[i][j].valid)
-	{
-	  IndependentHashCell *cur, *prev;
-	  prev = NULL;
-	  cur = a->independent_cells[i][j].next;
-	  while(cur != NULL)
-	    {
-	      if(prev != NULL)
-		free(prev);
-	      prev = cur;
-	      cur = cur->next;
-	    }
-	  if(prev != NULL)
-	    free(prev);
-	}
-
-      a->independent_cells[i][j].valid = 0;
-      a->independent_cells[i][j].next = NULL;
-    }
+  ResetIndependentTables(a);
 }
 
 /* Clean up and free the table */
@@ -489,6 +331,8 @@ void AggregateDelete(Aggregate a)
   for(i = 0; i < a->n_threads; i++)
     free( a->independent_cells[i]);
   free(a->independent_cells);
+  free(a->placed_input);
+  PoolDelete(a->pool);
   free(a);
 }
 double AggregateMissRate(Aggregate a)
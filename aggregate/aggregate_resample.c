@@ -8,6 +8,18 @@
  * determine an estimate of the distribution. The sampling is repeated
  * k times to adjust to changing distributions.
  *
+ * With drift detection on, a thread that already has a plan only probes
+ * the start of each new partition and resamples when the probe disagrees
+ * with the last full sample.
+ *
+ * Partitions are handed out in order from a shared counter, or, when a
+ * morsel size is given, are the morsels of morsel.c, so threads start on
+ * their own chunk and steal when they run out.
+ *
+ * If the input came with chunk statistics (see AggregateChunks), the
+ * partitions are the chunks and each is planned from its statistics,
+ * without sampling.
+ *
  * We sample for:
  * (1) Access counts to buckets
  * (2) Hits in the table (i.e. items already in the table)
@@ -30,13 +42,13 @@
 
 
 /* Create a new aggregation object and return it to the caller */
-Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate)
+Aggregate AggregateCreate(int n_threads, Tuple* tups, int n_tups, int n_groups, int resample_rate, const AggregateOptions *opts)
 {
   register int i, j, k;
 
   Aggregate a;
   
-  a = InitializeAggregate(n_threads, tups, n_tups, n_groups);
+  a = InitializeAggregate(n_threads, tups, n_tups, n_groups, opts);
 
   assert(resample_rate >= 1);
   a->resample_rate = resample_rate;
@@ -53,201 +65,247 @@ static inline void ResetLocalTable(Aggregate a, const int id)
     a->private_buckets[id][i].access_count = 0;
 }
 
-/* static function that performs the aggregation for one thread */
-static void AggregateOperate(Aggregate a, const int id)
+/* Full warmup and sample at the start of [start, end]; returns the strategy */
+static Strategy Resample(Aggregate a, const int id,
+			 const int start, const int end)
+{
+  int hits = 0;
+  int num_runs = 1;
+  const int warmup_end = start + WARMUP; 
+  const int sample_end = warmup_end + SAMPLE_SIZE;
+  SampleStats stats;
+
+  ResetLocalTable(a, id); //should be quick...
+
+  AggregateSample(a, id, 
+		  start, warmup_end-1, 
+		  &hits, &num_runs);
+      
+  hits = 0;
+  AggregateSample(a, id, 
+		  warmup_end, sample_end - 1, 
+		  &hits, &num_runs);
+      
+  AggregateEstimate(a, id, hits, num_runs, SAMPLE_SIZE, SAMPLE_SIZE + WARMUP, &stats);
+
+  a->last_sample[id] = stats;
+  a->last_strategy[id] = AggregateChoose(&stats);
+  a->have_plan[id] = true;
+  a->resamples[id] ++;
+  a->hits[id] = hits;
+
+  return a->last_strategy[id];
+}
+
+/* The next partition for thread id, from the shared counter or, with */
+/* morsels, a stream or auto DOP, from MorselNext. Returns false when none are left. */
+static bool NextPartition(Aggregate a, const int id, unsigned int *partition,
+			  unsigned int *start, unsigned int *end)
 {
-  register unsigned int i, j, k;
   unsigned int my_partition;
-  
-  while( (my_partition= atomic_inc_uint_nv(&(a->current_partition))) <= a->n_partitions)
+
+  if(a->opts.morsel || a->stream || a->opts.auto_dop)
+    return MorselNext(a, id, partition, start, end);
+
+  do
     {
+      if( (my_partition= atomic_inc_uint_nv(&(a->current_partition))) > a->n_partitions)
+	return false;
+
       // the current partition starts at 0, increment returns new value, 
       //so the values returned count [1, n_partitions], but we want [0, n_partitions)
       my_partition = my_partition - 1; 
+    }
+  while(a->chunks && a->chunks[my_partition].count == 0);
 
-      ResetLocalTable(a, id); //should be quick...
-      
+  *partition = my_partition;
+  if(a->chunks)
+    {
+      *start = a->chunks[my_partition].first;
+      *end = *start + a->chunks[my_partition].count - 1;
+      return true;
+    }
+  *start = my_partition * (double)a->n_tups/a->n_partitions;
+  *end = (my_partition == a->n_partitions-1) ? a->n_tups-1: (my_partition+1)*(double)a->n_tups/a->n_partitions - 1;
+  return true;
+}
+
+/* Aggregate one partition as thread id. When there are none left, */
+/* finish the thread's part and return false. */
+bool AggregateStep(Aggregate a, const int id)
+{
+  unsigned int my_partition, start, end;
+  
+  if(!NextPartition(a, id, &my_partition, &start, &end))
+    {
+      if(a->opts.pipelined)
+	{
+	  /* don't wait for the stragglers, merge while they finish */
+	  AggregateMergePrivate(a, id);
+	}
+      return false;
+    }
+
+  //printf("[%d]\t%d\t%d\t%d\t%d\n", id, my_partition, end - start, start, end);
+
+  hrtime_t begin = gethrtime();
+  SampleStats stats;
+
+  if(a->chunks && AggregateEstimateChunks(a, start, end, &stats))
+    {
+      /* the statistics came with the input, nothing to sample */
+      a->last_sample[id] = stats;
+      a->last_strategy[id] = AggregateStrategy(a, id, AggregateChoose(&stats), start, end);
+      a->have_plan[id] = true;
+      a->hits[id] = (1.0 - stats.missrate) * SAMPLE_SIZE;
+      TraceAdd(a, id, my_partition, a->last_strategy[id], true, 
+	       &stats, start, end, 
+	       (gethrtime() - begin)/1000000000.0);
+      return true;
+    }
+
+  if(end - start + 1 < MIN_SAMPLED_PARTITION)
+    {
+      /* too small to be worth sampling; morsels are at least this */
+      /* large, so only tiny inputs and small stream buffers get here */
+      AggregateHybrid(a, id, start, end);
+      TraceAdd(a, id, my_partition, STRATEGY_HYBRID, false, NULL, start, end,
+	       (gethrtime() - begin)/1000000000.0);
+      return true;
+    }
+
+  if(a->opts.drift && a->have_plan[id])
+    {
+      /* probe the start of the partition with a warm table */
       int hits = 0;
       int num_runs = 1;
-      
-      const unsigned int start = my_partition * (double)a->n_tups/a->n_partitions;
-      const unsigned int end = (my_partition == a->n_partitions-1) ? a->n_tups-1: (my_partition+1)*(double)a->n_tups/a->n_partitions - 1;
-      const int warmup_end = start + WARMUP; 
-      const int sample_end = warmup_end + SAMPLE_SIZE;
+      const int probe_end = start + DRIFT_PROBE;
+      SampleStats probe;
 
-      //printf("[%d]\t%d\t%d\t%d\t%d\n", id, my_partition, end - start, start, end);
-      
-      assert(warmup_end < end && sample_end < end);
+      ResetLocalTable(a, id);
+      AggregateSample(a, id, start, probe_end - 1, &hits, &num_runs);
+      AggregateEstimate(a, id, hits, num_runs, DRIFT_PROBE, DRIFT_PROBE, &probe);
 
-      AggregateSample(a, id, 
-		      start, warmup_end-1, 
-		      &hits, &num_runs);
-      
-      hits = 0;
-      AggregateSample(a, id, 
-		      warmup_end, sample_end - 1, 
-		      &hits, &num_runs);
-      
-      /* calculate the max accesses */
-      int max[7];
-      for(i = 0; i < 7; i++)
-	max[i] = 0; //init to 0
-      for(i = 0; i < a->n_private_buckets; i++)    
-	for(j = 0; j < 7; j++)       
-	  /* check all maxes */
-	  if(max[j] < a->private_buckets[id][i].access_count)
-	    {
-	      /* found this value's spot */
-	      /* slide all others down */
-	      for( k = 7-1; k > j; k--)
-		max[k] = max[k-1];
-	      max[j] = a->private_buckets[id][i].access_count;
-	    }
-      
-      double estimate_sum = 0.0;
-      double f;
-      for(i = 0; i < 7; i++)
-	{
-	  f = (double)max[i]/( SAMPLE_SIZE + WARMUP);
-	  if( f >= 1.0/7.58)
-	    {
-	      estimate_sum += 25.1 *f - 3.31;
-	    }
-	  else
-	    {
-	      break; //no subsequent max will meet the threshold, either.
-	    }
-	}
-      
-      double avg_run_length = (double)(SAMPLE_SIZE + WARMUP) / num_runs;
-      double missrate = ( (double)( SAMPLE_SIZE - hits) )/(SAMPLE_SIZE);
-      
-      if(avg_run_length > 1.142857)
-	{
-	  /* Runs are present */
-	  AggregateRuns(a, id, sample_end, end);
-	}
-  //  else if(missrate < 0.5 || max > (SAMPLE_SIZE + WARMUP)/16)
-      else if (missrate < 0.5 || estimate_sum >= 1.0)
+      if(AggregateDrifted(&(a->last_sample[id]), &probe))
 	{
-	  /* locallity or contention */
-	  AggregateHybrid(a, id, sample_end, end);
+	  a->last_strategy[id] = 
+	    AggregateStrategy(a, id, Resample(a, id, probe_end, end), 
+			      probe_end + WARMUP + SAMPLE_SIZE, end);
+	  TraceAdd(a, id, my_partition, a->last_strategy[id], true, 
+		   &(a->last_sample[id]), start, end, 
+		   (gethrtime() - begin)/1000000000.0);
 	}
       else
 	{
-	  /* no locallity or contention, use global table */
-	  AggregateAtomic(a, id, sample_end, end);
+	  a->last_strategy[id] = 
+	    AggregateStrategy(a, id, a->last_strategy[id], probe_end, end);
+	  TraceAdd(a, id, my_partition, a->last_strategy[id], false, 
+		   &probe, start, end, 
+		   (gethrtime() - begin)/1000000000.0);
 	}
-      
-      a->hits[id] = hits;
     }
+  else
+    {
+      a->last_strategy[id] = 
+	AggregateStrategy(a, id, Resample(a, id, start, end), 
+			  start + WARMUP + SAMPLE_SIZE, end);
+      TraceAdd(a, id, my_partition, a->last_strategy[id], true, 
+	       &(a->last_sample[id]), start, end, 
+	       (gethrtime() - begin)/1000000000.0);
+    }
+  return true;
 }
 
-/* stub for thread to start in */
-void * run_operate(void *v)
+void AggregatePrepare(Aggregate a)
 {
-  ThreadInfo* info = (ThreadInfo*)v;
-  AggregateOperate(info->a, info->id);
-  return NULL;
+  int i;
+
+  /* Sampling should cost at most 1/8 of a partition. Below that size, */
+  /* use fewer partitions (but keep every thread busy if we can). */
+  unsigned int max_partitions = a->n_tups / MIN_PARTITION_SIZE;
+  if(max_partitions < a->n_threads)
+    max_partitions = a->n_tups / MIN_SAMPLED_PARTITION;
+  if(max_partitions > a->n_threads * a->resample_rate)
+    max_partitions = a->n_threads * a->resample_rate;
+  a->n_partitions = max_partitions;
+  if(a->n_partitions < 1)
+    a->n_partitions = 1;
+  a->current_partition = 0;
+
+  /* with morsels on, every morsel is a partition, so each must be */
+  /* large enough to be sampled */
+  MorselReset(a, MIN_RESAMPLE_MORSEL);
+  if(a->opts.morsel || a->opts.auto_dop)
+    a->n_partitions = a->n_morsels;
+  /* otherwise, with chunk statistics, every chunk is */
+  else if(a->chunks)
+    a->n_partitions = a->n_chunks;
+
+  for(i = 0; i < a->n_threads; i++)
+    {
+      a->have_plan[i] = false;
+      a->resamples[i] = 0;
+    }
+  TraceReset(a);
+}
+
+/* private tables into the global table (unless pipelined runs already */
+/* did), then per node global tables into table 0 */
+unsigned int AggregateMergeSteps(Aggregate a)
+{
+  return (a->opts.pipelined ? 0 : 1) + ((a->n_tables > 1) ? 1 : 0);
+}
+
+void AggregateMergeStep(Aggregate a, const unsigned int step, const int id)
+{
+  if(step == 0 && !a->opts.pipelined)
+    AggregateMergeLite(a, id);
+  else
+    AggregateMergeNodes(a, id);
 }
 
-/* stub for thread to start in for table merge */
-void * run_merge(void *v)
+/* my private table into the global table, see StreamEmit */
+void AggregateFlush(Aggregate a, const int id)
+{
+  AggregateFlushPrivate(a, id);
+}
+
+/* stub for thread to start in */
+static void * run_operate(void *v)
 {
   ThreadInfo* info = (ThreadInfo*)v;
-  AggregateMergeLite(info->a, info->id);
+  while(AggregateStep(info->a, info->id))
+    ;
   return NULL;
 }
 
 /* global entry point for running an aggregate */
-/* creates threads that acutally do the aggregate, then collects them */
+/* runs the aggregate on the worker pool */
 /* times aggregation */
 double AggregateRun(Aggregate a)
 {
-  int i, r;
   double elapsed;
   Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
 
-  a->n_partitions = a->n_threads * a->resample_rate;
-  a->current_partition = 0;
+  AggregatePrepare(a);
   timer = TimerCreate();
 
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-
   TimerStart(timer);
 
-  /* set up thread info and start threads */  
-  for(i = 0; i < a->n_threads; i++)
-    {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_operate, 
-			 &info[i]);
-      assert(r==0);
-    }
-    /* join the theads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
+  PoolRun(a, run_operate);
 
   TimerStop(timer);
   elapsed = TimerElapsed(timer);
 
   /* clean up */
   TimerDelete(timer);
-  free(threads);
-  free(info);
 
   return elapsed;
 }
 
 double AggregateMerge(Aggregate a)
 {
-  int i, r;
-  double elapsed;
-  Timer timer;
-  pthread_t *threads;
-  ThreadInfo *info;
-  
-  timer = TimerCreate();
-  
-  /* allocate space for the threads and their private data */
-  threads = (pthread_t*)malloc(sizeof(pthread_t) * a->n_threads);
-  info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * a->n_threads);
-  
-  TimerStart(timer);
-  
-    /* respawn threads to do the merge */
-  for(i = 0; i < a->n_threads; i++)
-    {
-      info[i].id = i;
-      info[i].a = a;
-      r = pthread_create(&threads[i], 
-			 NULL, 
-			 run_merge, 
-			 &info[i]);
-      assert(r==0);
-    }
-
-  /* join threads */
-  for(i = 0; i < a->n_threads; i++)
-    pthread_join(threads[i], NULL);
-
-
-  TimerStop(timer);
-  elapsed = TimerElapsed(timer);
-
-  /* clean up */
-  TimerDelete(timer);
-  free(threads);
-  free(info);
-
-  return elapsed;
+  return PoolMerge(a);
 }
 
 
@@ -290,7 +348,10 @@ void AggregateReset(Aggregate a)
 void AggregateDelete(Aggregate a)
 {
   /* TODO -- free chained buckets */
+  TraceDelete(a);
   free(a->global_buckets);
+  free(a->placed_input);
+  PoolDelete(a->pool);
   free(a);
 }
 
@@ -8,6 +8,7 @@
 
 #include "aggregate.h"
 #include "global.h"
+#include "global_table.h"
 
 #include <atomic.h>
 #include <thread.h>
@@ -20,24 +21,35 @@
 
 #include <sun_prefetch.h>
 
-/* Insert into the global table */
-void AggregateAtomic(Aggregate a, const int id, 
-			    const int start, const int end)
+/* Insert [start, end] into the global table, plain as in ColumnGet */
+static inline void AtomicRange(Aggregate a, const int id,
+			       const int start, const int end, const bool plain)
 {
   register unsigned int i, index;
   register uint64_t key;
   HashCell *current, *prev, *first;
+  uint64_t keys[COLUMN_BATCH]; /* decoded ahead of hashing */
 
   /* place oft used info in local variables */
   const unsigned int lg_buckets = a->lg_buckets;
-  const Tuple* input = a->input;
-  register HashCell *buckets = a->global_buckets;
-  register char* valid = a->valid;
+  const InputColumns input = a->columns;
+  register HashCell *buckets = a->node_buckets[a->table_of[id]];
+  register char* valid = a->node_valid[a->table_of[id]];
+
+  /* contention counts, see global_table.h */
+  unsigned int cas_failures = 0, lock_waits = 0, chain_retries = 0;
 
   for(i = start; i <= end; i++)
     {
-
-      key = input[i].group;
+      if(plain)
+	key = ColumnGet(input.group, i, true);
+      else
+	{
+	  /* decode the next batch of keys, see Column in global.h */
+	  if((i - start) % COLUMN_BATCH == 0)
+	    ColumnDecode(input.group, i, (end - i + 1 < COLUMN_BATCH) ? end - i + 1 : COLUMN_BATCH, keys);
+	  key = keys[(i - start) % COLUMN_BATCH];
+	}
 
       bool done = false; /* flag set when the current tuple is processed */
 
@@ -46,7 +58,7 @@ void AggregateAtomic(Aggregate a, const int id,
       if(!valid[index])
 	{
 	  /* we're first, initialize the cell */
-	  MUTEX_LOCK(buckets[index].lock);
+	  lock_waits += LockAcquire(a, id, &(buckets[index].lock));
 	  
 	  /* recheck the bucket status after we aquire the lock */
 	  /* someone may have beat us here */	  
@@ -54,20 +66,20 @@ void AggregateAtomic(Aggregate a, const int id,
 	    {
 	      buckets[index].key = key;
 
-	      buckets[index].sum1= input[i].value1;
+	      buckets[index].sum1= ColumnGet(input.value1, i, plain);
 	      buckets[index].count1 = 1;
-	      buckets[index].squares1 = input[i].value1 * input[i].value1;
+	      buckets[index].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
-	      buckets[index].sum2 = input[i].value2;
+	      buckets[index].sum2 = ColumnGet(input.value2, i, plain);
 	      buckets[index].count2 = 1;
-	      buckets[index].squares2 = input[i].value2 * input[i].value2;
+	      buckets[index].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-	      buckets[index].sum3 = input[i].value3;
+	      buckets[index].sum3 = ColumnGet(input.value3, i, plain);
 	      buckets[index].count3 = 1;
-	      buckets[index].squares3 = input[i].value3 * input[i].value3;
+	      buckets[index].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
-	      buckets[index].sum4 = input[i].value4;
-	      buckets[index].count = 1;
+	      buckets[index].sum4 = ColumnGet(input.value4, i, plain);
+	      buckets[index].count4 = 1;
 
 	      buckets[index].next = NULL;
 	      
@@ -79,7 +91,7 @@ void AggregateAtomic(Aggregate a, const int id,
 	      valid[index] = 1; /*set last or immediatley valid...*/
 	      done = true;	 
 	    }	  
-	  MUTEX_UNLOCK(buckets[index].lock);
+	  LockRelease(a, id, &(buckets[index].lock));
 	}
       
       /* if !done we didn't initialize a cell above */
@@ -100,27 +112,27 @@ void AggregateAtomic(Aggregate a, const int id,
 	  if(current)
 	    {	     
 	      /* Found key -- update aggregate */	      
-	      atomic_add_64(&(current->sum1),input[i].value1); /* atomic add */
-	      atomic_inc_64(&(current->count1)); /* atomic increment */
-	      atomic_add_64(&(current->squares1), input[i].value1 * input[i].value1); /* atomic add */	  
+	      cas_failures += AtomicAddCounted(&(current->sum1), ColumnGet(input.value1, i, plain)); /* atomic add */
+	      cas_failures += AtomicAddCounted(&(current->count1), 1); /* atomic increment */
+	      cas_failures += AtomicAddCounted(&(current->squares1), ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain)); /* atomic add */	  
 
-	      atomic_add_64(&(current->sum2),input[i].value2); /* atomic add */
-	      atomic_inc_64(&(current->count2)); /* atomic increment */
-	      atomic_add_64(&(current->squares2), input[i].value2 * input[i].value2); /* atomic add */
+	      cas_failures += AtomicAddCounted(&(current->sum2), ColumnGet(input.value2, i, plain)); /* atomic add */
+	      cas_failures += AtomicAddCounted(&(current->count2), 1); /* atomic increment */
+	      cas_failures += AtomicAddCounted(&(current->squares2), ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain)); /* atomic add */
 
-	      atomic_add_64(&(current->sum3),input[i].value3); /* atomic add */
-	      atomic_inc_64(&(current->count3)); /* atomic increment */
-	      atomic_add_64(&(current->squares3), input[i].value3 * input[i].value3); /* atomic add */
+	      cas_failures += AtomicAddCounted(&(current->sum3), ColumnGet(input.value3, i, plain)); /* atomic add */
+	      cas_failures += AtomicAddCounted(&(current->count3), 1); /* atomic increment */
+	      cas_failures += AtomicAddCounted(&(current->squares3), ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain)); /* atomic add */
 
-	      atomic_add_64(&(current->sum4),input[i].value4); /* atomic add */
-	      atomic_inc_64(&(current->count4)); /* atomic increment */
+	      cas_failures += AtomicAddCounted(&(current->sum4), ColumnGet(input.value4, i, plain)); /* atomic add */
+	      cas_failures += AtomicAddCounted(&(current->count4), 1); /* atomic increment */
 
 	      done = true;	    
 	    }
 	  else
 	    {	      
 	      /* Didn't find key, allocate new cell */
-	      MUTEX_LOCK(buckets[index].lock);
+	      lock_waits += LockAcquire(a, id, &(buckets[index].lock));
 	      if(buckets[index].next == first) 
 		{
 		  /* as we did in earlier init code, make sure we weren't beaten */
@@ -128,33 +140,54 @@ void AggregateAtomic(Aggregate a, const int id,
 		  
 		  current->key = key;
 
-		  current->sum1 = input[i].value1;
+		  current->sum1 = ColumnGet(input.value1, i, plain);
 		  current->count1 = 1;
-		  current->squares1 = input[i].value1 * input[i].value1;
+		  current->squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
-		  current->sum2 = input[i].value2;
+		  current->sum2 = ColumnGet(input.value2, i, plain);
 		  current->count2 = 1;
-		  current->squares2 = input[i].value2 * input[i].value2;
+		  current->squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-		  current->sum3 = input[i].value3;
+		  current->sum3 = ColumnGet(input.value3, i, plain);
 		  current->count3 = 1;
-		  current->squares3 = input[i].value3 * input[i].value3;
+		  current->squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
-		  current->sum4 = input[i].value4;
+		  current->sum4 = ColumnGet(input.value4, i, plain);
 		  current->count4 = 1;
 
 		  current->next = first;
-		  //		  MUTEX_INIT(current->lock);
+		  //		  LockInit(a, &(current->lock));
 		  membar_exit();
 		  /* Set last or other threads can see it before init!*/
 		  /* TODO: As mentioned above, we may need a membar here */
 		  buckets[index].next = current; 
 		  done = true;
 		}
+	      else
+		chain_retries ++;
 	      /* If we fail, we redo everything, instead of continuing where */
 	      /* we left off...ok for now -- rarely happens */	      
-	      MUTEX_UNLOCK(buckets[index].lock);
+	      LockRelease(a, id, &(buckets[index].lock));
 	    }
 	}  
     }
+
+  ContentionAdd(a, id, cas_failures, lock_waits, chain_retries, end - start + 1);
+}
+
+/* Insert into the global table */
+void AggregateAtomic(Aggregate a, const int id,
+		     const int start, const int end)
+{
+  /* several lookups at a time, see interleave.c */
+  if(a->opts.interleave > 1)
+    {
+      AggregateAtomicInterleaved(a, id, start, end);
+      return;
+    }
+
+  if(ColumnsPlain(&(a->columns)))
+    AtomicRange(a, id, start, end, true);
+  else
+    AtomicRange(a, id, start, end, false);
 }
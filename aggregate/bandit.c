@@ -0,0 +1,83 @@
+/*
+ * File: bandit.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * A multi-armed bandit over the aggregation strategies. Instead of
+ * predicting the best strategy from a sample, each thread tries the
+ * strategies on morsels of its input and keeps the one with the best
+ * measured throughput.
+ *
+ * Every arm is tried BANDIT_ROUNDS times first. After that the thread
+ * exploits the best arm, exploring a random arm with probability
+ * N_STRATEGIES/pulls, and never spends more than 1/BANDIT_EXPLORE_SHARE
+ * of its morsels exploring in total.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <mtmalloc.h>
+
+Bandit BanditCreate(unsigned int seed, unsigned int n_morsels)
+{
+  register int i;
+  Bandit b = (Bandit)malloc(sizeof(BanditCDT));
+  assert(b);
+
+  for(i = 0; i < N_STRATEGIES; i++)
+    {
+      b->pulls[i] = 0;
+      b->reward[i] = 0.0;
+    }
+  b->total = 0;
+  b->explored = 0;
+  b->max_explore = n_morsels / BANDIT_EXPLORE_SHARE;
+  b->seed = seed;
+  return b;
+}
+
+/* the arm with the best mean throughput so far */
+static Strategy BanditBest(Bandit b)
+{
+  register int i;
+  Strategy best = 0;
+  for(i = 1; i < N_STRATEGIES; i++)
+    if(b->reward[i] > b->reward[best])
+      best = i;
+  return best;
+}
+
+/* Pick the arm to use for the next morsel */
+Strategy BanditSelect(Bandit b)
+{
+  /* initial round robin over all arms */
+  if(b->total < N_STRATEGIES * BANDIT_ROUNDS)
+    return b->total % N_STRATEGIES;
+
+  /* decaying exploration, bounded by the budget */
+  if(b->explored < b->max_explore &&
+     (double)rand_r(&(b->seed)) / RAND_MAX < (double)N_STRATEGIES / b->total)
+    {
+      b->explored ++;
+      return rand_r(&(b->seed)) % N_STRATEGIES;
+    }
+
+  return BanditBest(b);
+}
+
+/* Record the throughput (tuples per second) the arm achieved */
+void BanditUpdate(Bandit b, Strategy arm, double throughput)
+{
+  b->pulls[arm] ++;
+  b->total ++;
+  /* running mean */
+  b->reward[arm] += (throughput - b->reward[arm]) / b->pulls[arm];
+}
+
+void BanditDelete(Bandit b)
+{
+  free(b);
+}
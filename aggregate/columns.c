@@ -0,0 +1,68 @@
+/*
+ * File: columns.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Columnar input. The kernels never read Tuple rows directly; they read
+ * a->columns (see global.h), which AggregateCreate points at the fields
+ * of the rows it was given. An aggregate can instead be handed separate
+ * columns, so that a query streams 16 bytes per tuple (a group array and
+ * one value array that value2..4 share) instead of the 40 of a row, or
+ * only 8 when the values are virtual.
+ *
+ * The run kernels (runs.c) work a column at a time: they find a run in
+ * the group column and then sum each value column over it.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/*
+ * Aggregate columns instead of the rows given to AggregateCreate, which
+ * may have been NULL. The columns must hold a->n_tups values each and
+ * outlive the aggregate. Call before AggregateRun.
+ */
+void AggregateColumns(Aggregate a, const InputColumns *columns)
+{
+  assert(columns->group.data && columns->value1.data && columns->value2.data
+	 && columns->value3.data && columns->value4.data);
+  assert(!a->stream);
+
+  /* a copy of the rows placed by AggregateCreate is of no use now */
+  free(a->placed_input);
+  a->placed_input = NULL;
+
+  a->input = NULL;
+  a->columns = *columns;
+  if(a->opts.numa)
+    NumaPlaceInput(a);
+}
+
+/*
+ * Plan from the statistics of the chunks of the input instead of
+ * sampling it (adaptive and resample, see AggregateEstimateChunks). The
+ * chunks are consecutive ranges of tuples that cover the input, e.g. the
+ * shards of a tuple file, and must outlive the aggregate. Call before
+ * AggregateRun.
+ */
+void AggregateChunks(Aggregate a, const TupFileShard *chunks, 
+		     const TupFileShardStats *stats, unsigned int n_chunks)
+{
+  register unsigned int c;
+  uint64_t next = 0;
+
+  assert(!a->stream && n_chunks > 0);
+  for(c = 0; c < n_chunks; c++)
+    {
+      assert(chunks[c].first == next);
+      next += chunks[c].count;
+    }
+  assert(next == a->n_tups);
+
+  a->chunks = chunks;
+  a->chunk_stats = stats;
+  a->n_chunks = n_chunks;
+}
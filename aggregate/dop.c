@@ -0,0 +1,150 @@
+/*
+ * File: dop.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Automatic choice of the number of threads. Past some thread count more
+ * threads only add contention on the global table or compete for memory
+ * bandwidth, and where that happens depends on the query. With auto DOP
+ * the pool's n_threads is only the maximum. The run starts with one
+ * thread taking morsels and doubles the count (1, 2, 4, ... n_threads),
+ * measuring the throughput of DOP_ROUNDS morsels per thread at each
+ * count. The ramp stops at the first count that is slower than the best
+ * one so far, or at n_threads, and the rest of the run uses the best.
+ *
+ * Workers beyond the current count wait in MorselNext. Their queues are
+ * open to stealing from the start (no reserved first morsel), so the
+ * running workers can finish the input without them.
+ *
+ * Worker state changes once per morsel, so a mutex is fine here.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <pthread.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* threads measured at a level of the ramp */
+static unsigned int LevelThreads(Aggregate a, int level)
+{
+  unsigned int k = 1u << level;
+  return (k > a->n_threads) ? a->n_threads : k;
+}
+
+/* Called once by PoolCreate */
+void DopInit(Aggregate a)
+{
+  pthread_mutex_init(&a->dop_lock, NULL);
+  pthread_cond_init(&a->dop_wake, NULL);
+}
+
+/* Start the ramp over. Called by MorselReset before every run. */
+void DopReset(Aggregate a)
+{
+  register int i;
+
+  for(i = 0; i < MAX_THREADS; i++)
+    {
+      a->dop_of[i] = -1;
+      a->dop_size[i] = 0;
+    }
+  for(i = 0; i <= MAX_THREADS; i++)
+    a->dop_throughput[i] = 0.0;
+  a->dop_done = 0;
+  a->dop_tuples = 0;
+  a->dop_exhausted = false;
+
+  if(!a->opts.auto_dop || a->n_threads == 1)
+    {
+      /* nothing to choose */
+      a->dop = a->n_threads;
+      a->dop_level = -1;
+      return;
+    }
+
+  a->dop = 1;
+  a->dop_level = 0;
+  a->dop_start = gethrtime();
+}
+
+/* A level is done: record it, then go up a level or settle. Lock held. */
+static void NextLevel(Aggregate a)
+{
+  register unsigned int k, j, best;
+  double elapsed;
+
+  k = LevelThreads(a, a->dop_level);
+  elapsed = (gethrtime() - a->dop_start)/1000000000.0;
+  a->dop_throughput[k] = (elapsed > 0.0) ? a->dop_tuples / elapsed : 0.0;
+
+  best = 1;
+  for(j = 2; j <= k; j++)
+    if(a->dop_throughput[j] > a->dop_throughput[best])
+      best = j;
+
+  if(k == a->n_threads || best != k)
+    {
+      /* more threads stopped paying off */
+      a->dop = best;
+      a->dop_level = -1;
+    }
+  else
+    {
+      a->dop_level ++;
+      a->dop = LevelThreads(a, a->dop_level);
+      a->dop_done = 0;
+      a->dop_tuples = 0;
+      a->dop_start = gethrtime();
+    }
+  pthread_cond_broadcast(&a->dop_wake);
+}
+
+/*
+ * Called by worker id before it takes a morsel, so its last morsel is
+ * finished. Waits while the worker is beyond the current thread count.
+ * Returns false if the input ran out in the meantime.
+ */
+bool DopWait(Aggregate a, const int id)
+{
+  bool go;
+
+  pthread_mutex_lock(&a->dop_lock);
+
+  /* the morsel just finished counts for the level it started in */
+  if(a->dop_level >= 0 && a->dop_of[id] == a->dop_level)
+    {
+      a->dop_done ++;
+      a->dop_tuples += a->dop_size[id];
+      if(a->dop_done >= DOP_ROUNDS * LevelThreads(a, a->dop_level))
+	NextLevel(a);
+    }
+  a->dop_of[id] = -1;
+
+  while(id >= a->dop && !a->dop_exhausted)
+    pthread_cond_wait(&a->dop_wake, &a->dop_lock);
+  go = !a->dop_exhausted;
+
+  pthread_mutex_unlock(&a->dop_lock);
+  return go;
+}
+
+/* Called by worker id after it looked for a morsel of tuples tuples */
+void DopStarted(Aggregate a, const int id, bool found, unsigned int tuples)
+{
+  pthread_mutex_lock(&a->dop_lock);
+  if(found)
+    {
+      a->dop_of[id] = a->dop_level;
+      a->dop_size[id] = tuples;
+    }
+  else
+    {
+      /* let the waiting workers go home */
+      a->dop_exhausted = true;
+      pthread_cond_broadcast(&a->dop_wake);
+    }
+  pthread_mutex_unlock(&a->dop_lock);
+}
@@ -0,0 +1,258 @@
+/*
+ * File: gen.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Generating the input in process instead of reading it from files.
+ *
+ * Every tuple draws its random numbers from a hash of the seed and its
+ * position (splitmix64), not from a sequential generator, so the input
+ * only depends on the seed and threads can generate any part of it.
+ *
+ * Keys are in [0, n_groups):
+ *
+ *  - uniform: every key equally likely
+ *  - sorted: n_tuples/n_groups copies of each key, in key order
+ *  - heavy hitter: key 0 with probability heavy, otherwise uniform
+ *  - repeated runs: the sorted input, shrunk to GEN_REPEATS copies
+ *  - zipf: key r with probability proportional to 1/(r+1)^theta, drawn
+ *    from a table of the cumulative distribution, so any theta works
+ *  - self-similar: the h/(1-h) rule of Gray et al. (SIGMOD 1994), key
+ *    n_groups * u^(log h / log (1-h)) for a uniform u
+ *
+ * value1 is a small random number; value2 .. value4 repeat it, as the
+ * input files do. The input comes as rows or as columns (group and one
+ * shared value column).
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <pthread.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <math.h>
+#include <mtmalloc.h>
+
+/* the random 64 bits of draw d of tuple i */
+static inline uint64_t Random(const Generator g, const uint64_t i, const uint64_t d)
+{
+  uint64_t z = g->seed + (2 * i + d + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static inline double Uniform(const uint64_t r)
+{
+  return (r >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* uniform in [0, n) */
+static inline uint64_t Below(const uint64_t r, const uint64_t n)
+{
+  return (uint64_t)(Uniform(r) * n);
+}
+
+/* The first rank whose cumulative probability exceeds u */
+static uint64_t ZipfRank(const Generator g, const double u)
+{
+  register uint64_t lo = 0, hi = g->n_groups - 1, mid;
+
+  while(lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if(g->zipf_cdf[mid] > u)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+  return lo;
+}
+
+Generator GeneratorCreate(Distribution distribution, uint64_t n_tuples, uint64_t n_groups,
+			  uint64_t seed, double theta, double heavy)
+{
+  register uint64_t r;
+  double sum;
+  Generator g;
+
+  assert(distribution < N_DISTRIBUTIONS && n_groups > 0);
+  assert(theta >= 0.0 && heavy >= 0.0 && heavy <= 1.0);
+
+  g = (Generator)calloc(1, sizeof(GeneratorCDT));
+  assert(g);
+  g->distribution = distribution;
+  g->n_tuples = n_tuples;
+  g->n_groups = n_groups;
+  g->seed = seed;
+  g->theta = theta;
+  g->heavy = heavy;
+
+  if(distribution == DIST_ZIPF)
+    {
+      g->zipf_cdf = (double*)malloc(sizeof(double) * n_groups);
+      assert(g->zipf_cdf);
+      for(r = 0, sum = 0.0; r < n_groups; r++)
+	g->zipf_cdf[r] = (sum += 1.0 / pow(r + 1, theta));
+      for(r = 0; r < n_groups; r++)
+	g->zipf_cdf[r] /= sum;
+    }
+  return g;
+}
+
+/* the key of tuple i */
+static inline uint64_t GeneratorKey(const Generator g, const uint64_t i)
+{
+  register uint64_t key;
+  const uint64_t n = g->n_tuples, groups = g->n_groups;
+  const uint64_t period = (n / GEN_REPEATS > 0) ? n / GEN_REPEATS : 1;
+
+  switch(g->distribution)
+    {
+    case DIST_SORTED:
+      key = i * groups / n;
+      break;
+    case DIST_HEAVY_HITTER:
+      key = (Uniform(Random(g, i, 0)) < g->heavy) ? 0 : Below(Random(g, i, 1), groups);
+      break;
+    case DIST_REPEATED_RUNS:
+      key = (i % period) * groups / period;
+      break;
+    case DIST_ZIPF:
+      key = ZipfRank(g, Uniform(Random(g, i, 0)));
+      break;
+    case DIST_SELF_SIMILAR:
+      key = (uint64_t)(groups * pow(Uniform(Random(g, i, 0)), 
+				    log(GEN_SELF_SIMILAR_H) / log(1.0 - GEN_SELF_SIMILAR_H)));
+      break;
+    default:
+      key = Below(Random(g, i, 0), groups);
+    }
+  return (key >= groups) ? groups - 1 : key;
+}
+
+/* the value of tuple i, the same in all four value columns */
+static inline uint64_t GeneratorValue(const Generator g, const uint64_t i)
+{
+  return Random(g, i, 2) % 1024;
+}
+
+/* Generate tuples [start, end] */
+void GeneratorFill(Generator g, Tuple *tuples, uint64_t start, uint64_t end)
+{
+  register uint64_t i;
+
+  for(i = start; i <= end; i++)
+    {
+      tuples[i].group = GeneratorKey(g, i);
+      tuples[i].value1 = tuples[i].value2 = tuples[i].value3 = tuples[i].value4 = 
+	GeneratorValue(g, i);
+    }
+}
+
+/* Generate the group and value columns of tuples [start, end] */
+static void GeneratorFillColumns(Generator g, uint64_t *group, uint64_t *value,
+				 uint64_t start, uint64_t end)
+{
+  register uint64_t i;
+
+  for(i = start; i <= end; i++)
+    group[i] = GeneratorKey(g, i);
+  for(i = start; i <= end; i++)
+    value[i] = GeneratorValue(g, i);
+}
+
+typedef struct GenInfo
+{
+  Generator g;
+  Tuple *tuples; /* rows, or NULL for columns */
+  uint64_t *group;
+  uint64_t *value;
+  int id;
+  int n_threads;
+} GenInfo;
+
+/* stub for thread to start in: generate one chunk */
+static void * run_generate(void *v)
+{
+  GenInfo *info = (GenInfo*)v;
+  const uint64_t n = info->g->n_tuples;
+  const uint64_t chunkSize = n / info->n_threads;
+  const uint64_t start = info->id * chunkSize;
+  const uint64_t end = (info->id == info->n_threads-1) ? n-1: chunkSize*(info->id+1)-1;
+
+  /* an empty chunk, where end would wrap around */
+  if(n == 0 || start > end)
+    return NULL;
+  if(info->tuples)
+    GeneratorFill(info->g, info->tuples, start, end);
+  else
+    GeneratorFillColumns(info->g, info->group, info->value, start, end);
+  return NULL;
+}
+
+/* Fill the input with n_threads threads, into rows or columns */
+static void GeneratorRun(Generator g, int n_threads, Tuple *tuples, uint64_t *group, uint64_t *value)
+{
+  register int i, r;
+  pthread_t threads[MAX_THREADS];
+  GenInfo info[MAX_THREADS];
+
+  assert(n_threads > 0 && n_threads <= MAX_THREADS);
+  /* no more threads than tuples, so that every chunk holds one */
+  if(g->n_tuples < (uint64_t)n_threads)
+    n_threads = (g->n_tuples > 0) ? g->n_tuples : 1;
+  for(i = 0; i < n_threads; i++)
+    {
+      info[i].g = g;
+      info[i].tuples = tuples;
+      info[i].group = group;
+      info[i].value = value;
+      info[i].id = i;
+      info[i].n_threads = n_threads;
+      r = pthread_create(&threads[i], NULL, run_generate, &info[i]);
+      assert(r==0);
+    }
+  for(i = 0; i < n_threads; i++)
+    pthread_join(threads[i], NULL);
+}
+
+/* A new input of g->n_tuples tuples, generated by n_threads threads */
+Tuple *GeneratorInput(Generator g, int n_threads)
+{
+  Tuple *tuples;
+
+  tuples = (Tuple*)malloc(sizeof(Tuple) * g->n_tuples);
+  assert(tuples);
+  GeneratorRun(g, n_threads, tuples, NULL, NULL);
+  return tuples;
+}
+
+/*
+ * The same input as GeneratorInput, as a group column and one value
+ * column that value1..4 share: 16 bytes a tuple instead of 40. Free
+ * columns->group.data and columns->value1.data when done.
+ */
+void GeneratorColumns(Generator g, int n_threads, InputColumns *columns)
+{
+  uint64_t *group, *value;
+  InputColumns c = {{0}};
+
+  group = (uint64_t*)malloc(sizeof(uint64_t) * g->n_tuples);
+  value = (uint64_t*)malloc(sizeof(uint64_t) * g->n_tuples);
+  assert(group && value);
+  GeneratorRun(g, n_threads, NULL, group, value);
+
+  c.group.data = group;
+  c.value1.data = c.value2.data = c.value3.data = c.value4.data = value;
+  c.group.stride = c.value1.stride = c.value2.stride = c.value3.stride = c.value4.stride = 1;
+  *columns = c;
+}
+
+void GeneratorDelete(Generator g)
+{
+  free(g->zipf_cdf);
+  free(g);
+}
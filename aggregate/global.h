@@ -16,6 +16,10 @@
 #define MAX_THREADS (32)
 #endif /* MAX_THREADS */
 
+#ifndef MAX_NODES
+#define MAX_NODES (8)
+#endif /* MAX_NODES */
+
 #ifndef L2_CACHE_SIZE
 #define L2_CACHE_SIZE (3145728) /* 3MB */
 #endif /* L2_CACHE_SIZE */
@@ -32,6 +36,205 @@ typedef struct{
   uint64_t value4;
 }Tuple;
 
+/*
+ * One column of the input. Value i is data[i * stride]: a field of Tuple
+ * rows has a stride of 5, a dense array a stride of 1 and a virtual
+ * column, one value for every tuple, a stride of 0. Columns may share
+ * their data (value2..4 of the generated inputs are value1), so a kernel
+ * only streams the distinct arrays it reads through the cache.
+ *
+ * A column can also be bit-packed: value i is then the bits-bit number
+ * at bit i * bits of data (low bits first, one spare word at the end),
+ * plus base, or, with a dictionary, the entry of dict it numbers. Keys
+ * are decoded where the kernels read them, never in a pass of their own.
+ *
+ * Or a column can be run-length encoded: data then holds the value of
+ * every run and ends where each run ends (the index after its last
+ * value), so value i is data[r] for the first run r with ends[r] > i.
+ * The run kernels take the runs as they are instead of finding them.
+ */
+typedef struct{
+  const uint64_t *data;
+  unsigned int stride;
+  unsigned int bits; /* 0 unless packed */
+  uint64_t base; /* packed without a dictionary: added to every value */
+  const uint64_t *dict; /* packed: 2^bits values the codes stand for, or NULL */
+  const uint64_t *ends; /* run-length encoded: the end of every run, or NULL */
+  uint64_t n_runs;
+}Column;
+
+/* the input as the kernels read it, see columns.c */
+typedef struct{
+  Column group;
+  Column value1;
+  Column value2;
+  Column value3;
+  Column value4;
+}InputColumns;
+
+/* keys decoded at a time by the kernels that hash them */
+#define COLUMN_BATCH (64)
+
+/* value i of a packed column */
+static inline uint64_t ColumnUnpack(const Column c, const unsigned int i)
+{
+  const uint64_t bit = (uint64_t)i * c.bits;
+  const uint64_t *w = c.data + (bit >> 6);
+  const unsigned int shift = bit & 63;
+  const uint64_t mask = (c.bits == 64) ? ~(uint64_t)0 : ((uint64_t)1 << c.bits) - 1;
+  /* the second word in two shifts, so that shift 0 brings in nothing */
+  register uint64_t code = ((w[0] >> shift) | ((w[1] << 1) << (63 - shift))) & mask;
+
+  return c.dict ? c.dict[code] : c.base + code;
+}
+
+/* the run of an encoded column that holds value i */
+static inline uint64_t ColumnRun(const Column c, const unsigned int i)
+{
+  register uint64_t lo = 0, hi = c.n_runs - 1, mid;
+
+  while(lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if(c.ends[mid] <= i)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static inline uint64_t ColumnAt(const Column c, const unsigned int i)
+{
+  if(c.ends)
+    return c.data[ColumnRun(c, i)];
+  if(c.bits)
+    return ColumnUnpack(c, i);
+  return c.data[(uint64_t)i * c.stride];
+}
+
+/* values [start, start + n) of c into out, n <= COLUMN_BATCH */
+static inline void ColumnDecode(const Column c, const unsigned int start, const unsigned int n,
+				uint64_t *out)
+{
+  register unsigned int i;
+  register uint64_t r;
+  register const uint64_t *p = c.data + (uint64_t)start * c.stride;
+
+  if(c.ends)
+    for(i = 0, r = ColumnRun(c, start); i < n; i++)
+      {
+	while(c.ends[r] <= start + i)
+	  r ++;
+	out[i] = c.data[r];
+      }
+  else if(c.bits)
+    for(i = 0; i < n; i++)
+      out[i] = ColumnUnpack(c, start + i);
+  else
+    for(i = 0; i < n; i++, p += c.stride)
+      out[i] = *p;
+}
+
+/*
+ * Value i of c, where plain says that no column of the input is packed
+ * or encoded (ColumnsPlain). The kernels take plain as a parameter and
+ * are called with it constant, once per range, so that on plain input
+ * they compile to the direct loads they did before there were encodings.
+ */
+static inline uint64_t ColumnGet(const Column c, const unsigned int i, const bool plain)
+{
+  if(plain)
+    return c.data[(uint64_t)i * c.stride];
+  return ColumnAt(c, i);
+}
+
+static inline bool ColumnIsPlain(const Column c)
+{
+  return !c.bits && !c.ends;
+}
+
+/* whether no column of t is packed or encoded */
+static inline bool ColumnsPlain(const InputColumns *t)
+{
+  return ColumnIsPlain(t->group) && ColumnIsPlain(t->value1) && ColumnIsPlain(t->value2)
+    && ColumnIsPlain(t->value3) && ColumnIsPlain(t->value4);
+}
+
+/*
+ * sum and sum of squares of values [start, end] of c. A dense column is
+ * summed four values at a time into independent sums, which compilers
+ * turn into vector adds and multiplies where the processor has them and
+ * which at least keep four additions in flight where it doesn't.
+ */
+static inline void ColumnSums(const Column c, const unsigned int start, const unsigned int end,
+			      uint64_t *sum, uint64_t *squares)
+{
+  register unsigned int i = start;
+  register uint64_t s = 0, q = 0, v;
+  register const uint64_t *p = c.data + (uint64_t)start * c.stride;
+  uint64_t s4[4] = {0, 0, 0, 0}, q4[4] = {0, 0, 0, 0};
+
+  if(c.bits || c.ends)
+    {
+      /* packed or encoded: decode one at a time, apart from the plain loops */
+      for(; i <= end; i++)
+	{
+	  v = ColumnAt(c, i);
+	  s += v;
+	  q += v * v;
+	}
+      *sum = s;
+      *squares = q;
+      return;
+    }
+  if(c.stride == 0)
+    {
+      /* a virtual column: the same value end - start + 1 times */
+      v = *p;
+      *sum = v * (end - start + 1);
+      *squares = v * v * (end - start + 1);
+      return;
+    }
+  if(c.stride == 1)
+    for(; i <= end && end - i >= 3; i += 4, p += 4)
+      {
+	s4[0] += p[0];
+	s4[1] += p[1];
+	s4[2] += p[2];
+	s4[3] += p[3];
+	q4[0] += p[0] * p[0];
+	q4[1] += p[1] * p[1];
+	q4[2] += p[2] * p[2];
+	q4[3] += p[3] * p[3];
+      }
+  s = s4[0] + s4[1] + s4[2] + s4[3];
+  q = q4[0] + q4[1] + q4[2] + q4[3];
+
+  for(; i <= end; i++, p += c.stride)
+    {
+      s += *p;
+      q += *p * *p;
+    }
+  *sum = s;
+  *squares = q;
+}
+
+/* the columns of an array of rows */
+static inline InputColumns RowColumns(const Tuple *t)
+{
+  InputColumns c = {{0}};
+  const unsigned int width = sizeof(Tuple)/sizeof(uint64_t);
+
+  c.group.data = &(t->group);
+  c.value1.data = &(t->value1);
+  c.value2.data = &(t->value2);
+  c.value3.data = &(t->value3);
+  c.value4.data = &(t->value4);
+  c.group.stride = c.value1.stride = c.value2.stride = c.value3.stride = c.value4.stride = width;
+  return c;
+}
+
 /* * * * * * HASH FUNCTIONS * * * * * * * */
 
 
@@ -71,29 +274,6 @@ static inline uint32_t joaat_hash_hardcoded(unsigned char *key)
 }
 
 /* * * * * * THREADING MACROS * * * * * * */
-/* turn off mutexes */
-/* #define MUTEX_T pthread_mutex_t */
-/* #define MUTEX_LOCK(x) */
-/* #define MUTEX_UNLOCK(x)  */
-/* #define MUTEX_INIT(x)  */
-
-/* pthread spin locks */
-/* #define MUTEX_T pthread_spinlock_t */
-/* #define MUTEX_LOCK(a) (pthread_spin_lock(&a)) */
-/* #define MUTEX_UNLOCK(a) (pthread_spin_unlock(&a)) */
-/* #define MUTEX_INIT(a) (pthread_spin_init(&a, NULL)) */
-
-/* pthread mutexes */
-#define MUTEX_T pthread_mutex_t
-#define MUTEX_LOCK(x) (pthread_mutex_lock(&x))
-#define MUTEX_UNLOCK(x) (pthread_mutex_unlock(&x))
-#define MUTEX_INIT(x) (pthread_mutex_init(&x, NULL))
-
-
-/* solaris mutexes */
-/* #define MUTEX_T mutex_t */
-/* #define MUTEX_LOCK(a) (mutex_lock(&a)) */
-/* #define MUTEX_UNLOCK(a) (mutex_unlock(&a)) */
-/* #define MUTEX_INIT(a) (mutex_init(&a, USYNC_THREAD, NULL) ) */
+/* the global table locks are chosen at run time, see lock.h */
 
 #endif /* _GLOBAL_H_ */
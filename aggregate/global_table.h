@@ -0,0 +1,209 @@
+#ifndef _GLOBAL_TABLE_H_
+#define _GLOBAL_TABLE_H_
+
+/*
+ * File: global_table.h
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Insertion of a partial aggregate into the shared global table. Used
+ * whenever a private table or a run spills into the global table.
+ *
+ * The global table paths count how often they had to wait for each other:
+ * failed compare and swaps, lock acquisitions that found the lock held and
+ * chain inserts that lost a race and had to start over. Each thread keeps
+ * the counts in locals and adds them to a->contention[id] when done.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+#include "lock.h"
+
+#include <atomic.h>
+#include <stdlib.h>
+
+/* atomic_add_64 that returns the number of failed compare and swaps */
+static inline unsigned int AtomicAddCounted(volatile uint64_t *target, uint64_t delta)
+{
+  register unsigned int failures = 0;
+  register uint64_t old = *target;
+  register uint64_t seen;
+
+  while((seen = atomic_cas_64(target, old, old + delta)) != old)
+    {
+      old = seen;
+      failures ++;
+    }
+  return failures;
+}
+
+/* fold a kernel's local counts into the counters of thread id */
+static inline void ContentionAdd(Aggregate a, const int id,
+				 unsigned int cas_failures, unsigned int lock_waits,
+				 unsigned int chain_retries, unsigned int updates)
+{
+  ContentionStats *c = &(a->contention[id]);
+  c->cas_failures += cas_failures;
+  c->lock_waits += lock_waits;
+  c->chain_retries += chain_retries;
+  c->updates += updates;
+}
+
+/* Insert into the table given by buckets and valid */
+static inline void AddToTable(Aggregate a, const int id, 
+			      register HashCell *buckets, register char *valid,
+			      uint64_t key, 
+			      uint64_t count1, uint64_t sum1, uint64_t square1,
+			      uint64_t count2, uint64_t sum2, uint64_t square2,
+			      uint64_t count3, uint64_t sum3, uint64_t square3,
+			      uint64_t count4, uint64_t sum4
+			      )
+{
+  register unsigned int i, index;
+  register HashCell *current, *prev, *first;
+						   
+
+  register unsigned int cas_failures = 0, lock_waits = 0, chain_retries = 0;
+
+  register bool done = false; /* flag set when the current tuple is processed */
+  index = mhash(key, a->lg_buckets);
+      
+  /* First check to see if the bucket has been visited before */
+  if(!valid[index])
+  {
+    /* we're first, initialize the cell */
+    lock_waits += LockAcquire(a, id, &(buckets[index].lock));
+    
+    /* recheck the bucket status after we aquire the lock */
+    /* someone may have beat us here */	  
+    if(valid[index] == 0)
+      {
+	buckets[index].key = key;
+
+	buckets[index].sum1 = sum1;
+	buckets[index].count1 = count1;
+	buckets[index].squares1 = square1;
+
+	buckets[index].sum2 = sum2;
+	buckets[index].count2 = count2;
+	buckets[index].squares2 = square2;
+
+	buckets[index].sum3 = sum3;
+	buckets[index].count3 = count3;
+	buckets[index].squares3 = square3;
+
+	buckets[index].sum4 = sum4;
+	buckets[index].count4 = count4;
+
+	buckets[index].next = NULL;
+	
+	/* TODO: Because the valid bit is read unlocked above, */
+	/* we may need a membar_exit before setting valid to */
+	/* ensure that the previous stores are globally visible */
+	/* before the valid bit is */
+	membar_exit();
+	valid[index] = 1; /*set last or immediatley valid...*/
+	done = true;	 
+      }	  
+    LockRelease(a, id, &(buckets[index].lock));
+  }
+  
+  /* if !done we didn't initialize a cell above */
+  while(!done)
+    {
+      /* the bucket is valid, so look at the chain*/	  
+      first = buckets[index].next;
+      current = &buckets[index];
+      prev = NULL;
+      
+      /* is key already there? */
+      while(current!=NULL && current->key != key)
+	{ 
+	  prev = current;
+	  current = current->next;
+	}
+      
+      if(current)
+	{	     
+	  /* Found key -- update aggregate */	      
+
+	  cas_failures += AtomicAddCounted(&(current->sum1), sum1); /* atomic add */
+	  cas_failures += AtomicAddCounted(&(current->count1), count1); /* atomic increment */
+	  cas_failures += AtomicAddCounted(&(current->squares1), square1); /* atomic add */	  
+
+	  cas_failures += AtomicAddCounted(&(current->sum2), sum2); /* atomic add */
+	  cas_failures += AtomicAddCounted(&(current->count2), count2); /* atomic increment */
+	  cas_failures += AtomicAddCounted(&(current->squares2), square2); /* atomic add */	
+
+	  cas_failures += AtomicAddCounted(&(current->sum3), sum3); /* atomic add */
+	  cas_failures += AtomicAddCounted(&(current->count3), count3); /* atomic increment */
+	  cas_failures += AtomicAddCounted(&(current->squares3), square3); /* atomic add */	
+
+	  cas_failures += AtomicAddCounted(&(current->sum4), sum4); /* atomic add */
+	  cas_failures += AtomicAddCounted(&(current->count4), count4); /* atomic increment */
+
+	  done = true;	    
+	}
+      else
+	{	      
+	  /* Didn't find key, allocate new cell */
+	  lock_waits += LockAcquire(a, id, &(buckets[index].lock));
+	  if(buckets[index].next == first) 
+	    {
+	      /* as we did in earlier init code, make sure we weren't beaten */
+	      current  = (HashCell*)malloc(sizeof(HashCell));
+	      
+	      current->key = key;
+
+	      current->sum1 = sum1;
+	      current->count1 = count1;
+	      current->squares1 = square1;
+
+	      current->sum2 = sum2;
+	      current->count2 = count2;
+	      current->squares2 = square2;
+
+	      current->sum3 = sum3;
+	      current->count3 = count3;
+	      current->squares3 = square3;
+
+	      current->sum4 = sum4;
+	      current->count4 = count4;
+
+	      current->next = first;
+	      //	      LockInit(a, &(current->lock));
+	      membar_exit();
+	      /* Set last or other threads can see it before init!*/
+	      /* TODO: As mentioned above, we may need a membar here */
+	      buckets[index].next = current; 
+	      done = true;
+	    }
+	  else
+	    chain_retries ++;
+	  /* If we fail, we redo everything, instead of continuing where */
+	  /* we left off...ok for now -- rarely happens */	      
+	  LockRelease(a, id, &(buckets[index].lock));
+	}
+    }  
+
+  ContentionAdd(a, id, cas_failures, lock_waits, chain_retries, 1);
+}
+
+/* Insert into the global table of thread id (its node's, see numa.c) */
+static inline void AddToGlobalAtomic(Aggregate a, const int id, 
+				     uint64_t key, 
+				     uint64_t count1, uint64_t sum1, uint64_t square1,
+				     uint64_t count2, uint64_t sum2, uint64_t square2,
+				     uint64_t count3, uint64_t sum3, uint64_t square3,
+				     uint64_t count4, uint64_t sum4
+				     )
+{
+  AddToTable(a, id, a->node_buckets[a->table_of[id]], a->node_valid[a->table_of[id]],
+	     key, 
+	     count1, sum1, square1,
+	     count2, sum2, square2,
+	     count3, sum3, square3,
+	     count4, sum4);
+}
+
+#endif /* _GLOBAL_TABLE_H_ */
@@ -9,6 +9,7 @@
 
 #include "aggregate.h"
 #include "global.h"
+#include "global_table.h"
 
 #include <atomic.h>
 #include <thread.h>
@@ -36,7 +37,7 @@ void InitializePrivateTables(Aggregate a)
   for(i=0; i < a->n_threads; i++)
     {      
       /* Ken noticed that there is an alignment issue, this fixes it */
-      a->private_buckets[i] = (PrivateHashBucket*) ((unsigned long)(ptr + (i * (a->n_private_buckets * sizeof(PrivateHashBucket) + 8192 + 64) ) + i*(8192 / a->n_threads ) ) & (~63));
+      a->private_buckets[i] = (PrivateHashBucket*) ((unsigned long)(ptr + 64 + (i * (a->n_private_buckets * sizeof(PrivateHashBucket) + 8192 + 64) ) + i*(8192 / a->n_threads ) ) & (~63));
       
       //TODO compare with a bzero operation
       for(j = 0 ; j < a->n_private_buckets; j++)
@@ -60,153 +61,18 @@ void ResetPrivateTables(Aggregate a)
       }
 }
 
-static inline void AddToGlobalAtomic(Aggregate a, const int id, 
-				     uint64_t key, 
-				     uint64_t count1, uint64_t sum1, uint64_t square1,
-				     uint64_t count2, uint64_t sum2, uint64_t square2,
-				     uint64_t count3, uint64_t sum3, uint64_t square3,
-				     uint64_t count4, uint64_t sum4
-				     )
-{
-  register unsigned int i, index;
-  register HashCell *current, *prev, *first;
-
-  /* place oft used info in local variables */
-  register const Tuple* input = a->input;
-  register HashCell *buckets = a->global_buckets;
-  register char *valid = a->valid;
-						   
-
-  register bool done = false; /* flag set when the current tuple is processed */
-  index = mhash(key, a->lg_buckets);
-      
-  /* First check to see if the bucket has been visited before */
-  if(!valid[index])
-  {
-    /* we're first, initialize the cell */
-    MUTEX_LOCK(buckets[index].lock);
-    
-    /* recheck the bucket status after we aquire the lock */
-    /* someone may have beat us here */	  
-    if(valid[index] == 0)
-      {
-	buckets[index].key = key;
-
-	buckets[index].sum1 = sum1;
-	buckets[index].count1 = count1;
-	buckets[index].squares1 = square1;
-
-	buckets[index].sum2 = sum2;
-	buckets[index].count2 = count2;
-	buckets[index].squares2 = square2;
-
-	buckets[index].sum3 = sum3;
-	buckets[index].count3 = count3;
-	buckets[index].squares3 = square3;
-
-	buckets[index].sum4 = sum4;
-	buckets[index].count4 = count4;
-
-	buckets[index].next = NULL;
-	
-	/* TODO: Because the valid bit is read unlocked above, */
-	/* we may need a membar_exit before setting valid to */
-	/* ensure that the previous stores are globally visible */
-	/* before the valid bit is */
-	membar_exit();
-	valid[index] = 1; /*set last or immediatley valid...*/
-	done = true;	 
-      }	  
-    MUTEX_UNLOCK(buckets[index].lock);
-  }
-  
-  /* if !done we didn't initialize a cell above */
-  while(!done)
-    {
-      /* the bucket is valid, so look at the chain*/	  
-      first = buckets[index].next;
-      current = &buckets[index];
-      prev = NULL;
-      
-      /* is key already there? */
-      while(current!=NULL && current->key != key)
-	{ 
-	  prev = current;
-	  current = current->next;
-	}
-      
-      if(current)
-	{	     
-	  /* Found key -- update aggregate */	      
-
-	  atomic_add_64(&(current->sum1),sum1); /* atomic add */
-	  atomic_add_64(&(current->count1), count1); /* atomic increment */
-	  atomic_add_64(&(current->square1), square1); /* atomic add */	  
-
-	  atomic_add_64(&(current->sum2),sum2); /* atomic add */
-	  atomic_add_64(&(current->count2), count2); /* atomic increment */
-	  atomic_add_64(&(current->square2), square2); /* atomic add */	
-
-	  atomic_add_64(&(current->sum3),sum3); /* atomic add */
-	  atomic_add_64(&(current->count3), count3); /* atomic increment */
-	  atomic_add_64(&(current->square3), square3); /* atomic add */	
-
-	  atomic_add_64(&(current->sum4),sum4); /* atomic add */
-	  atomic_add_64(&(current->count4), count4); /* atomic increment */
-
-	  done = true;	    
-	}
-      else
-	{	      
-	  /* Didn't find key, allocate new cell */
-	  MUTEX_LOCK(buckets[index].lock);
-	  if(buckets[index].next == first) 
-	    {
-	      /* as we did in earlier init code, make sure we weren't beaten */
-	      current  = (HashCell*)malloc(sizeof(HashCell));
-	      
-	      current->key = key;
-
-	      current->sum1 = sum1;
-	      current->count1 = count1;
-	      current->squares1 = square1;
-
-	      current->sum2 = sum2;
-	      current->count2 = count2;
-	      current->squares2 = square2;
-
-	      current->sum3 = sum3;
-	      current->count3 = count3;
-	      current->squares3 = square3;
-
-	      current->sum4 = sum4;
-	      current->count4 = count4;
-
-	      current->next = first;
-	      //	      MUTEX_INIT(current->lock);
-	      membar_exit();
-	      /* Set last or other threads can see it before init!*/
-	      /* TODO: As mentioned above, we may need a membar here */
-	      buckets[index].next = current; 
-	      done = true;
-	    }
-	  /* If we fail, we redo everything, instead of continuing where */
-	  /* we left off...ok for now -- rarely happens */	      
-	  MUTEX_UNLOCK(buckets[index].lock);
-	}
-    }  
-}
 
 
-void AggregateSample(Aggregate a, const int id, 
-			    const int start, const int end, 
-			    int *hits, int* num_runs)
+/* AggregateSample of [start, end], plain as in ColumnGet */
+static inline void SampleRange(Aggregate a, const int id,
+			       const int start, const int end,
+			       int *hits, int* num_runs, const bool plain)
 {
   register unsigned int i, j, k, index;
   register uint64_t key;
 
   /* place oft used info in local variables */
-  register const Tuple* input = a->input;
+  register const InputColumns input = a->columns;
   register PrivateHashBucket *buckets = a->private_buckets[id];
 
   // do counting with local variables
@@ -215,9 +81,9 @@ void AggregateSample(Aggregate a, const int id,
  
   for(i = start; i <= end; i++)
     {
-      key = input[i].group;
+      key = ColumnGet(input.group, i, plain);
 
-      if(i > start && input[i-1].group != key)
+      if(i > start && ColumnGet(input.group, i-1, plain) != key)
 	{
 	  /* end of a run */
 	  _num_runs ++;
@@ -240,19 +106,19 @@ void AggregateSample(Aggregate a, const int id,
 	    {
 	      // Found key, do aggregation.
 		  buckets[index].data[j].count1 ++;
-		  buckets[index].data[j].sum1 += input[i].value1;
-		  buckets[index].data[j].squares1 += input[i].value1 * input[i].value1;
+		  buckets[index].data[j].sum1 += ColumnGet(input.value1, i, plain);
+		  buckets[index].data[j].squares1 += ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
 		  buckets[index].data[j].count2 ++;
-		  buckets[index].data[j].sum2 += input[i].value2;
-		  buckets[index].data[j].squares2 += input[i].value2 * input[i].value2;
+		  buckets[index].data[j].sum2 += ColumnGet(input.value2, i, plain);
+		  buckets[index].data[j].squares2 += ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
 		  buckets[index].data[j].count3 ++;
-		  buckets[index].data[j].sum3 += input[i].value3;
-		  buckets[index].data[j].squares3 += input[i].value3 * input[i].value3;
+		  buckets[index].data[j].sum3 += ColumnGet(input.value3, i, plain);
+		  buckets[index].data[j].squares3 += ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
 		  buckets[index].data[j].count4 ++;
-		  buckets[index].data[j].sum4 += input[i].value4;
+		  buckets[index].data[j].sum4 += ColumnGet(input.value4, i, plain);
 
 		  _hits ++;
 	    }
@@ -262,19 +128,19 @@ void AggregateSample(Aggregate a, const int id,
 	      buckets[index].data[j].key = key;
 
 	      buckets[index].data[j].count1 = 1;
-	      buckets[index].data[j].sum1 = input[i].value1;
-	      buckets[index].data[j].squares1 = input[i].value1 * input[i].value1;
+	      buckets[index].data[j].sum1 = ColumnGet(input.value1, i, plain);
+	      buckets[index].data[j].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
 	      buckets[index].data[j].count2 = 1;
-	      buckets[index].data[j].sum2 = input[i].value2;
-	      buckets[index].data[j].squares2 = input[i].value2 * input[i].value2;
+	      buckets[index].data[j].sum2 = ColumnGet(input.value2, i, plain);
+	      buckets[index].data[j].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-	      buckets[index].data[j].count3 = 3;
-	      buckets[index].data[j].sum3 = input[i].value3;
-	      buckets[index].data[j].squares3 = input[i].value3 * input[i].value3;
+	      buckets[index].data[j].count3 = 1;
+	      buckets[index].data[j].sum3 = ColumnGet(input.value3, i, plain);
+	      buckets[index].data[j].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
 	      buckets[index].data[j].count4 = 1;
-	      buckets[index].data[j].sum4 = input[i].value4;
+	      buckets[index].data[j].sum4 = ColumnGet(input.value4, i, plain);
 
 	      buckets[index].valid[j] = 1;
 	    }
@@ -305,19 +171,19 @@ void AggregateSample(Aggregate a, const int id,
 	  buckets[index].data[0].key = key;
 
 	  buckets[index].data[0].count1 = 1;
-	  buckets[index].data[0].sum1 = input[i].value1;
-	  buckets[index].data[0].squares1 = input[i].value1 * input[i].value1;
+	  buckets[index].data[0].sum1 = ColumnGet(input.value1, i, plain);
+	  buckets[index].data[0].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
 	  buckets[index].data[0].count2 = 1;
-	  buckets[index].data[0].sum2 = input[i].value2;
-	  buckets[index].data[0].squares2 = input[i].value2 * input[i].value2;
+	  buckets[index].data[0].sum2 = ColumnGet(input.value2, i, plain);
+	  buckets[index].data[0].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
 	  buckets[index].data[0].count3 = 1;
-	  buckets[index].data[0].sum3 = input[i].value3;
-	  buckets[index].data[0].squares3 = input[i].value3 * input[i].value3;
+	  buckets[index].data[0].sum3 = ColumnGet(input.value3, i, plain);
+	  buckets[index].data[0].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
 	  buckets[index].data[0].count4 = 1;
-	  buckets[index].data[0].sum4 = input[i].value4;
+	  buckets[index].data[0].sum4 = ColumnGet(input.value4, i, plain);
 	}    
     }
   //store hits and runs for return to caller
@@ -325,19 +191,39 @@ void AggregateSample(Aggregate a, const int id,
   *num_runs += _num_runs;
 }
 
-void AggregateHybrid(Aggregate a, const int id, 
-			  const int start, const int end)
+void AggregateSample(Aggregate a, const int id, 
+			    const int start, const int end, 
+			    int *hits, int* num_runs)
+{
+  if(ColumnsPlain(&(a->columns)))
+    SampleRange(a, id, start, end, hits, num_runs, true);
+  else
+    SampleRange(a, id, start, end, hits, num_runs, false);
+}
+
+/* AggregateHybrid of [start, end], plain as in ColumnGet */
+static inline void HybridRange(Aggregate a, const int id,
+			       const int start, const int end, const bool plain)
 {
   register unsigned int i, j, k, index;
   register uint64_t key;
+  uint64_t keys[COLUMN_BATCH]; /* decoded ahead of hashing */
 
   /* place oft used info in local variables */
-  register const Tuple* input = a->input;
+  register const InputColumns input = a->columns;
   PrivateHashBucket *buckets = a->private_buckets[id];
 
   for(i = start; i <= end; i++)
     {
-      key = input[i].group;
+      if(plain)
+	key = ColumnGet(input.group, i, true);
+      else
+	{
+	  /* decode the next batch of keys, see Column in global.h */
+	  if((i - start) % COLUMN_BATCH == 0)
+	    ColumnDecode(input.group, i, (end - i + 1 < COLUMN_BATCH) ? end - i + 1 : COLUMN_BATCH, keys);
+	  key = keys[(i - start) % COLUMN_BATCH];
+	}
       index = mhash(key, a->lg_private_buckets);
       
       j = 0;
@@ -353,19 +239,19 @@ void AggregateHybrid(Aggregate a, const int id,
 	    {
 	      // Found key, do aggregation.
 	      buckets[index].data[j].count1 ++;
-		  buckets[index].data[j].sum1 += input[i].value1;
-		  buckets[index].data[j].squares1 += input[i].value1 * input[i].value1;
+		  buckets[index].data[j].sum1 += ColumnGet(input.value1, i, plain);
+		  buckets[index].data[j].squares1 += ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
 		  buckets[index].data[j].count2 ++;
-		  buckets[index].data[j].sum2 += input[i].value2;
-		  buckets[index].data[j].squares2 += input[i].value2 * input[i].value2;
+		  buckets[index].data[j].sum2 += ColumnGet(input.value2, i, plain);
+		  buckets[index].data[j].squares2 += ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
 		  buckets[index].data[j].count3 ++;
-		  buckets[index].data[j].sum3 += input[i].value3;
-		  buckets[index].data[j].squares3 += input[i].value3 * input[i].value3;
+		  buckets[index].data[j].sum3 += ColumnGet(input.value3, i, plain);
+		  buckets[index].data[j].squares3 += ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
 		  buckets[index].data[j].count4 ++;
-		  buckets[index].data[j].sum4 += input[i].value4;
+		  buckets[index].data[j].sum4 += ColumnGet(input.value4, i, plain);
 	    }
 	  else
 	    {
@@ -373,19 +259,19 @@ void AggregateHybrid(Aggregate a, const int id,
 	      buckets[index].data[j].key = key;
 
 	      buckets[index].data[j].count1 = 1;
-	      buckets[index].data[j].sum1 = input[i].value1;
-	      buckets[index].data[j].squares1 = input[i].value1 * input[i].value1;
+	      buckets[index].data[j].sum1 = ColumnGet(input.value1, i, plain);
+	      buckets[index].data[j].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
 	      buckets[index].data[j].count2 = 1;
-	      buckets[index].data[j].sum2 = input[i].value2;
-	      buckets[index].data[j].squares2 = input[i].value2 * input[i].value2;
+	      buckets[index].data[j].sum2 = ColumnGet(input.value2, i, plain);
+	      buckets[index].data[j].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-	      buckets[index].data[j].count3 = 3;
-	      buckets[index].data[j].sum3 = input[i].value3;
-	      buckets[index].data[j].squares3 = input[i].value3 * input[i].value3;
+	      buckets[index].data[j].count3 = 1;
+	      buckets[index].data[j].sum3 = ColumnGet(input.value3, i, plain);
+	      buckets[index].data[j].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
 	      buckets[index].data[j].count4 = 1;
-	      buckets[index].data[j].sum4 = input[i].value4;
+	      buckets[index].data[j].sum4 = ColumnGet(input.value4, i, plain);
 
 	      buckets[index].valid[j] = 1;
 	    }
@@ -416,62 +302,101 @@ void AggregateHybrid(Aggregate a, const int id,
 	  buckets[index].data[0].key = key;
 
 	  buckets[index].data[0].count1 = 1;
-	  buckets[index].data[0].sum1 = input[i].value1;
-	  buckets[index].data[0].squares1 = input[i].value1 * input[i].value1;
+	  buckets[index].data[0].sum1 = ColumnGet(input.value1, i, plain);
+	  buckets[index].data[0].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
 	  buckets[index].data[0].count2 = 1;
-	  buckets[index].data[0].sum2 = input[i].value2;
-	  buckets[index].data[0].squares2 = input[i].value2 * input[i].value2;
+	  buckets[index].data[0].sum2 = ColumnGet(input.value2, i, plain);
+	  buckets[index].data[0].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
 	  buckets[index].data[0].count3 = 1;
-	  buckets[index].data[0].sum3 = input[i].value3;
-	  buckets[index].data[0].squares3 = input[i].value3 * input[i].value3;
+	  buckets[index].data[0].sum3 = ColumnGet(input.value3, i, plain);
+	  buckets[index].data[0].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
 	  buckets[index].data[0].count4 = 1;
-	  buckets[index].data[0].sum4 = input[i].value4;
+	  buckets[index].data[0].sum4 = ColumnGet(input.value4, i, plain);
 	}    
     }
 }
 
+void AggregateHybrid(Aggregate a, const int id,
+		     const int start, const int end)
+{
+  if(ColumnsPlain(&(a->columns)))
+    HybridRange(a, id, start, end, true);
+  else
+    HybridRange(a, id, start, end, false);
+}
+
+
 
 
+/* push buckets [start_bucket, end_bucket) of private table into the global table */
+static void MergePrivateBuckets(Aggregate a, const int id, const int table,
+				const int start_bucket, const int end_bucket)
+{
+  int b, i;
+  PrivateHashBucket *bucket;
+
+  /* for all buckets in the range */
+  for(b = start_bucket; b < end_bucket; b++)
+    {
+      bucket = &(a->private_buckets[table][b]);
+      i = 0;
+      /* Do all the data elements in the current bucket */
+      while(i < PRIVATE_BUCKET_SIZE && bucket->valid[i])
+	{
+	  AddToGlobalAtomic(a, id, 
+			    bucket->data[i].key,
+			    bucket->data[i].count1,
+			    bucket->data[i].sum1,
+			    bucket->data[i].squares1,
+			    bucket->data[i].count2,
+			    bucket->data[i].sum2,
+			    bucket->data[i].squares2,
+			    bucket->data[i].count3,
+			    bucket->data[i].sum3,
+			    bucket->data[i].squares3,
+			    bucket->data[i].count4,
+			    bucket->data[i].sum4
+			    );
+	  i++;
+	}	  	  
+    }
+}
 
 // We put all the local data directly into the global table
 void AggregateMergeLite(Aggregate a, const int id)
 {
-  int b, table, i;
+  int table;
 
   const int start_bucket = id * (a->n_private_buckets/a->n_threads);
   const int end_bucket = (id == a->n_threads-1) ? a->n_private_buckets : (id+1) *(a->n_private_buckets/a->n_threads);
-  PrivateHashBucket *bucket;
 
   /* for all tables */
   for(table = 0; table < a->n_threads; table++)
+    MergePrivateBuckets(a, id, table, start_bucket, end_bucket);
+}
+
+/* Push only my own private table, all of it, into the global table. Used */
+/* by the pipelined merge right after a thread runs out of input, while */
+/* the other threads may still be aggregating. */
+void AggregateMergePrivate(Aggregate a, const int id)
+{
+  MergePrivateBuckets(a, id, id, 0, a->n_private_buckets);
+}
+
+/* Push my private table into the global table and empty it, so that the */
+/* global table holds all I aggregated so far. See StreamEmit. */
+void AggregateFlushPrivate(Aggregate a, const int id)
+{
+  register int j, k;
+
+  AggregateMergePrivate(a, id);
+  for(j = 0; j < a->n_private_buckets; j++)
     {
-      /* for all buckets in my range */      
-      for(b = start_bucket; b < end_bucket; b++)
-	{
-	  bucket = &(a->private_buckets[table][b]);
-	  i = 0;
-	  /* Do all the data elements in the current bucket */
-	  while(i < PRIVATE_BUCKET_SIZE && bucket->valid[i])
-	    {
-	      AddToGlobalAtomic(a, id, 
-				bucket->data[i].key,
-				bucket->data[i].count1,
-				bucket->data[i].sum1,
-				bucket->data[i].squares1,
-				bucket->data[i].count2,
-				bucket->data[i].sum2,
-				bucket->data[i].squares2,
-				bucket->data[i].count3,
-				bucket->data[i].sum3,
-				bucket->data[i].squares3,
-				bucket->data[i].count4,
-				bucket->data[i].sum4
-				);
-	      i++;
-	    }	  	  
-	}      
-    }  
+      a->private_buckets[id][j].access_count = 0;
+      for(k = 0; k < PRIVATE_BUCKET_SIZE; k++)
+	a->private_buckets[id][j].valid[k] = 0;
+    }
 }
@@ -0,0 +1,268 @@
+/*
+ * File: independent.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Aggregation into a private, chained table per thread that covers all
+ * of the groups. Used by the partitioned strategy and as one of the arms
+ * of the adaptive engine's bandit.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+#include "global_table.h"
+
+#include <thread.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mtmalloc.h>
+#include <math.h>
+
+/* stub for thread to start in for table initialization */
+static void * run_init_independent(void *v)
+{
+  register int i;
+  ThreadInfo *info = (ThreadInfo*)v;
+  Aggregate a = info->a;
+  const int id = info->id;
+
+  for(i = 0 ; i < a->n_buckets; i++)
+    {
+      a->independent_cells[id][i].valid = 0;
+      a->independent_cells[id][i].next = NULL;
+    }
+
+  return NULL;
+}
+
+/* Allocate and clear one table of a->n_buckets cells per thread */
+void InitializeIndependentTables(Aggregate a)
+{
+  register int i, j;
+
+  /* allocate the pointers to the hash tables */
+  a->independent_cells = (IndependentHashCell**)malloc(sizeof(IndependentHashCell*) * a->n_threads);
+  assert(a->independent_cells);
+  char* ptr = (char*)malloc( (sizeof(IndependentHashCell)*a->n_buckets+8192+64) * a->n_threads); // we allocate extra to allow for setting the alignment.
+  assert(ptr);  
+
+  /* Initialize the table */
+  /* TODO: If we are going to include initialization time in the */
+  /*       running time, then this should be done in parallel */
+  for(i = 0; i < a->n_threads; i++)
+    {
+      /* Ken noticed that there is an alignment issue, this fixes it */
+      // align to the 64 byte L2 cache, choose a different offset in the 8K L1.
+      a->independent_cells[i] = (IndependentHashCell*) ((unsigned long)(ptr + 64 + (i * (a->n_buckets * sizeof(IndependentHashCell) + 8192 + 64) ) + i*(8192 / a->n_threads ) ) & (~63));
+      
+    }
+
+  if(a->n_buckets < 1000 && !a->opts.numa)
+    {
+      /* do serially */
+       for(i = 0; i < a->n_threads; i++)
+	 {
+	   
+	   for(j = 0 ; j < a->n_buckets; j++)
+	     {
+	       a->independent_cells[i][j].valid = 0;
+	       a->independent_cells[i][j].next = NULL;
+	     }
+	 }
+    }
+  else
+    {
+      /* do with all threads */
+      PoolRun(a, run_init_independent);
+    }
+}
+
+/* AggregateIndependent, plain as in ColumnGet */
+static inline void IndependentRange(Aggregate a, const int id,
+				    const int start, const int end, const bool plain)
+{
+  register unsigned int i, index;
+  register IndependentHashCell *current, *prev;
+
+  /* place oft used info in local variables */
+  register const int lg_buckets = a->lg_buckets;
+  register const InputColumns input = a->columns;
+  register IndependentHashCell *buckets = a->independent_cells[id];
+
+  for(i = start; i <= end; i++)
+    {
+      index = mhash(ColumnGet(input.group, i, plain), lg_buckets);
+      if(buckets[index].valid == 0)
+	{
+	  /* unused slot, add our info and we're done */
+	  buckets[index].key = ColumnGet(input.group, i, plain);
+
+	  buckets[index].sum1 = ColumnGet(input.value1, i, plain);
+	  buckets[index].count1 = 1;
+	  buckets[index].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
+
+	  buckets[index].sum2 = ColumnGet(input.value2, i, plain);
+	  buckets[index].count2 = 1;
+	  buckets[index].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
+
+	  buckets[index].sum3 = ColumnGet(input.value3, i, plain);
+	  buckets[index].count3 = 1;
+	  buckets[index].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
+
+	  buckets[index].sum4 = ColumnGet(input.value4, i, plain);
+	  buckets[index].count4 = 1;
+
+	  buckets[index].next = NULL;
+	  buckets[index].valid = 1;
+	}	   
+      else
+	{
+	  /* the bucket is valid, so look at the chain*/
+	  current = &buckets[index];
+	  prev = NULL;
+
+	  /* is key already there? */
+	  while(current!=NULL && current->key != ColumnGet(input.group, i, plain))
+	    {
+	      prev = current;
+	      current = current->next;	      
+	    }
+	  
+	  if(current)
+	    {	   
+	      /* Found key -- update aggregate */
+	      current->sum1 += ColumnGet(input.value1, i, plain);	
+	      current->count1 ++;
+	      current->squares1 += ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
+
+	      current->sum2 += ColumnGet(input.value2, i, plain);	
+	      current->count2 ++;
+	      current->squares2 += ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
+
+	      current->sum3 += ColumnGet(input.value3, i, plain);	
+	      current->count3 ++;
+	      current->squares3 += ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
+
+	      current->sum4 += ColumnGet(input.value4, i, plain);	
+	      current->count4 ++;
+
+	    }
+	  else
+	    {	 
+	      /* Didn't find key, allocate new cell */
+	      current  = (IndependentHashCell*)malloc(sizeof(IndependentHashCell));
+	      assert(current);
+	      current->key = ColumnGet(input.group, i, plain);
+
+	      current->sum1 = ColumnGet(input.value1, i, plain);
+	      current->count1 = 1;
+	      current->squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
+
+	      current->sum2 = ColumnGet(input.value2, i, plain);
+	      current->count2 = 1;
+	      current->squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
+
+	      current->sum3 = ColumnGet(input.value3, i, plain);
+	      current->count3 = 1;
+	      current->squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
+
+	      current->sum4 = ColumnGet(input.value4, i, plain);
+	      current->count4 = 1;
+
+	      //add to front
+	      current->next = buckets[index].next;	      
+	      buckets[index].next = current;
+	    } 
+	}    
+    }    
+}
+
+/* Aggregate [start, end] into the independent table of thread id */
+void AggregateIndependent(Aggregate a, const int id,
+			  const int start, const int end)
+{
+  if(ColumnsPlain(&(a->columns)))
+    IndependentRange(a, id, start, end, true);
+  else
+    IndependentRange(a, id, start, end, false);
+}
+
+/* empty the independent table of thread id */
+static void ResetIndependentTable(Aggregate a, const int id)
+{
+  for(int j = 0; j < a->n_buckets; j++)
+    {
+      if(a->independent_cells[id][j].valid)
+	{
+	  IndependentHashCell *cur, *prev;
+	  prev = NULL;
+	  cur = a->independent_cells[id][j].next;
+	  while(cur != NULL)
+	    {
+	      if(prev != NULL)
+		free(prev);
+	      prev = cur;
+	      cur = cur->next;
+	    }
+	  if(prev != NULL)
+	    free(prev);
+	}
+
+      a->independent_cells[id][j].valid = 0;
+      a->independent_cells[id][j].next = NULL;
+    }
+}
+
+void ResetIndependentTables(Aggregate a)
+{
+  for(int i = 0; i < a->n_threads; i++)
+    ResetIndependentTable(a, i);
+}
+
+
+/* Push every independent table into the global table. Threads split the */
+/* buckets between them, as in AggregateMergeLite. */
+void AggregateMergeIndependent(Aggregate a, const int id)
+{
+  int bucket, table;
+  IndependentHashCell *p;
+
+  const int start_bucket = id * (a->n_buckets/a->n_threads);
+  const int end_bucket = (id == a->n_threads-1) ? a->n_buckets : (id+1) *(a->n_buckets/a->n_threads);
+
+  for(table = 0; table < a->n_threads; table++)
+    for(bucket = start_bucket; bucket < end_bucket; bucket++)
+      if(a->independent_cells[table][bucket].valid)
+	for(p = &(a->independent_cells[table][bucket]); p != NULL; p = p->next)
+	  AddToGlobalAtomic(a, id, p->key,
+			    p->count1, p->sum1, p->squares1,
+			    p->count2, p->sum2, p->squares2,
+			    p->count3, p->sum3, p->squares3,
+			    p->count4, p->sum4);
+}
+
+/* Push all of my own independent table into the global table (pipelined */
+/* merge). */
+void AggregateMergeIndependentTable(Aggregate a, const int id)
+{
+  int bucket;
+  IndependentHashCell *p;
+
+  for(bucket = 0; bucket < a->n_buckets; bucket++)
+    if(a->independent_cells[id][bucket].valid)
+      for(p = &(a->independent_cells[id][bucket]); p != NULL; p = p->next)
+	AddToGlobalAtomic(a, id, p->key,
+			  p->count1, p->sum1, p->squares1,
+			  p->count2, p->sum2, p->squares2,
+			  p->count3, p->sum3, p->squares3,
+			  p->count4, p->sum4);
+}
+
+/* Push my independent table into the global table and empty it. See StreamEmit. */
+void AggregateFlushIndependent(Aggregate a, const int id)
+{
+  AggregateMergeIndependentTable(a, id);
+  ResetIndependentTable(a, id);
+}
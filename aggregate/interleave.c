@@ -0,0 +1,258 @@
+/*
+ * File: interleave.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Global table insertion with several lookups in flight per thread.
+ * Walking a chain is a dependent pointer chase, and every step that
+ * misses the cache stalls the thread. Here each thread keeps up to
+ * a->opts.interleave lookups, each a small state machine. Whenever a
+ * lookup needs a bucket or chain cell it prefetches it and the thread
+ * moves on to the next lookup, so by the time it comes back around the
+ * cell has (hopefully) arrived and the misses of all lookups overlap.
+ *
+ * Tuples are finished out of input order, which doesn't matter for
+ * aggregates. Locks are never held across a switch, so two lookups of
+ * the same thread can't deadlock on a bucket. Insertion follows
+ * AggregateAtomic and AggregateMutex exactly: the lock only protects
+ * filling an empty bucket and pushing onto a chain; updates of a found
+ * cell are atomic adds or, for the lock strategy, under the cell's lock.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+#include "global_table.h"
+
+#include <atomic.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <mtmalloc.h>
+
+#include <sun_prefetch.h>
+
+/* where a lookup stands */
+typedef enum
+{
+  LOOKUP_IDLE, /* needs a tuple */
+  LOOKUP_BUCKET, /* waiting for its bucket */
+  LOOKUP_CHAIN /* waiting for cell current of the chain */
+} LookupStage;
+
+typedef struct Lookup
+{
+  LookupStage stage;
+  unsigned int tuple;
+  unsigned int index;
+  HashCell *first; /* head of the chain when the walk started */
+  HashCell *current;
+} Lookup;
+
+/* fill a new cell with tuple i */
+static inline void InitCell(HashCell *c, const InputColumns *t, const unsigned int i,
+			    const bool plain)
+{
+  c->key = ColumnGet(t->group, i, plain);
+
+  c->sum1 = ColumnGet(t->value1, i, plain);
+  c->count1 = 1;
+  c->squares1 = ColumnGet(t->value1, i, plain) * ColumnGet(t->value1, i, plain);
+
+  c->sum2 = ColumnGet(t->value2, i, plain);
+  c->count2 = 1;
+  c->squares2 = ColumnGet(t->value2, i, plain) * ColumnGet(t->value2, i, plain);
+
+  c->sum3 = ColumnGet(t->value3, i, plain);
+  c->count3 = 1;
+  c->squares3 = ColumnGet(t->value3, i, plain) * ColumnGet(t->value3, i, plain);
+
+  c->sum4 = ColumnGet(t->value4, i, plain);
+  c->count4 = 1;
+}
+
+/* add tuple i to a cell that already holds its key */
+static inline void UpdateCell(Aggregate a, const int id, HashCell *c,
+			      const InputColumns *t, const unsigned int i, const bool locked,
+			      unsigned int *cas_failures, unsigned int *lock_waits,
+			      const bool plain)
+{
+  if(locked)
+    {
+      *lock_waits += LockAcquire(a, id, &(c->lock));
+      c->sum1 += ColumnGet(t->value1, i, plain);
+      c->count1 ++;
+      c->squares1 += ColumnGet(t->value1, i, plain) * ColumnGet(t->value1, i, plain);
+
+      c->sum2 += ColumnGet(t->value2, i, plain);
+      c->count2 ++;
+      c->squares2 += ColumnGet(t->value2, i, plain) * ColumnGet(t->value2, i, plain);
+
+      c->sum3 += ColumnGet(t->value3, i, plain);
+      c->count3 ++;
+      c->squares3 += ColumnGet(t->value3, i, plain) * ColumnGet(t->value3, i, plain);
+
+      c->sum4 += ColumnGet(t->value4, i, plain);
+      c->count4 ++;
+      LockRelease(a, id, &(c->lock));
+    }
+  else
+    {
+      *cas_failures += AtomicAddCounted(&(c->sum1), ColumnGet(t->value1, i, plain));
+      *cas_failures += AtomicAddCounted(&(c->count1), 1);
+      *cas_failures += AtomicAddCounted(&(c->squares1), ColumnGet(t->value1, i, plain) * ColumnGet(t->value1, i, plain));
+
+      *cas_failures += AtomicAddCounted(&(c->sum2), ColumnGet(t->value2, i, plain));
+      *cas_failures += AtomicAddCounted(&(c->count2), 1);
+      *cas_failures += AtomicAddCounted(&(c->squares2), ColumnGet(t->value2, i, plain) * ColumnGet(t->value2, i, plain));
+
+      *cas_failures += AtomicAddCounted(&(c->sum3), ColumnGet(t->value3, i, plain));
+      *cas_failures += AtomicAddCounted(&(c->count3), 1);
+      *cas_failures += AtomicAddCounted(&(c->squares3), ColumnGet(t->value3, i, plain) * ColumnGet(t->value3, i, plain));
+
+      *cas_failures += AtomicAddCounted(&(c->sum4), ColumnGet(t->value4, i, plain));
+      *cas_failures += AtomicAddCounted(&(c->count4), 1);
+    }
+}
+
+/*
+ * Aggregate [start, end] into the global table of thread id, plain as
+ * in ColumnGet
+ */
+static inline void AggregateInterleaved(Aggregate a, const int id,
+					const int start, const int end,
+					const bool locked, const bool plain)
+{
+  register int s;
+  register unsigned int next = start, active = 0;
+  register Lookup *l;
+  register HashCell *c;
+  Lookup lookups[INTERLEAVE_MAX];
+
+  /* place oft used info in local variables */
+  const unsigned int lg_buckets = a->lg_buckets;
+  const InputColumns input = a->columns;
+  register HashCell *buckets = a->node_buckets[a->table_of[id]];
+  register char* valid = a->node_valid[a->table_of[id]];
+  const int width = (a->opts.interleave > INTERLEAVE_MAX) ? INTERLEAVE_MAX : a->opts.interleave;
+
+  /* contention counts, see global_table.h */
+  unsigned int cas_failures = 0, lock_waits = 0, chain_retries = 0;
+
+  if(start > end)
+    return;
+
+  for(s = 0; s < width; s++)
+    lookups[s].stage = LOOKUP_IDLE;
+
+  /* round robin over the lookups until the range is done */
+  for(s = 0; next <= end || active > 0; s = (s + 1 == width) ? 0 : s + 1)
+    {
+      l = &lookups[s];
+      switch(l->stage)
+	{
+	case LOOKUP_IDLE:
+	  if(next > end)
+	    break;
+	  /* start a new lookup: hash, prefetch the bucket, switch */
+	  l->tuple = next++;
+	  l->index = mhash(ColumnGet(input.group, l->tuple, plain), lg_buckets);
+	  sun_prefetch_read_many(&valid[l->index]);
+	  sun_prefetch_write_many(&buckets[l->index]);
+	  l->stage = LOOKUP_BUCKET;
+	  active ++;
+	  break;
+
+	case LOOKUP_BUCKET:
+	  if(!valid[l->index])
+	    {
+	      /* we're first, initialize the cell */
+	      c = &buckets[l->index];
+	      lock_waits += LockAcquire(a, id, &(c->lock));
+	      /* someone may have beat us here */
+	      if(valid[l->index] == 0)
+		{
+		  InitCell(c, &input, l->tuple, plain);
+		  c->next = NULL;
+		  membar_exit();
+		  valid[l->index] = 1; /*set last or immediatley valid...*/
+		  l->stage = LOOKUP_IDLE;
+		}
+	      LockRelease(a, id, &(c->lock));
+	      if(l->stage == LOOKUP_IDLE)
+		{
+		  active --;
+		  break;
+		}
+	    }
+	  /* the bucket is valid and cached, walk the chain from it */
+	  l->first = buckets[l->index].next;
+	  l->current = &buckets[l->index];
+	  l->stage = LOOKUP_CHAIN;
+	  /* no break: the bucket itself is the first cell to look at */
+
+	case LOOKUP_CHAIN:
+	  c = l->current;
+	  if(c->key == ColumnGet(input.group, l->tuple, plain))
+	    {
+	      /* Found key -- update aggregate */
+	      UpdateCell(a, id, c, &input, l->tuple, locked, &cas_failures, &lock_waits, plain);
+	      l->stage = LOOKUP_IDLE;
+	      active --;
+	    }
+	  else if(c->next != NULL)
+	    {
+	      /* one more step: fetch it while the other lookups run */
+	      l->current = c->next;
+	      sun_prefetch_write_many(l->current);
+	    }
+	  else
+	    {
+	      /* Didn't find key, allocate new cell at beginning */
+	      c = &buckets[l->index];
+	      lock_waits += LockAcquire(a, id, &(c->lock));
+	      if(c->next == l->first)
+		{
+		  l->current = (HashCell*)malloc(sizeof(HashCell));
+		  InitCell(l->current, &input, l->tuple, plain);
+		  l->current->next = l->first;
+		  if(locked)
+		    LockInit(a, &(l->current->lock));
+		  membar_exit();
+		  c->next = l->current;
+		  l->stage = LOOKUP_IDLE;
+		  active --;
+		}
+	      else
+		{
+		  /* beaten to it, walk again from the head */
+		  chain_retries ++;
+		  l->first = c->next;
+		  l->current = c;
+		}
+	      LockRelease(a, id, &(c->lock));
+	    }
+	  break;
+	}
+    }
+
+  ContentionAdd(a, id, cas_failures, lock_waits, chain_retries, end - start + 1);
+}
+
+/* AggregateAtomic with a->opts.interleave lookups in flight */
+void AggregateAtomicInterleaved(Aggregate a, const int id,
+				const int start, const int end)
+{
+  if(ColumnsPlain(&(a->columns)))
+    AggregateInterleaved(a, id, start, end, false, true);
+  else
+    AggregateInterleaved(a, id, start, end, false, false);
+}
+
+/* AggregateMutex with a->opts.interleave lookups in flight */
+void AggregateMutexInterleaved(Aggregate a, const int id,
+			       const int start, const int end)
+{
+  if(ColumnsPlain(&(a->columns)))
+    AggregateInterleaved(a, id, start, end, true, true);
+  else
+    AggregateInterleaved(a, id, start, end, true, false);
+}
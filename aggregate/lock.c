@@ -0,0 +1,174 @@
+/*
+ * File: lock.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * The contended paths of the global table locks (see lock.h).
+ *
+ * Spinning waiters give up the processor every LOCK_YIELD_SPINS rounds,
+ * so that a holder that was preempted on an oversubscribed machine gets
+ * to run and release the lock.
+ *
+ * Futexes are Linux only. Elsewhere the futex lock's waiters yield the
+ * processor instead of sleeping, and waking them is a no-op.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+#include "lock.h"
+
+#include <atomic.h>
+#include <thread.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#define LOCK_BACKOFF_MIN (4) /* first ttas backoff, in delay loop rounds */
+#define LOCK_BACKOFF_MAX (1024) /* longest ttas backoff */
+#define LOCK_YIELD_SPINS (4096) /* spin rounds between yields */
+#define FUTEX_SPINS (128) /* tries before a futex waiter sleeps */
+
+const char *LockName(LockKind kind)
+{
+  switch(kind)
+    {
+    case LOCK_PTHREAD: return "pthread";
+    case LOCK_TTAS: return "ttas";
+    case LOCK_TICKET: return "ticket";
+    case LOCK_MCS: return "mcs";
+    case LOCK_FUTEX: return "futex";
+    }
+  return "unknown";
+}
+
+/* wait about n rounds without touching shared memory */
+static void Delay(unsigned int n)
+{
+  volatile unsigned int i;
+  for(i = 0; i < n; i++)
+    ;
+}
+
+/* one round of a spin wait */
+static inline void Spin(unsigned int *spins)
+{
+  if(++(*spins) % LOCK_YIELD_SPINS == 0)
+    thr_yield();
+}
+
+static void FutexWait(volatile unsigned int *word, unsigned int value)
+{
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+  thr_yield();
+#endif
+}
+
+static void FutexWake(volatile unsigned int *word)
+{
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+/* Take l as thread id after the inline attempt of LockAcquire failed */
+void LockWait(Aggregate a, const int id, Lock *l)
+{
+  register unsigned int ticket, backoff, c;
+  register McsNode *me, *pred;
+  unsigned int spins = 0;
+
+  switch(a->opts.lock)
+    {
+    case LOCK_TTAS:
+      for(backoff = LOCK_BACKOFF_MIN; ; )
+	{
+	  /* read until it looks free, then try */
+	  while(l->word != 0)
+	    Spin(&spins);
+	  if(atomic_swap_uint(&l->word, 1) == 0)
+	    break;
+	  /* lost the race: let the others thin out */
+	  Delay(backoff);
+	  if(backoff < LOCK_BACKOFF_MAX)
+	    backoff <<= 1;
+	  else
+	    thr_yield();
+	}
+      break;
+
+    case LOCK_TICKET:
+      ticket = atomic_inc_uint_nv(&l->ticket.next) - 1;
+      while(l->ticket.owner != ticket)
+	{
+	  /* back off in proportion to the waiters ahead of us */
+	  Delay((ticket - l->ticket.owner) * LOCK_BACKOFF_MIN);
+	  Spin(&spins);
+	}
+      break;
+
+    case LOCK_MCS:
+      me = &(a->lock_nodes[id]);
+      me->next = NULL;
+      me->locked = 1;
+      membar_producer();
+      pred = (McsNode*)atomic_swap_ptr(&l->tail, me);
+      if(pred != NULL)
+	{
+	  pred->next = me;
+	  while(me->locked)
+	    Spin(&spins);
+	}
+      break;
+
+    case LOCK_FUTEX:
+      /* spin a little: critical sections here are short */
+      for(c = 0; c < FUTEX_SPINS; c++)
+	if(l->word == 0 && atomic_cas_uint(&l->word, 0, 1) == 0)
+	  {
+	    membar_enter();
+	    return;
+	  }
+      /* then sleep, marking the lock as having waiters */
+      while(atomic_swap_uint(&l->word, 2) != 0)
+	FutexWait(&l->word, 2);
+      break;
+
+    default:
+      assert(0);
+    }
+
+  membar_enter();
+}
+
+/* Hand l on after LockRelease found someone (maybe) waiting */
+void LockWake(Aggregate a, const int id, Lock *l)
+{
+  register McsNode *me;
+  unsigned int spins = 0;
+
+  switch(a->opts.lock)
+    {
+    case LOCK_MCS:
+      me = &(a->lock_nodes[id]);
+      /* a waiter swapped itself in but hasn't linked to us yet */
+      while(me->next == NULL)
+	Spin(&spins);
+      me->next->locked = 0;
+      break;
+
+    case LOCK_FUTEX:
+      FutexWake(&l->word);
+      break;
+
+    default:
+      assert(0);
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef _LOCK_H_
+#define _LOCK_H_
+
+/*
+ * File: lock.h
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * The locks of the global table cells. The kind is chosen at run time
+ * (a->opts.lock), so lock implementations can be compared without a
+ * rebuild. Every operation tries the uncontended case inline and leaves
+ * waiting to lock.c:
+ *
+ *  - pthread: a pthread mutex (the old default of global.h)
+ *  - ttas: test and test and set, backing off exponentially while held
+ *  - ticket: waiters are served in the order they took a ticket
+ *  - mcs: waiters queue up and each spins on its own node, so a release
+ *    only touches the cache line of the next waiter
+ *  - futex: spins a while, then sleeps until the holder wakes it
+ *
+ * A thread holds at most one lock at a time, which is what lets MCS get
+ * by with one queue node per thread (a->lock_nodes[id]).
+ *
+ * LockAcquire returns 1 if the lock was held by someone else, for the
+ * contention counts of global_table.h.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <atomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Initialize l as an unheld lock of a's kind */
+static inline void LockInit(Aggregate a, Lock *l)
+{
+  if(a->opts.lock == LOCK_PTHREAD)
+    pthread_mutex_init(&l->mutex, NULL);
+  else
+    {
+      l->ticket.next = 0; /* also the word of ttas and futex */
+      l->ticket.owner = 0;
+      l->tail = NULL;
+    }
+}
+
+/* Take l as thread id. Returns 1 if we had to wait for it, 0 otherwise. */
+static inline unsigned int LockAcquire(Aggregate a, const int id, Lock *l)
+{
+  register unsigned int owner;
+  register McsNode *me;
+
+  switch(a->opts.lock)
+    {
+    case LOCK_PTHREAD:
+      if(pthread_mutex_trylock(&l->mutex) == 0)
+	return 0;
+      pthread_mutex_lock(&l->mutex);
+      return 1;
+
+    case LOCK_TTAS:
+      if(l->word == 0 && atomic_swap_uint(&l->word, 1) == 0)
+	break;
+      LockWait(a, id, l);
+      return 1;
+
+    case LOCK_TICKET:
+      /* only take a ticket without waiting if nobody holds one */
+      owner = l->ticket.owner;
+      if(l->ticket.next == owner && atomic_cas_uint(&l->ticket.next, owner, owner + 1) == owner)
+	break;
+      LockWait(a, id, l);
+      return 1;
+
+    case LOCK_MCS:
+      me = &(a->lock_nodes[id]);
+      me->next = NULL;
+      membar_producer();
+      if(l->tail == NULL && atomic_cas_ptr(&l->tail, NULL, me) == NULL)
+	break;
+      LockWait(a, id, l);
+      return 1;
+
+    case LOCK_FUTEX:
+      if(atomic_cas_uint(&l->word, 0, 1) == 0)
+	break;
+      LockWait(a, id, l);
+      return 1;
+    }
+
+  /* nothing of the critical section may happen before we hold the lock */
+  membar_enter();
+  return 0;
+}
+
+/* Release l, held by thread id */
+static inline void LockRelease(Aggregate a, const int id, Lock *l)
+{
+  register McsNode *me;
+
+  if(a->opts.lock == LOCK_PTHREAD)
+    {
+      pthread_mutex_unlock(&l->mutex);
+      return;
+    }
+
+  /* the critical section is visible before the lock is */
+  membar_exit();
+  switch(a->opts.lock)
+    {
+    case LOCK_TTAS:
+      l->word = 0;
+      break;
+
+    case LOCK_TICKET:
+      /* only the holder writes owner */
+      l->ticket.owner ++;
+      break;
+
+    case LOCK_MCS:
+      me = &(a->lock_nodes[id]);
+      if(me->next == NULL && atomic_cas_ptr(&l->tail, me, NULL) == me)
+	break; /* nobody waiting */
+      LockWake(a, id, l);
+      break;
+
+    case LOCK_FUTEX:
+      if(atomic_swap_uint(&l->word, 0) == 2)
+	LockWake(a, id, l);
+      break;
+
+    default:
+      break;
+    }
+}
+
+#endif /* _LOCK_H_ */
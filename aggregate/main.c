@@ -15,6 +15,11 @@
 #include <mtmalloc.h>
 #include <assert.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 
 //#include <libcpc.h>
 
@@ -28,42 +33,212 @@ typedef struct InputInfo
   int numTups;
   int distribution;
   int power;
+  Stream stream; /* streaming only */
+  int numReaders;
+  TupFile file; /* tuple file input only */
+  int fd; /* unbounded input only */
+  ReadStats read; /* input files only */
 } InputInfo;
 
+/* the thread that writes results while an unbounded stream runs */
+typedef struct EmitInfo
+{
+  Aggregate a;
+  double interval; /* seconds between emissions, 0 for SIGUSR1 only */
+  volatile bool done;
+} EmitInfo;
+
+/* the path of input file number file */
+static void
+input_path (InputInfo *info, int file, char *buffer)
+{
+  sprintf(buffer, "/local/johnc/niagra/input/INPUT_%d-%d-%d.%d.tup", info->power, info->numGroups, info->distribution, file);
+}
+
+/* read this thread's input file, a block ahead of widening it */
 void *
 fill_table (void *v)
 {
   InputInfo *info;
+  Reader r;
   char buffer[256];
-  int i, r;
   unsigned int chunksize, start, end;
+  uint64_t got;
 
   info = (InputInfo*)v;
 
-  sprintf(buffer, "/local/johnc/niagra/input/INPUT_%d-%d-%d.%d.tup", info->power, info->numGroups, info->distribution, info->id);
-  FILE *F = fopen(buffer, "rb");
-  if(!F)
+  chunksize = info->numTups/MAX_THREADS;
+  start = info->id * chunksize;
+  end = (info->id == MAX_THREADS -1) ? info->numTups - 1 : (info->id+1)*chunksize - 1;
+
+  /* the file holds (group, value) pairs */
+  input_path(info, info->id, buffer);
+  r = ReaderOpen(buffer, 2 * sizeof(uint64_t) * (uint64_t)(end - start + 1));
+  got = ReaderPairs(r, &(info->tuples[start]), end - start + 1);
+  if (got < end - start + 1)
     {
-      fprintf(stderr, "Could not open file: %s", buffer);
+      fprintf(stderr, "Input file %s holds %llu pairs, %u expected\n", 
+	      buffer, (unsigned long long)got, end - start + 1);
       exit(-1);
     }
+  ReaderClose(r, &(info->read));
+  return NULL;
+}
+
+/* widen this thread's shards (or chunk) of a tuple file into tuples */
+void *
+fill_from_file (void *v)
+{
+  InputInfo *info;
+  TupFile f;
+  uint64_t chunksize, start, end;
+  int s;
+
+  info = (InputInfo*)v;
+  f = info->file;
+
+  if (f->header->n_shards > 0)
+    {
+      for (s = info->id; s < f->header->n_shards; s += MAX_THREADS)
+	if (f->shards[s].count > 0)
+	  TupFileRead(f, info->tuples, f->shards[s].first, 
+		      f->shards[s].first + f->shards[s].count - 1);
+      return NULL;
+    }
 
-  
   chunksize = info->numTups/MAX_THREADS;
   start = info->id * chunksize;
   end = (info->id == MAX_THREADS -1) ? info->numTups - 1 : (info->id+1)*chunksize - 1;
-  //  printf("Starting read %d\n", info->id);
-  for(i = start; i <= end; i++)
-    {
-      r = fread( &(info->tuples[i].group), sizeof(uint64_t), 1, F);
-      //assert(r);
-      r = fread( &(info->tuples[i].value1), sizeof(uint64_t), 1, F);      	
-      //assert(r);
-      info->tuples[i].value2 = info->tuples[i].value3 = info->tuples[i].value4 = info->tuples[i].value1;
-      //  printf("%lld\t%lld\n", info->tuples[i].group, info->tuples[i].value);
-    }
-  //printf("Ending read %d\n", info->id);
-  fclose(F);
+  if (info->numTups > 0)
+    TupFileRead(f, info->tuples, start, end);
+  return NULL;
+}
+
+/* read the files of this reader into the stream, a buffer at a time */
+void *
+fill_stream (void *v)
+{
+  InputInfo *info;
+  Stream s;
+  Reader r;
+  Tuple *buf;
+  char buffer[256];
+  int file;
+  unsigned int slot, chunksize, left, want, got;
+
+  info = (InputInfo*)v;
+  s = info->stream;
+
+  for(file = info->id; file < MAX_THREADS; file += info->numReaders)
+    {
+      chunksize = info->numTups/MAX_THREADS;
+      left = (file == MAX_THREADS -1) ? info->numTups - file * chunksize : chunksize;
+
+      input_path(info, file, buffer);
+      r = ReaderOpen(buffer, 2 * sizeof(uint64_t) * (uint64_t)left);
+      while(left > 0)
+	{
+	  /* blocks while the workers are behind */
+	  buf = StreamAcquire(s, &slot);
+	  want = (left < s->slot_size) ? left : s->slot_size;
+
+	  got = ReaderPairs(r, buf, want);
+	  StreamPublish(s, slot, got);
+	  left -= got;
+	  if(got < want)
+	    {
+	      fprintf(stderr, "Input file %s is %u pairs short\n", buffer, left);
+	      exit(-1);
+	    }
+	}
+      ReaderClose(r, &(info->read));
+    }
+
+  StreamClose(s);
+  return NULL;
+}
+
+/* read (group, value) pairs from a pipe or file into the stream until it */
+/* ends, which it need not: the stream only ever holds its ring */
+void *
+fill_unbounded (void *v)
+{
+  InputInfo *info;
+  Stream s;
+  Tuple *buf;
+  uint64_t *raw;
+  const size_t pair = 2 * sizeof(uint64_t);
+  size_t have = 0;
+  ssize_t got;
+  unsigned int i, n, slot;
+
+  info = (InputInfo*)v;
+  s = info->stream;
+  raw = (uint64_t*)malloc(pair * s->slot_size);
+  assert(raw);
+
+  while(1)
+    {
+      /* blocks while the workers are behind */
+      buf = StreamAcquire(s, &slot);
+
+      /* whatever has arrived; a pair may be split across reads */
+      do
+	got = read(info->fd, (char*)raw + have, pair * s->slot_size - have);
+      while(got < 0 && errno == EINTR);
+      if(got <= 0)
+	{
+	  if(got < 0)
+	    perror("unbounded input");
+	  StreamPublish(s, slot, 0);
+	  break;
+	}
+      have += got;
+
+      n = have / pair;
+      for(i = 0; i < n; i++)
+	{
+	  buf[i].group = raw[2*i];
+	  buf[i].value1 = buf[i].value2 = buf[i].value3 = buf[i].value4 = raw[2*i+1];
+	}
+      StreamPublish(s, slot, n);
+      have -= n * pair;
+      memmove(raw, (char*)raw + n * pair, have);
+    }
+
+  free(raw);
+  StreamClose(s);
+  return NULL;
+}
+
+/* emit every interval and on every SIGUSR1 until done */
+void *
+emit_results (void *v)
+{
+  EmitInfo *e;
+  sigset_t set;
+  struct timespec wait;
+  int sig;
+
+  e = (EmitInfo*)v;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  wait.tv_sec = (time_t)e->interval;
+  wait.tv_nsec = (long)((e->interval - wait.tv_sec) * 1000000000.0);
+
+  while(!e->done)
+    {
+      /* SIGUSR1 is blocked in every thread, it waits for us here */
+      if(e->interval > 0)
+	sig = sigtimedwait(&set, NULL, &wait);
+      else
+	sigwait(&set, &sig);
+      if(e->done)
+	break;
+      if(sig < 0 && errno != EAGAIN)
+	continue;
+      StreamEmit(e->a, stdout);
+    }
   return NULL;
 }
 
@@ -112,21 +287,293 @@ main (int argc, char *argv[])
   InputInfo info[MAX_THREADS];
   pthread_t threads[MAX_THREADS];
   Aggregate A;
+  AggregateOptions opts;
+  char *trace_file = NULL;
+  unsigned int stream_size = 0;
+  char *unbounded = NULL;
+  double emit_interval = 0.0;
+  EmitInfo emit;
+  pthread_t emitter;
+  sigset_t usr1;
+  unsigned int n_queries = 1, q;
+  char *input_file = NULL, *write_file = NULL, *text_file = NULL;
+  TextFile X;
+  uint64_t text_bytes = 0;
+  bool write_rows = false;
+  unsigned int chunk_size = 0;
+  bool chunk_plan = false;
+  TupFileType key_type = TUPFILE_UINT64;
+  const char *input_kind = "files";
+  TupFile F_in = NULL;
+  bool attach = false;
+  bool generate = false;
+  bool columnar = false;
+  InputColumns columns;
+  uint64_t seed = 1;
+  double theta = 0.5, heavy = 0.5;
+  Generator G;
+  hrtime_t load_start;
+  double load_time = 0.0;
+  Aggregate *Q;
+  double *q_exec, *q_merge, *q_time = NULL, batch_time = 0.0, longest;
+  Stream S;
+  TraceFormat trace_format = TRACE_CSV;
+  int c;
+  bool usage = false;
+  ReadStats reads = {0};
 
-  if (!(argc == 6))
+  memset(info, 0, sizeof(info));
+  AggregateOptionsDefault(&opts);
+
+  while ((c = getopt(argc, argv, "a:bc:CdDe:fF:gGH:I:jk:K:L:m:M:nN:PQ:s:S:t:T:u:w:W:x:z:")) != -1)
     {
-      fprintf(stderr, "Usage: %s <num tuples 2^k> <num groups> <num threads> <distribution code> <resample rate>\n", argv[0]);
+      switch (c)
+	{
+	case 'c':
+	  if (strcmp(optarg, "off") == 0)
+	    opts.cooperative = COOP_OFF;
+	  else if (strcmp(optarg, "consistent") == 0)
+	    opts.cooperative = COOP_CONSISTENT;
+	  else if (strcmp(optarg, "heterogeneous") == 0)
+	    opts.cooperative = COOP_HETEROGENEOUS;
+	  else
+	    usage = true;
+	  break;
+	case 'a':
+	  if (strcmp(optarg, "none") == 0)
+	    opts.affinity = AFFINITY_NONE;
+	  else if (strcmp(optarg, "compact") == 0)
+	    opts.affinity = AFFINITY_COMPACT;
+	  else if (strcmp(optarg, "scatter") == 0)
+	    opts.affinity = AFFINITY_SCATTER;
+	  else if (strcmp(optarg, "cores") == 0)
+	    opts.affinity = AFFINITY_CORES;
+	  else
+	    usage = true;
+	  break;
+	case 'b':
+	  opts.bandit = true;
+	  break;
+	case 'C':
+	  columnar = true;
+	  break;
+	case 'd':
+	  opts.drift = true;
+	  break;
+	case 'D':
+	  opts.auto_dop = true;
+	  break;
+	case 'e':
+	  emit_interval = atof(optarg);
+	  if (emit_interval <= 0.0)
+	    usage = true;
+	  break;
+	case 'f':
+	  opts.feedback = true;
+	  break;
+	case 'F':
+	  input_file = optarg;
+	  attach = false;
+	  break;
+	case 'g':
+	  generate = true;
+	  break;
+	case 'G':
+	  opts.node_tables = true;
+	  break;
+	case 'H':
+	  heavy = atof(optarg);
+	  if (heavy < 0.0 || heavy > 1.0)
+	    usage = true;
+	  break;
+	case 'I':
+	  opts.interleave = atoi(optarg);
+	  break;
+	case 'j':
+	  chunk_plan = true;
+	  break;
+	case 'k':
+	  chunk_size = atoi(optarg);
+	  if (chunk_size < 1)
+	    usage = true;
+	  break;
+	case 'K':
+	  if (strcmp(optarg, "plain") == 0)
+	    key_type = TUPFILE_UINT64;
+	  else if (strcmp(optarg, "packed") == 0)
+	    key_type = TUPFILE_PACKED;
+	  else if (strcmp(optarg, "dict") == 0)
+	    key_type = TUPFILE_DICT;
+	  else if (strcmp(optarg, "rle") == 0)
+	    key_type = TUPFILE_RLE;
+	  else
+	    usage = true;
+	  break;
+	case 'L':
+	  if (strcmp(optarg, "pthread") == 0)
+	    opts.lock = LOCK_PTHREAD;
+	  else if (strcmp(optarg, "ttas") == 0)
+	    opts.lock = LOCK_TTAS;
+	  else if (strcmp(optarg, "ticket") == 0)
+	    opts.lock = LOCK_TICKET;
+	  else if (strcmp(optarg, "mcs") == 0)
+	    opts.lock = LOCK_MCS;
+	  else if (strcmp(optarg, "futex") == 0)
+	    opts.lock = LOCK_FUTEX;
+	  else
+	    usage = true;
+	  break;
+	case 'm':
+	  opts.morsel = atoi(optarg);
+	  break;
+	case 'M':
+	  /* a tuple file in memory, otherwise just like -F */
+	  input_file = optarg;
+	  attach = true;
+	  break;
+	case 'n':
+	  opts.numa = true;
+	  break;
+	case 'N':
+	  opts.nodes = atoi(optarg);
+	  break;
+	case 'P':
+	  opts.pipelined = true;
+	  break;
+	case 'Q':
+	  n_queries = atoi(optarg);
+	  if (n_queries == 0)
+	    usage = true;
+	  break;
+	case 's':
+	  seed = strtoull(optarg, NULL, 0);
+	  break;
+	case 'S':
+	  stream_size = atoi(optarg);
+	  if (stream_size == 0)
+	    usage = true;
+	  break;
+	case 't':
+	  opts.trace = true;
+	  trace_file = optarg;
+	  break;
+	case 'T':
+	  if (strcmp(optarg, "csv") == 0)
+	    trace_format = TRACE_CSV;
+	  else if (strcmp(optarg, "json") == 0)
+	    trace_format = TRACE_JSON;
+	  else
+	    usage = true;
+	  break;
+	case 'u':
+	  unbounded = optarg;
+	  break;
+	case 'w':
+	  write_file = optarg;
+	  write_rows = false;
+	  break;
+	case 'W':
+	  write_file = optarg;
+	  write_rows = true;
+	  break;
+	case 'x':
+	  text_file = optarg;
+	  break;
+	case 'z':
+	  theta = atof(optarg);
+	  if (theta < 0.0)
+	    usage = true;
+	  break;
+	default:
+	  usage = true;
+	}
+    }
+
+  /* an unbounded stream is read from its one source through the global */
+  /* table (of node 0) and emits from it; the default buffers hold 64K tuples */
+  if (unbounded && !stream_size)
+    stream_size = 1 << 16;
+  if (unbounded && (input_file || text_file || write_file || generate || opts.node_tables || opts.auto_dop))
+    usage = true;
+  if (emit_interval > 0.0 && !unbounded)
+    usage = true;
+  /* a stream never holds the whole input, and threads may get no buffer */
+  if (stream_size && (opts.numa || opts.cooperative != COOP_OFF))
+    usage = true;
+  /* with auto DOP some threads never sample */
+  if (opts.auto_dop && opts.cooperative != COOP_OFF)
+    usage = true;
+  /* the stream reads the input files itself */
+  if (stream_size && (input_file || write_file || generate))
+    usage = true;
+  if (generate && input_file)
+    usage = true;
+  /* one source of input at a time */
+  if (text_file && (generate || input_file || stream_size))
+    usage = true;
+  /* records have plain keys */
+  if (key_type != TUPFILE_UINT64 && (!write_file || write_rows))
+    usage = true;
+  /* chunks are written by -w and read by -F; their statistics replace */
+  /* the samples that -b and -c work from */
+  if ((chunk_size && !write_file) 
+      || (chunk_plan && (!input_file || opts.bandit || opts.cooperative != COOP_OFF)))
+    usage = true;
+  /* columns come straight from the generator or the mapped file */
+  if (columnar && (!(generate || input_file || text_file) || write_file))
+    usage = true;
+  /* concurrent queries step their workers independently */
+  if (n_queries > 1 && (stream_size || opts.auto_dop || opts.cooperative != COOP_OFF))
+    usage = true;
+
+  if (usage || !(argc - optind == 5))
+    {
+      fprintf(stderr, "Usage: %s [options] <num tuples 2^k> <num groups> <num threads> <distribution code> <resample rate>\n", argv[0]);
+      fprintf(stderr, "\tOptions:\n");
+      fprintf(stderr, "\t\t-a <none|compact|scatter|cores>  bind the worker threads to processors\n");
+      fprintf(stderr, "\t\t-b  choose strategies by measured throughput (adaptive)\n");
+      fprintf(stderr, "\t\t-c <off|consistent|heterogeneous>  pool samples across threads (adaptive)\n");
+      fprintf(stderr, "\t\t-C  aggregate the input as columns (with -g, -F or -x, not with -w or -W)\n");
+      fprintf(stderr, "\t\t-d  only resample when the distribution drifts (resample)\n");
+      fprintf(stderr, "\t\t-D  choose how many of <num threads> to use while running (not with -c)\n");
+      fprintf(stderr, "\t\t-e <seconds>  emit the results of -u this often (they are always emitted on SIGUSR1)\n");
+      fprintf(stderr, "\t\t-f  leave the global table when it is measured to be contended (adaptive, resample)\n");
+      fprintf(stderr, "\t\t-F <file>  read the input from a tuple file; its tuple count overrides <num tuples>\n");
+      fprintf(stderr, "\t\t-g  generate the input instead of reading the input files (not with -S or -F)\n");
+      fprintf(stderr, "\t\t-G  one global table per NUMA node, merged at the end\n");
+      fprintf(stderr, "\t\t-H <fraction>  share of the heavy hitter in generated inputs (default 0.5)\n");
+      fprintf(stderr, "\t\t-I <lookups>  keep this many global table lookups in flight per thread (at most 16)\n");
+      fprintf(stderr, "\t\t-j  plan from the chunk statistics of the -F file instead of sampling (adaptive, resample; not with -b or -c)\n");
+      fprintf(stderr, "\t\t-k <tuples>  write chunks of at most this many tuples with -w or -W (default 32 chunks)\n");
+      fprintf(stderr, "\t\t-K <plain|packed|dict|rle>  encoding of the keys written with -w (default plain)\n");
+      fprintf(stderr, "\t\t-L <pthread|ttas|ticket|mcs|futex>  lock of the global table cells (default pthread)\n");
+      fprintf(stderr, "\t\t-m <tuples>  hand out the input in morsels of this size, with work stealing\n");
+      fprintf(stderr, "\t\t-M <segment>  -F for a tuple file in the POSIX shared memory segment /<name>, or received as unix:<socket>\n");
+      fprintf(stderr, "\t\t-n  copy the input next to the threads that read it\n");
+      fprintf(stderr, "\t\t-N <nodes>  split the threads into this many virtual NUMA nodes\n");
+      fprintf(stderr, "\t\t-P  merge each thread's tables as soon as it finishes aggregating\n");
+      fprintf(stderr, "\t\t-Q <queries>  run this many aggregates of the input at the same time on one pool (not with -S, -D or -c)\n");
+      fprintf(stderr, "\t\t-s <seed>  seed of generated inputs (default 1)\n");
+      fprintf(stderr, "\t\t-S <tuples>  aggregate while reading, through buffers of this size (one run, not with -n or -c)\n");
+      fprintf(stderr, "\t\t-t <file>  write the sampling decisions of the last run to file\n");
+      fprintf(stderr, "\t\t-T <csv|json>  format of the decision trace (default csv)\n");
+      fprintf(stderr, "\t\t-u <file>  aggregate (group, value) pairs from a pipe or file (- for stdin) until it ends,\n\t\t\temitting results while running (<num tuples> is ignored; not with -F, -x, -g, -w, -W, -G, -D, -n, -c or -Q)\n");
+      fprintf(stderr, "\t\t-w <file>  write the input to a tuple file of group and value columns (not with -S)\n");
+      fprintf(stderr, "\t\t-W <file>  write the input to a tuple file of records that -F can use in place (not with -S)\n");
+      fprintf(stderr, "\t\t-x <file>  read the input from a text file of <group> <value> lines; its line count overrides <num tuples>\n");
+      fprintf(stderr, "\t\t-z <theta>  skew of generated zipf inputs (default 0.5)\n");
       fprintf(stderr, "\tAvailable distributions:\n");
       fprintf(stderr, "\t\t0. Uniform\n");
       fprintf(stderr, "\t\t1. Sorted\n");
-      fprintf(stderr, "\t\t2. 50%% Heavy Hitter\n");
+      fprintf(stderr, "\t\t2. 50%% Heavy Hitter (-H with -g)\n");
       fprintf(stderr, "\t\t3. Repeated Sorted Runs\n");
-      fprintf(stderr, "\t\t4. Zipf (theta = 0.5)\n");
+      fprintf(stderr, "\t\t4. Zipf (theta = 0.5, -z with -g)\n");
       fprintf(stderr, "\t\t5. Self-similar (h = 0.2)\n");
       exit (-1);
     }
 
   // shift -- we express input as a power of 2
+  argv += optind - 1;
   power = atoi(argv[1]);
   nTups = (power == 1) ? 12663401 /*real input*/ : 1 << power;
   nGroups = atoi (argv[2]);
@@ -138,42 +585,243 @@ main (int argc, char *argv[])
   assert (nGroups > 0);
   assert (nThreads >= 1);
   assert (distribution >= 0);
+  if (generate && distribution >= N_DISTRIBUTIONS)
+    {
+      fprintf(stderr, "Can't generate distribution %d\n", distribution);
+      exit(-1);
+    }
   assert (resample_rate >= 1);
 
-  //  printf("Building Input\n");
-  tuples = (Tuple*)malloc(sizeof(Tuple)*nTups);
+  if (unbounded)
+    {
+      /* one reader, results emitted from the global table while it runs. */
+      /* SIGUSR1 is blocked before any thread starts, so only the emitter */
+      /* takes it. */
+      sigemptyset(&usr1);
+      sigaddset(&usr1, SIGUSR1);
+      pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+
+      info[0].fd = strcmp(unbounded, "-") ? open(unbounded, O_RDONLY) : 0;
+      if (info[0].fd < 0)
+	{
+	  fprintf(stderr, "Could not open file: %s\n", unbounded);
+	  exit(-1);
+	}
+      S = StreamCreate(3 * nThreads, stream_size, 1);
+      A = AggregateCreate(nThreads, S->tuples, nTups, nGroups, resample_rate, &opts);
+      if (!A->global_buckets)
+	{
+	  fprintf(stderr, "-u needs a strategy with a global table to emit from\n");
+	  exit(-1);
+	}
+      AggregateStream(A, S);
 
-  for (i = 0; i < MAX_THREADS; i++)
+      emit.a = A;
+      emit.interval = emit_interval;
+      emit.done = false;
+      pthread_create (&emitter, NULL, emit_results, &emit);
+      info[0].stream = S;
+      pthread_create (&threads[0], NULL, fill_unbounded, &info[0]);
+
+      exec_time = AggregateRun(A);
+      pthread_join (threads[0], NULL);
+      emit.done = true;
+      pthread_kill (emitter, SIGUSR1);
+      pthread_join (emitter, NULL);
+      if (info[0].fd != 0)
+	close (info[0].fd);
+      merge_time = AggregateMerge(A);
+
+      /* the final result is the last emission */
+      AggregateEmit(A, stdout, S->n_emits++, S->n_read);
+      nTups = S->n_read;
+    }
+  else if (stream_size)
     {
-      info[i].tuples = tuples;
-      info[i].id = i;
-      info[i].numGroups = nGroups;
-      info[i].numTups = nTups;
-      info[i].distribution = distribution;
-      info[i].power = power;
-      pthread_create (&threads[i], NULL, fill_table, &info[i]);
+      /* a single pass: the workers aggregate buffers while the readers */
+      /* fill the others, so exec_time includes reading the input */
+      S = StreamCreate(3 * nThreads, stream_size, nThreads);
+      A = AggregateCreate(nThreads, S->tuples, nTups, nGroups, resample_rate, &opts);
+      AggregateStream(A, S);
+
+      for (i = 0; i < nThreads; i++)
+	{
+	  info[i].id = i;
+	  info[i].numGroups = nGroups;
+	  info[i].numTups = nTups;
+	  info[i].distribution = distribution;
+	  info[i].power = power;
+	  info[i].stream = S;
+	  info[i].numReaders = nThreads;
+	  pthread_create (&threads[i], NULL, fill_stream, &info[i]);
+	}
+      exec_time = AggregateRun(A);
+      for (i = 0; i < nThreads; i++)
+	pthread_join (threads[i], NULL);
+      merge_time = AggregateMerge(A);
     }
-  for (i = 0; i < MAX_THREADS; i++)
-    pthread_join (threads[i], NULL);
+  else
+    {
+      //  printf("Building Input\n");
+      load_start = gethrtime();
+      tuples = NULL;
+      if (input_file)
+	{
+	  F_in = attach ? TupFileAttach(input_file) : TupFileOpen(input_file);
+	  if (F_in->header->n_tuples == 0 || F_in->header->n_tuples > 0x7fffffff)
+	    {
+	      fprintf(stderr, "Tuple file %s: can't aggregate %llu tuples\n", 
+		      input_file, (unsigned long long)F_in->header->n_tuples);
+	      exit(-1);
+	    }
+	  nTups = F_in->header->n_tuples;
+	  if (chunk_plan && !F_in->stats)
+	    {
+	      fprintf(stderr, "Tuple file %s has no chunk statistics\n", input_file);
+	      exit(-1);
+	    }
+	  if (columnar)
+	    {
+	      /* any layout is read where it is mapped */
+	      if (!TupFileColumns(F_in, &columns))
+		{
+		  fprintf(stderr, "Tuple file %s: columns are not 8 byte aligned\n", input_file);
+		  exit(-1);
+		}
+	      input_kind = attach ? "shared" : "mapped";
+	    }
+	  else
+	    {
+	      /* records are used where they are mapped, anything else is widened */
+	      tuples = TupFileInPlace(F_in);
+	      input_kind = !tuples ? "widened" : attach ? "shared" : "mapped";
+	    }
+	}
+      else if (text_file)
+	{
+	  X = TextOpen(text_file);
+	  if (columnar)
+	    TextColumns(X, MAX_THREADS, &columns);
+	  else
+	    tuples = TextInput(X, MAX_THREADS);
+	  if (X->n_tuples == 0 || X->n_tuples > 0x7fffffff)
+	    {
+	      fprintf(stderr, "Text file %s: can't aggregate %llu tuples\n", 
+		      text_file, (unsigned long long)X->n_tuples);
+	      exit(-1);
+	    }
+	  nTups = X->n_tuples;
+	  text_bytes = X->size;
+	  TextClose(X);
+	  input_kind = "text";
+	}
+      else if (generate)
+	{
+	  G = GeneratorCreate(distribution, nTups, nGroups, seed, theta, heavy);
+	  if (columnar)
+	    GeneratorColumns(G, MAX_THREADS, &columns);
+	  else
+	    tuples = GeneratorInput(G, MAX_THREADS);
+	  GeneratorDelete(G);
+	  input_kind = "generated";
+	}
+
+      if (!tuples && !columnar)
+	{
+	  tuples = (Tuple*)malloc(sizeof(Tuple)*nTups);
+	  assert(tuples);
 
-  //throw away run 1
-  A = AggregateCreate(nThreads, tuples, nTups, nGroups, resample_rate);
-  exec_time = AggregateRun(A);
-  merge_time = AggregateMerge(A);
-  //AggregateReset(A);
+	  for (i = 0; i < MAX_THREADS; i++)
+	    {
+	      info[i].tuples = tuples;
+	      info[i].id = i;
+	      info[i].numGroups = nGroups;
+	      info[i].numTups = nTups;
+	      info[i].distribution = distribution;
+	      info[i].power = power;
+	      info[i].file = F_in;
+	      pthread_create (&threads[i], NULL, F_in ? fill_from_file : fill_table, &info[i]);
+	    }
+	  for (i = 0; i < MAX_THREADS; i++)
+	    pthread_join (threads[i], NULL);
+	}
+      load_time = (gethrtime() - load_start)/1000000000.0;
+
+      /* one shard per input file it came from, or chunks of -k tuples */
+      if (write_file)
+	TupFileWrite(write_file, tuples, nTups, write_rows, 
+		     chunk_size ? (nTups + chunk_size - 1) / chunk_size : MAX_THREADS, key_type);
+
+      //throw away run 1
+      A = AggregateCreate(nThreads, tuples, nTups, nGroups, resample_rate, &opts);
+      if (columnar)
+	AggregateColumns(A, &columns);
+      if (chunk_plan)
+	AggregateChunks(A, F_in->shards, F_in->stats, F_in->header->n_shards);
+      if (n_queries == 1)
+	{
+	  exec_time = AggregateRun(A);
+	  merge_time = AggregateMerge(A);
+	  //AggregateReset(A);
   
-  exec_time = merge_time = 0.0;
-  for(i = 0; i < NUM_RUNS; i++)
-    {
-      //      A = AggregateCreate(nThreads, tuples, nTups, nGroups, resample_rate);
-      AggregateReset(A);
-      exec_time += AggregateRun(A);
-      merge_time += AggregateMerge(A);
+	  exec_time = merge_time = 0.0;
+	  for(i = 0; i < NUM_RUNS; i++)
+	    {
+	      //      A = AggregateCreate(nThreads, tuples, nTups, nGroups, resample_rate, &opts);
+	      AggregateReset(A);
+	      exec_time += AggregateRun(A);
+	      merge_time += AggregateMerge(A);
 
-    }
+	    }
+
+	  exec_time = exec_time / NUM_RUNS;
+	  merge_time = merge_time / NUM_RUNS;
+	}
+      else
+	{
+	  /* the same aggregate n_queries times, sharing the workers of A; */
+	  /* the times reported are the means over the queries */
+	  Q = (Aggregate*)malloc(sizeof(Aggregate) * n_queries);
+	  q_exec = (double*)malloc(sizeof(double) * n_queries);
+	  q_merge = (double*)malloc(sizeof(double) * n_queries);
+	  q_time = (double*)calloc(n_queries, sizeof(double));
+	  assert(Q && q_exec && q_merge && q_time);
+
+	  Q[0] = A;
+	  opts.pool = A->pool;
+	  for (q = 1; q < n_queries; q++)
+	    {
+	      Q[q] = AggregateCreate(nThreads, tuples, nTups, nGroups, resample_rate, &opts);
+	      if (columnar)
+		AggregateColumns(Q[q], &columns);
+	      if (chunk_plan)
+		AggregateChunks(Q[q], F_in->shards, F_in->stats, F_in->header->n_shards);
+	    }
+	  AggregateRunConcurrent(Q, n_queries, q_exec, q_merge);
 
-  exec_time = exec_time / NUM_RUNS;
-  merge_time = merge_time / NUM_RUNS;
+	  exec_time = merge_time = 0.0;
+	  for(i = 0; i < NUM_RUNS; i++)
+	    {
+	      for (q = 0; q < n_queries; q++)
+		AggregateReset(Q[q]);
+	      AggregateRunConcurrent(Q, n_queries, q_exec, q_merge);
+
+	      longest = 0.0;
+	      for (q = 0; q < n_queries; q++)
+		{
+		  exec_time += q_exec[q];
+		  merge_time += q_merge[q];
+		  q_time[q] += q_exec[q] + q_merge[q];
+		  if (q_exec[q] + q_merge[q] > longest)
+		    longest = q_exec[q] + q_merge[q];
+		}
+	      batch_time += longest;
+	    }
+
+	  exec_time = exec_time / (NUM_RUNS * n_queries);
+	  merge_time = merge_time / (NUM_RUNS * n_queries);
+	}
+    }
 
   printf("%d\t%d\t%d\t%f\t%f\t%f\t%f\t%f\t%f\t%d\n", 
 	 nTups, 
@@ -187,6 +835,58 @@ main (int argc, char *argv[])
 	 merge_time,
 	 resample_rate
 	 );
+  /* what a query waits for, whichever phase the merge work landed in */
+  printf("# total_time\t%f\n", exec_time + merge_time);
+  printf("# input\t%s\n", unbounded ? "unbounded" : stream_size ? "stream" : input_kind);
+  if (!stream_size)
+    printf("# load_time\t%f\n", load_time);
+  for (i = 0; i < MAX_THREADS; i++)
+    {
+      reads.bytes += info[i].read.bytes;
+      reads.busy += info[i].read.busy;
+      reads.wait += info[i].read.wait;
+      reads.files += info[i].read.files;
+      reads.direct += info[i].read.direct;
+    }
+  if (text_file)
+    {
+      printf("# parse_bandwidth\t%f\n", text_bytes / 1048576.0 / load_time);
+      printf("# parse_rate\t%f\n", nTups / load_time);
+    }
+  if (reads.files > 0)
+    {
+      /* over the whole load, or the run that read the stream */
+      printf("# read_bytes\t%llu\n", (unsigned long long)reads.bytes);
+      printf("# read_bandwidth\t%f\n", reads.bytes / 1048576.0 / (stream_size ? exec_time : load_time));
+      printf("# read_busy\t%f\n", reads.busy / reads.files);
+      printf("# read_wait\t%f\n", reads.wait / reads.files);
+      printf("# read_direct\t%u\n", reads.direct);
+    }
+  printf("# layout\t%s\n", columnar ? "columns" : "rows");
+  if (generate)
+    printf("# seed\t%llu\n", (unsigned long long)seed);
+  AggregateReport(A, stdout);
+  if (n_queries > 1)
+    {
+      printf("# queries\t%d\n", n_queries);
+      printf("# query_time");
+      for (q = 0; q < n_queries; q++)
+	printf("\t%f", q_time[q] / NUM_RUNS);
+      printf("\n");
+      printf("# batch_time\t%f\n", batch_time / NUM_RUNS);
+    }
+
+  if (trace_file)
+    {
+      FILE *F = fopen(trace_file, "w");
+      if(!F)
+	{
+	  fprintf(stderr, "Could not open file: %s", trace_file);
+	  exit(-1);
+	}
+      AggregateTraceWrite(A, F, trace_format);
+      fclose(F);
+    }
 
   //AggregatePrint(A);
 }
@@ -0,0 +1,178 @@
+/*
+ * File: morsel.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Morsel scheduling with work stealing. The input is cut into morsels of
+ * a->morsel_size tuples and every thread starts with a queue holding the
+ * morsels of its own chunk, in input order, so a thread that is not
+ * disturbed reads its chunk sequentially just like the static split.
+ * A thread that runs dry steals one morsel at a time from the back of
+ * the other queues, so it takes the tuples its victim would reach last.
+ *
+ * The first morsel of every queue is reserved for its owner; strategies
+ * that sample use it, and every thread is guaranteed to run at least one,
+ * unless there are fewer tuples than threads: then the threads without a
+ * tuple of their own get no morsel and finish at once.
+ *
+ * Without a morsel size (the default) there is one morsel per thread and
+ * nothing to steal, which is the static split of the paper. With a stream
+ * attached the morsels are its buffers, see stream.c
+ *
+ * With auto DOP (see dop.c) workers may sit out, so nothing is reserved
+ * and the input is cut into DOP_SPLIT morsels per thread unless a size
+ * is given.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <atomic.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#define HEAD(r) ((unsigned int)((r) >> 32))
+#define TAIL(r) ((unsigned int)((r) & 0xffffffff))
+#define RANGE(h, t) ( ((uint64_t)(h) << 32) | (uint64_t)(t) )
+
+/*
+ * Cut the input into morsels and deal them out. Called before every run.
+ * A morsel size given with -m or chosen for auto DOP is raised to
+ * min_size, which is what the engine needs to sample a morsel.
+ */
+void MorselReset(Aggregate a, const unsigned int min_size)
+{
+  register int i;
+  unsigned int size, first, last;
+
+  if(a->stream)
+    {
+      /* buffers are counted as they are taken */
+      a->morsel_size = a->stream->slot_size;
+      a->n_morsels = 0;
+      for(i = 0; i < a->n_threads; i++)
+	a->steals[i] = 0;
+      DopReset(a);
+      return;
+    }
+
+  size = a->n_tups / a->n_threads;
+  if(a->opts.morsel)
+    {
+      /* at least one sample per morsel, at least one morsel per thread */
+      size = (a->opts.morsel < min_size) ? min_size : a->opts.morsel;
+      if(size > a->n_tups / a->n_threads)
+	size = a->n_tups / a->n_threads;
+    }
+  else if(a->opts.auto_dop)
+    {
+      /* enough morsels to try several thread counts on */
+      size = a->n_tups / (DOP_SPLIT * a->n_threads);
+      if(size < min_size)
+	size = min_size;
+      if(size > a->n_tups / a->n_threads)
+	size = a->n_tups / a->n_threads;
+    }
+  if(size < 1)
+    size = 1;
+
+  a->morsel_size = size;
+  a->n_morsels = a->n_tups / size;
+
+  for(i = 0; i < a->n_threads; i++)
+    {
+      first = (unsigned long long)i * a->n_morsels / a->n_threads;
+      last = (unsigned long long)(i+1) * a->n_morsels / a->n_threads;
+      a->queues[i].first = first;
+      /* nothing to reserve with auto DOP, or if the queue is empty */
+      a->queues[i].first_taken = a->opts.auto_dop || first == last;
+      a->queues[i].range = RANGE(a->queues[i].first_taken ? first : first + 1, last);
+      a->steals[i] = 0;
+    }
+  DopReset(a);
+  membar_producer();
+}
+
+/* take a morsel from the front of queue q */
+static inline bool PopFront(MorselQueue *q, unsigned int *morsel)
+{
+  register uint64_t old;
+  do
+    {
+      old = q->range;
+      if(HEAD(old) >= TAIL(old))
+	return false;
+    }
+  while(atomic_cas_64(&q->range, old, RANGE(HEAD(old) + 1, TAIL(old))) != old);
+
+  *morsel = HEAD(old);
+  return true;
+}
+
+/* take a morsel from the back of queue q */
+static inline bool PopBack(MorselQueue *q, unsigned int *morsel)
+{
+  register uint64_t old;
+  do
+    {
+      old = q->range;
+      if(HEAD(old) >= TAIL(old))
+	return false;
+    }
+  while(atomic_cas_64(&q->range, old, RANGE(HEAD(old), TAIL(old) - 1)) != old);
+
+  *morsel = TAIL(old) - 1;
+  return true;
+}
+
+/*
+ * The next morsel for thread id: its reserved first morsel, then its own
+ * queue, then whatever it can steal. Returns false when the input is
+ * exhausted. [start, end] is the tuple range of the morsel.
+ */
+bool MorselNext(Aggregate a, const int id,
+		unsigned int *morsel, unsigned int *start, unsigned int *end)
+{
+  register int i, victim;
+  MorselQueue *q = &(a->queues[id]);
+  bool found = false;
+
+  /* with auto DOP, this is where surplus workers wait */
+  if(a->opts.auto_dop && !DopWait(a, id))
+    return false;
+
+  if(a->stream)
+    found = StreamNext(a, id, morsel, start, end);
+  else if(!q->first_taken)
+    {
+      q->first_taken = true;
+      *morsel = q->first;
+      found = true;
+    }
+  else if(PopFront(q, morsel))
+    {
+      found = true;
+    }
+  else
+    {
+      /* start with the neighbor, who is likely on a nearby core */
+      for(i = 1; i < a->n_threads && !found; i++)
+	{
+	  victim = (id + i) % a->n_threads;
+	  if(PopBack(&(a->queues[victim]), morsel))
+	    {
+	      a->steals[id] ++;
+	      found = true;
+	    }
+	}
+    }
+
+  if(found && !a->stream)
+    {
+      *start = *morsel * a->morsel_size;
+      *end = (*morsel == a->n_morsels - 1) ? a->n_tups - 1 : (*morsel + 1) * a->morsel_size - 1;
+    }
+  if(a->opts.auto_dop)
+    DopStarted(a, id, found, found ? *end - *start + 1 : 0);
+  return found;
+}
@@ -9,6 +9,7 @@
 
 #include "aggregate.h"
 #include "global.h"
+#include "global_table.h"
 #include "timer.h"
 
 #include <atomic.h>
@@ -27,23 +28,34 @@ void * run_init(void *v)
   ThreadInfo *info = (ThreadInfo*)v;
   Aggregate a = info->a;
 
-  const unsigned int chunkSize = a->n_buckets/a->n_threads;
-  const unsigned int start = info->id * chunkSize;
-  const unsigned int end = (info->id == a->n_threads-1) ? a->n_buckets-1: chunkSize*(info->id+1)-1;
-
-  HashCell *end_bucket = &(a->global_buckets[end]);
-  HashCell *current_bucket = &(a->global_buckets[start]);
-  char *current_valid = &(a->valid[start]);
+  /* the threads of a node share the initialization of its table */
+  const unsigned int table = a->table_of[info->id];
+  unsigned int rank = 0, members = 0;
+  for(i = 0; i < a->n_threads; i++)
+    if(a->table_of[i] == table)
+      {
+	if(i < info->id)
+	  rank ++;
+	members ++;
+      }
+
+  const unsigned int chunkSize = a->n_buckets/members;
+  const unsigned int start = rank * chunkSize;
+  const unsigned int end = (rank == members-1) ? a->n_buckets-1: chunkSize*(rank+1)-1;
+
+  HashCell *end_bucket = &(a->node_buckets[table][end]);
+  HashCell *current_bucket = &(a->node_buckets[table][start]);
+  char *current_valid = &(a->node_valid[table][start]);
 
   for(; current_bucket <= end_bucket; current_bucket++, current_valid++)
     {
-      MUTEX_INIT(current_bucket->lock);
+      LockInit(a, &(current_bucket->lock));
       (*current_valid) = 0;
     }
 
   /*   for(i = start ; i <= end ; i++) */
   /*     { */
-  /*       MUTEX_INIT(a->global_buckets[i].lock); */
+  /*       LockInit(a, &(a->global_buckets[i].lock)); */
   /*       a->valid[i] = 0; */
   /*     } */
   
@@ -53,7 +65,8 @@ void * run_init(void *v)
 Aggregate InitializeAggregate(int n_threads, 
 			      Tuple *tups, 
 			      int n_tups, 
-			      int n_groups)
+			      int n_groups,
+			      const AggregateOptions *opts)
 {
   register int i;
   char * ptr;
@@ -62,24 +75,43 @@ Aggregate InitializeAggregate(int n_threads,
 
   assert(n_threads > 0);
 
-  a = (Aggregate)malloc(sizeof(AggregateCDT));
+  a = (Aggregate)calloc(1, sizeof(AggregateCDT));
+  if(opts)
+    a->opts = *opts;
+  else
+    AggregateOptionsDefault(&(a->opts));
   a->n_threads = n_threads;
   a->n_tups = n_tups;
   a->input = tups;
+  if(tups)
+    a->columns = RowColumns(tups);
 
   // We assume that the number of groups is a power of 2
   a->n_buckets = (n_groups < 32) ? 32 : n_groups * 2;
   //a->n_buckets = 1 << 17;
 
-  ptr = (char*)malloc(sizeof(HashCell) * a->n_buckets + 64); //align to 64 byte cache line
-  a->global_buckets = (HashCell*)( (unsigned long)(ptr + 64) & (~63) );
-  assert(a->global_buckets);
+  /* start the workers that every phase runs on; this also decides */
+  /* how many global tables there are */
+  PoolCreate(a);
+
+  for(i = 0; i < a->n_tables; i++)
+    {
+      ptr = (char*)malloc(sizeof(HashCell) * a->n_buckets + 64); //align to 64 byte cache line
+      a->node_buckets[i] = (HashCell*)( (unsigned long)(ptr + 64) & (~63) );
+      assert(a->node_buckets[i]);
 
-  a->valid = (char*)malloc(sizeof(char) * a->n_buckets);
-  assert(a->valid);
+      a->node_valid[i] = (char*)malloc(sizeof(char) * a->n_buckets);
+      assert(a->node_valid[i]);
+    }
+  a->global_buckets = a->node_buckets[0];
+  a->valid = a->node_valid[0];
 
   a->lg_buckets = log2(a->n_buckets);
 
+  /* move the input next to the threads that read it */
+  if(a->opts.numa)
+    NumaPlaceInput(a);
+
   // WARM UP
 /*    int temp = 0;  */
 /*    for(i = 0; i < a->n_buckets; i ++)  */
@@ -95,46 +127,31 @@ Aggregate InitializeAggregate(int n_threads,
   /* Initialize the table */
   /* TODO: If we are going to include initialization time in the */
   /*       running time, then this should be done in parallel */
-  if(a->n_buckets < 10000)
+  if(a->n_buckets < 10000 && a->n_tables == 1 && !a->opts.numa)
     {
       /* Serial Initialization */
       for(i = 0; i < a->n_buckets; i++)
 	{
-	  MUTEX_INIT(a->global_buckets[i].lock);
+	  LockInit(a, &(a->global_buckets[i].lock));
 	  a->valid[i] = 0;
 	} 
     }
   else
-    {
-      ThreadInfo *info = (ThreadInfo*)malloc(sizeof(ThreadInfo)*a->n_threads);
-      pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t)*a->n_threads);
-      assert(info && threads);
-      for(i = 0; i < a->n_threads; i++)
-	{
-	  info[i].id = i;
-	  info[i].a = a;
-	  pthread_create(&threads[i], NULL, run_init, &info[i]);
-	}
-
-      for(i = 0; i < a->n_threads; i++)
-	pthread_join(threads[i], NULL);
-
-      free(info);
-      free(threads);
-    }
+    PoolRun(a, run_init);
 
   return a;
 }
 
-void DeleteGlobalTable(Aggregate a)
+/* free the chains hanging off table t */
+static void FreeChains(Aggregate a, const int t)
 {
   for(int i = 0; i < a->n_buckets; i++)
     {
-      if(a->valid[i])
+      if(a->node_valid[t][i])
 	{
 	  HashCell *prev, *current;
 	  prev = NULL;
-	  current = a->global_buckets[i].next;
+	  current = a->node_buckets[t][i].next;
 	  while(current != NULL)
 	    {
 	      if(prev != NULL)
@@ -146,81 +163,85 @@ void DeleteGlobalTable(Aggregate a)
 	    free(prev);
 	}
     }
-  free(a->global_buckets);  
+}
+
+void DeleteGlobalTable(Aggregate a)
+{
+  for(int t = 0; t < a->n_tables; t++)
+    {
+      FreeChains(a, t);
+      free(a->node_buckets[t]);  
+      a->node_buckets[t] = NULL;
+      free(a->node_valid[t]);
+      a->node_valid[t] = NULL;
+    }
   a->global_buckets = NULL;
-  free(a->valid);
   a->valid = NULL;
 }
 
 void ResetGlobalTable(Aggregate a)
 {
-  for(int i = 0; i < a->n_buckets; i++)
+  for(int t = 0; t < a->n_tables; t++)
     {
-      if(a->valid[i])
+      FreeChains(a, t);
+      for(int i = 0; i < a->n_buckets; i++)
 	{
-	  HashCell *prev, *current;
-	  prev = NULL;
-	  current = a->global_buckets[i].next;
-	  while(current != NULL)
-	    {
-	      if(prev != NULL)
-		free(prev);
-	      prev = current;
-	      current = current->next;
-	    }
-	  if(prev != NULL)
-	    free(prev);
+	  a->node_valid[t][i] = 0;
+	  a->node_buckets[t][i].next = NULL;
 	}
-      a->valid[i] = 0;
-      a->global_buckets[i].next = NULL;
     }
+  bzero(a->contention, sizeof(a->contention));
+  bzero(a->feedback_switches, sizeof(a->feedback_switches));
 }
 
-/* Insert into the global table */
-void AggregateMutex(Aggregate a, const int id, 
-			    const int start, const int end)
+/* Insert [start, end] into the global table, plain as in ColumnGet */
+static inline void MutexRange(Aggregate a, const int id,
+			      const int start, const int end, const bool plain)
 {
   register unsigned int i, index;
   HashCell *current, *prev, *first;
   
   /* place oft used info in local variables */
   const unsigned int lg_buckets = a->lg_buckets;
-  const Tuple* input = a->input;
-  register HashCell *buckets = a->global_buckets;
-  register char* valid = a->valid;
+  const InputColumns input = a->columns;
+  register HashCell *buckets = a->node_buckets[a->table_of[id]];
+  register char* valid = a->node_valid[a->table_of[id]];
+
+  /* contention counts, see global_table.h */
+  unsigned int cas_failures = 0, lock_waits = 0, chain_retries = 0;
 
   for(i = start; i<=end; i++)
     {
       bool done = false; /* flag set when the current tuple is processed */
-      //hash = joaat_hash_hardcoded((unsigned char*)&(input[i].group));
+      //hash = joaat_hash_hardcoded((unsigned char*)&(ColumnGet(input.group, i, plain)));
       //index = hash & a->BUCKET_MASK;
-      index = mhash(input[i].group, lg_buckets);
+      index = mhash(ColumnGet(input.group, i, plain), lg_buckets);
       
       /* First check to see if the bucket has been visited before */
       if(!valid[index])
 	{
 	  /* we're first, initialize the cell */
-	  MUTEX_LOCK(buckets[index].lock);
+	  lock_waits += LockAcquire(a, id, &(buckets[index].lock));
 
 	  /* recheck the bucket status after we aquire the lock */
 	  /* someone may have beat us here */	  
 	  if(valid[index] == 0)
 	    {
-	      buckets[index].key = input[i].group;
+	      buckets[index].key = ColumnGet(input.group, i, plain);
 
-	      buckets[index].sum1 = input[i].value1;
+	      buckets[index].sum1 = ColumnGet(input.value1, i, plain);
 	      buckets[index].count1 = 1;
-	      buckets[index].squares1 = input[i].value1 * input[i].value1;
+	      buckets[index].squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
-	      buckets[index].sum2 = input[i].value2;
+	      buckets[index].sum2 = ColumnGet(input.value2, i, plain);
 	      buckets[index].count2 = 1;
-	      buckets[index].squares2 = input[i].value2 * input[i].value2;
+	      buckets[index].squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-	      buckets[index].sum3 = input[i].value3;
+	      buckets[index].sum3 = ColumnGet(input.value3, i, plain);
 	      buckets[index].count3 = 1;
-	      buckets[index].squares3 = input[i].value3 * input[i].value3;
+	      buckets[index].squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
-	      buckets[index].sum4 = input[i].value4;
+	      buckets[index].sum4 = ColumnGet(input.value4, i, plain);
 	      buckets[index].count4 = 1;
 
 	      buckets[index].next = NULL;
@@ -233,7 +254,7 @@ void AggregateMutex(Aggregate a, const int id,
 	      valid[index] = 1; /*set last or immediatley valid...*/
 	      done = true;
 	    }	  
-	  MUTEX_UNLOCK(buckets[index].lock);
+	  LockRelease(a, id, &(buckets[index].lock));
 	}
       
       /* if !done we didn't initialize a cell above */
@@ -245,7 +266,7 @@ void AggregateMutex(Aggregate a, const int id,
 	  prev = NULL;
 
 	  /* is key already there? */
-	  while(current!=NULL && current->key != input[i].group)
+	  while(current!=NULL && current->key != ColumnGet(input.group, i, plain))
 	    { 
 	      prev = current;
 	      current = current->next;
@@ -255,63 +276,84 @@ void AggregateMutex(Aggregate a, const int id,
 	    {	     
 	      /* Found key -- update aggregate */
 	      	      
-	      MUTEX_LOCK(current->lock);
+	      lock_waits += LockAcquire(a, id, &(current->lock));
 
-	      current->sum1 = input[i].value1;
+	      current->sum1 += ColumnGet(input.value1, i, plain);
 	      current->count1 ++;
-	      current->squares1 = input[i].value1 * input[i].value1;
+	      current->squares1 += ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
-	      current->sum2 = input[i].value2;
+	      current->sum2 += ColumnGet(input.value2, i, plain);
 	      current->count2 ++;
-	      current->squares2 = input[i].value2 * input[i].value2;
+	      current->squares2 += ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-	      current->sum3 = input[i].value3;
+	      current->sum3 += ColumnGet(input.value3, i, plain);
 	      current->count3 ++;
-	      current->squares3 = input[i].value3 * input[i].value3;
+	      current->squares3 += ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
-	      current->sum4 = input[i].value4;
+	      current->sum4 += ColumnGet(input.value4, i, plain);
 	      current->count4 ++;
 
-	      MUTEX_UNLOCK(current->lock);
+	      LockRelease(a, id, &(current->lock));
 	      done = true;	    
 	    }
 	  else
 	    {	      
 	      /* Didn't find key, allocate new cell at beginning */
-	      MUTEX_LOCK(buckets[index].lock);
+	      lock_waits += LockAcquire(a, id, &(buckets[index].lock));
 	      /* as we did in earlier init code, make sure we weren't beaten */
 	      if(buckets[index].next == first) 
 		{
 		  current  = (HashCell*)malloc(sizeof(HashCell));		  
-		  current->key = input[i].group;
+		  current->key = ColumnGet(input.group, i, plain);
 
-		  current->sum1 = input[i].value1;
+		  current->sum1 = ColumnGet(input.value1, i, plain);
 		  current->count1 = 1;
-		  current->squares1 = input[i].value1 * input[i].value1;
+		  current->squares1 = ColumnGet(input.value1, i, plain) * ColumnGet(input.value1, i, plain);
 
-		  current->sum2 = input[i].value2;
+		  current->sum2 = ColumnGet(input.value2, i, plain);
 		  current->count2 = 1;
-		  current->squares2 = input[i].value2 * input[i].value2;
+		  current->squares2 = ColumnGet(input.value2, i, plain) * ColumnGet(input.value2, i, plain);
 
-		  current->sum3 = input[i].value3;
+		  current->sum3 = ColumnGet(input.value3, i, plain);
 		  current->count3 = 1;
-		  current->squares3 = input[i].value3 * input[i].value3;
+		  current->squares3 = ColumnGet(input.value3, i, plain) * ColumnGet(input.value3, i, plain);
 
-		  current->sum4 = input[i].value4;
+		  current->sum4 = ColumnGet(input.value4, i, plain);
 		  current->count4 = 1;
 
 		  current->next = first;
-		  MUTEX_INIT(current->lock);
+		  LockInit(a, &(current->lock));
 		  /* Set last or other threads can see it before init!*/
 		  /* TODO: As mentioned above, we may need a membar here */
 		  membar_exit();
 		  buckets[index].next = current; 
 		  done = true;
 		}
+	      else
+		chain_retries ++;
 	      /* If we fail, we redo everything, instead of continuing where */
 	      /* we left off...ok for now -- rarely happens */	      
-	      MUTEX_UNLOCK(buckets[index].lock);
+	      LockRelease(a, id, &(buckets[index].lock));
 	    }
 	}
     }    
+
+  ContentionAdd(a, id, cas_failures, lock_waits, chain_retries, end - start + 1);
+}
+
+/* Insert into the global table */
+void AggregateMutex(Aggregate a, const int id,
+		    const int start, const int end)
+{
+  /* several lookups at a time, see interleave.c */
+  if(a->opts.interleave > 1)
+    {
+      AggregateMutexInterleaved(a, id, start, end);
+      return;
+    }
+
+  if(ColumnsPlain(&(a->columns)))
+    MutexRange(a, id, start, end, true);
+  else
+    MutexRange(a, id, start, end, false);
 }
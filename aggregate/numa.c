@@ -0,0 +1,172 @@
+/*
+ * File: numa.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Placement of the input and the global table on the NUMA nodes of the
+ * threads that use them. Memory lands on the node of the thread that
+ * touches it first, so placement is done by having the (bound) pool
+ * workers do the first touch:
+ *
+ *  - the input is copied by the worker that will read each chunk, and
+ *  - every worker initializes its share of the global table it uses.
+ *
+ * Optionally every node gets its own global table. Threads only write to
+ * the table of their node, and the tables are merged into table 0 at the
+ * end. Since all tables hash alike, bucket b of every table holds the
+ * same keys, so each thread can merge its own range of buckets.
+ *
+ * Nodes are only known for threads bound with an affinity policy; without
+ * one everything is node 0. A node count can also be forced, which splits
+ * the threads into that many virtual nodes so that the per-node code can
+ * be exercised on a machine with a single node.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+#include "global_table.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mtmalloc.h>
+
+/* Assign every worker to a node and a global table. Called by PoolCreate. */
+void NumaPlan(Aggregate a)
+{
+  register int i, j;
+  int dense[MAX_NODES];
+
+  if(a->opts.nodes)
+    {
+      /* virtual nodes: consecutive threads share a node */
+      a->n_nodes = (a->opts.nodes > a->n_threads) ? a->n_threads : a->opts.nodes;
+      if(a->n_nodes > MAX_NODES)
+	a->n_nodes = MAX_NODES;
+      for(i = 0; i < a->n_threads; i++)
+	a->node_of[i] = (unsigned long long)i * a->n_nodes / a->n_threads;
+    }
+  else
+    {
+      /* number the nodes the workers are bound to 0, 1, ... */
+      for(j = 0; j < MAX_NODES; j++)
+	dense[j] = -1;
+      a->n_nodes = 0;
+      for(i = 0; i < a->n_threads; i++)
+	{
+	  j = AffinityNode(a->cpu_of[i]);
+	  if(dense[j] < 0)
+	    dense[j] = a->n_nodes++;
+	  a->node_of[i] = dense[j];
+	}
+    }
+
+  a->n_tables = a->opts.node_tables ? a->n_nodes : 1;
+  for(i = 0; i < a->n_threads; i++)
+    a->table_of[i] = a->opts.node_tables ? a->node_of[i] : 0;
+}
+
+/* the distinct dense (stride 1, unpacked) columns of a's input, in column order */
+static int DenseColumns(Aggregate a, const uint64_t *data[5])
+{
+  register int k, j, n = 0;
+  const Column *c = &(a->columns.group);
+
+  for(k = 0; k < 5; k++)
+    {
+      if(c[k].stride != 1 || c[k].bits)
+	continue;
+      for(j = 0; j < n && data[j] != c[k].data; j++)
+	;
+      if(j == n)
+	data[n++] = c[k].data;
+    }
+  return n;
+}
+
+/* stub for thread to start in: copy the chunk this thread will read */
+static void * run_place_input(void *v)
+{
+  ThreadInfo *info = (ThreadInfo*)v;
+  Aggregate a = info->a;
+  register int k;
+  const uint64_t *data[5];
+  uint64_t *placed = (uint64_t*)a->placed_input;
+
+  const unsigned int chunkSize = a->n_tups/a->n_threads;
+  const unsigned int start = info->id * chunkSize;
+  const unsigned int end = (info->id == a->n_threads-1) ? a->n_tups-1: chunkSize*(info->id+1)-1;
+  const int n = DenseColumns(a, data);
+
+  if(a->input)
+    memcpy(&(((Tuple*)a->placed_input)[start]), &(a->input[start]), sizeof(Tuple) * (end - start + 1));
+  else
+    for(k = 0; k < n; k++)
+      memcpy(&(placed[(uint64_t)k * a->n_tups + start]), &(data[k][start]), 
+	     sizeof(uint64_t) * (end - start + 1));
+  return NULL;
+}
+
+/*
+ * Replace the input with a copy whose chunks were first touched by the
+ * threads that read them. Morsels of a thread's own chunk stay local;
+ * stolen morsels are read remotely. Of columnar input only the dense
+ * columns are copied, each once however many columns share it; packed
+ * columns stay where they are.
+ */
+void NumaPlaceInput(Aggregate a)
+{
+  register int k, j;
+  const uint64_t *data[5];
+  Column *c = &(a->columns.group);
+  const int n = DenseColumns(a, data);
+
+  if(a->input)
+    {
+      a->placed_input = malloc(sizeof(Tuple) * a->n_tups);
+      assert(a->placed_input);
+      PoolRun(a, run_place_input);
+      a->input = (Tuple*)a->placed_input;
+      a->columns = RowColumns(a->input);
+      return;
+    }
+
+  if(n == 0)
+    return;
+  a->placed_input = malloc(sizeof(uint64_t) * a->n_tups * n);
+  assert(a->placed_input);
+  PoolRun(a, run_place_input);
+  for(k = 0; k < 5; k++)
+    for(j = 0; j < n; j++)
+      if(c[k].stride == 1 && c[k].data == data[j])
+	{
+	  c[k].data = (uint64_t*)a->placed_input + (uint64_t)j * a->n_tups;
+	  break;
+	}
+}
+
+/* Merge my range of buckets of tables 1.. into table 0. The merge step */
+/* for per node tables, see AggregateMergeSteps. */
+void AggregateMergeNodes(Aggregate a, const int id)
+{
+  register int t, b;
+  register HashCell *p;
+
+  const unsigned int chunkSize = a->n_buckets/a->n_threads;
+  const unsigned int start = id * chunkSize;
+  const unsigned int end = (id == a->n_threads-1) ? a->n_buckets-1: chunkSize*(id+1)-1;
+
+  for(t = 1; t < a->n_tables; t++)
+    for(b = start; b <= end; b++)
+      {
+	if(!a->node_valid[t][b])
+	  continue;
+	for(p = &(a->node_buckets[t][b]); p != NULL; p = p->next)
+	  AddToTable(a, id, a->node_buckets[0], a->node_valid[0],
+		     p->key,
+		     p->count1, p->sum1, p->squares1,
+		     p->count2, p->sum2, p->squares2,
+		     p->count3, p->sum3, p->squares3,
+		     p->count4, p->sum4);
+      }
+}
@@ -0,0 +1,34 @@
+/*
+ * File: options.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Run time options shared by all of the aggregation strategies.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Fill in the defaults, which reproduce the behavior of the paper */
+void AggregateOptionsDefault(AggregateOptions *opts)
+{
+  memset(opts, 0, sizeof(AggregateOptions));
+  opts->cooperative = COOP_OFF;
+  opts->drift = false;
+  opts->trace = false;
+  opts->bandit = false;
+  opts->feedback = false;
+  opts->morsel = 0;
+  opts->affinity = AFFINITY_NONE;
+  opts->numa = false;
+  opts->node_tables = false;
+  opts->nodes = 0;
+  opts->pipelined = false;
+  opts->interleave = 0;
+  opts->auto_dop = false;
+  opts->pool = NULL;
+  opts->lock = LOCK_PTHREAD;
+}
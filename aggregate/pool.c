@@ -0,0 +1,134 @@
+/*
+ * File: pool.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * A pool of n_threads worker threads that lives as long as the aggregate.
+ * Table initialization, aggregation and merge are run as phases on the
+ * same workers instead of creating and joining threads for every phase.
+ *
+ * Workers wait on the start barrier for a phase, run it with their own
+ * ThreadInfo and meet the caller again on the done barrier, so PoolRun
+ * returns only when every worker has finished the phase.
+ *
+ * Each worker binds itself to the processor chosen by AffinityPlan before
+ * it runs anything, so the tables it initializes are first touched there.
+ *
+ * Several aggregates can share one pool (AggregateOptions.pool), so that
+ * they can run at the same time without more threads than processors
+ * (see sched.c). Every phase runs as the threads of the aggregate that
+ * dispatched it. Aggregates sharing a pool must be created with the same
+ * affinity and node options, and only one thread may dispatch at a time.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <thread.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <mtmalloc.h>
+
+/* the loop every worker runs until the pool is deleted */
+static void * run_worker(void *v)
+{
+  ThreadInfo *info = (ThreadInfo*)v;
+  Aggregate a = info->a;
+  Pool p = a->pool;
+
+  /* bind before the first phase touches any memory */
+  p->pinned[info->id] = AffinityPin(a->cpu_of[info->id]) && a->cpu_of[info->id] >= 0;
+
+  while(1)
+    {
+      pthread_barrier_wait(&p->start);
+      if(p->quit)
+	break;
+      p->task(info);
+      pthread_barrier_wait(&p->done);
+    }
+  return NULL;
+}
+
+/* Start a->n_threads workers for a, or join a->opts.pool. Sets a->pool. */
+Pool PoolCreate(Aggregate a)
+{
+  register int i, r;
+  Pool p;
+
+  if(a->opts.pool)
+    {
+      /* the workers are already placed; make the same plan for a */
+      p = a->opts.pool;
+      assert(p->n_threads == a->n_threads);
+      p->users ++;
+      a->pool = p;
+      AffinityPlan(a);
+      NumaPlan(a);
+      DopInit(a);
+      return p;
+    }
+
+  p = (Pool)malloc(sizeof(PoolCDT));
+  assert(p);
+
+  p->n_threads = a->n_threads;
+  p->threads = (pthread_t*)malloc(sizeof(pthread_t) * p->n_threads);
+  p->info = (ThreadInfo*)malloc(sizeof(ThreadInfo) * p->n_threads);
+  assert(p->threads && p->info);
+  p->task = NULL;
+  p->quit = false;
+  p->users = 1;
+
+  /* the workers plus the thread that dispatches */
+  pthread_barrier_init(&p->start, NULL, p->n_threads + 1);
+  pthread_barrier_init(&p->done, NULL, p->n_threads + 1);
+
+  a->pool = p;
+  AffinityPlan(a);
+  NumaPlan(a);
+  DopInit(a);
+  for(i = 0; i < p->n_threads; i++)
+    {
+      p->info[i].id = i;
+      p->info[i].a = a;
+      r = pthread_create(&p->threads[i], NULL, run_worker, &p->info[i]);
+      assert(r==0);
+    }
+  return p;
+}
+
+/* Run task on every worker of a's pool, as the threads of a, and */
+/* wait for all of them to finish */
+void PoolRun(Aggregate a, void *(*task)(void *))
+{
+  register int i;
+  Pool p = a->pool;
+
+  for(i = 0; i < p->n_threads; i++)
+    p->info[i].a = a;
+  p->task = task;
+  pthread_barrier_wait(&p->start);
+  pthread_barrier_wait(&p->done);
+}
+
+/* Leave the pool; the last aggregate to leave stops and joins the workers */
+void PoolDelete(Pool p)
+{
+  register int i;
+
+  if(--p->users > 0)
+    return;
+
+  p->quit = true;
+  pthread_barrier_wait(&p->start);
+  for(i = 0; i < p->n_threads; i++)
+    pthread_join(p->threads[i], NULL);
+
+  pthread_barrier_destroy(&p->start);
+  pthread_barrier_destroy(&p->done);
+  free(p->threads);
+  free(p->info);
+  free(p);
+}
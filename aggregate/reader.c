@@ -0,0 +1,249 @@
+/*
+ * File: reader.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Reading the (group, value) input files without stdio. Every file gets
+ * an I/O thread that reads it in READER_BLOCK blocks with pread, one
+ * block ahead of the thread that widens the pairs into tuples, so the
+ * device and the widening overlap (double buffering). Reading many files
+ * at once gives a pool of readers, one per file.
+ *
+ * Where the system has it, the file is read with direct I/O (O_DIRECT,
+ * or directio() on Solaris) into aligned buffers: the blocks go straight
+ * from the device to the buffer, without a copy through the file system
+ * cache that a single pass over the input doesn't need. Files that can't
+ * be read that way are read through the cache with the same large reads,
+ * including files that open for direct I/O but then refuse the reads
+ * (EINVAL, e.g. on file systems without it). Any other read error stops
+ * the program; it is not taken for the end of the file.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <pthread.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <mtmalloc.h>
+
+/* give up direct I/O: reopen r's file to read it through the cache */
+static void ReaderIndirect(Reader r)
+{
+#ifdef DIRECTIO_OFF
+  directio(r->fd, DIRECTIO_OFF);
+#endif /* DIRECTIO_OFF */
+  close(r->fd);
+  r->fd = open(r->path, O_RDONLY);
+  if(r->fd < 0)
+    {
+      fprintf(stderr, "Could not open file: %s\n", r->path);
+      exit(-1);
+    }
+  r->direct = false;
+}
+
+/* the I/O thread: fill the blocks in turn until limit or the end of the file */
+static void * run_io(void *v)
+{
+  Reader r = (Reader)v;
+  register unsigned int b;
+  uint64_t offset = 0;
+  size_t want, got;
+  ssize_t n;
+  bool end = false;
+  hrtime_t start;
+
+  for(b = 0; ; b = (b + 1) % READER_DEPTH)
+    {
+      pthread_mutex_lock(&r->lock);
+      while(r->full[b] && !r->quit)
+	pthread_cond_wait(&r->emptied, &r->lock);
+      pthread_mutex_unlock(&r->lock);
+      if(r->quit)
+	break;
+
+      /* direct reads must cover whole aligned blocks, even at the end */
+      want = (r->limit - offset < READER_BLOCK) ? r->limit - offset : READER_BLOCK;
+      if(end)
+	want = 0;
+      else if(r->direct)
+	want = (want + READER_ALIGN - 1) / READER_ALIGN * READER_ALIGN;
+
+      start = gethrtime();
+      for(got = 0; got < want; got += n)
+	{
+	  n = pread(r->fd, r->block[b] + got, want - got, offset + got);
+	  if(n < 0 && errno == EINTR)
+	    n = 0;
+	  else if(n < 0 && errno == EINVAL && r->direct)
+	    {
+	      /* no direct reads after all, go on through the cache */
+	      ReaderIndirect(r);
+	      n = 0;
+	    }
+	  else if(n < 0)
+	    {
+	      fprintf(stderr, "Could not read file: %s: %s\n", r->path, strerror(errno));
+	      exit(-1);
+	    }
+	  else if(n == 0)
+	    break;
+	}
+      r->busy += gethrtime() - start;
+
+      /* past a short read the offset isn't aligned any more; stop there */
+      if(got < want)
+	end = true;
+      if(got > r->limit - offset)
+	got = r->limit - offset;
+      offset += got;
+
+      pthread_mutex_lock(&r->lock);
+      r->size[b] = got;
+      r->full[b] = true;
+      pthread_cond_signal(&r->filled);
+      pthread_mutex_unlock(&r->lock);
+
+      /* an empty block tells the user it's over */
+      if(got == 0)
+	break;
+    }
+  return NULL;
+}
+
+/* Start reading the first limit bytes of path (all of it if limit is 0) */
+Reader ReaderOpen(const char *path, uint64_t limit)
+{
+  register int i;
+  Reader r;
+
+  r = (Reader)calloc(1, sizeof(ReaderCDT));
+  assert(r);
+
+  r->path = strdup(path);
+  assert(r->path);
+  r->fd = -1;
+#ifdef O_DIRECT
+  r->fd = open(path, O_RDONLY | O_DIRECT);
+  r->direct = (r->fd >= 0);
+#endif /* O_DIRECT */
+  if(r->fd < 0)
+    r->fd = open(path, O_RDONLY);
+  if(r->fd < 0)
+    {
+      fprintf(stderr, "Could not open file: %s\n", path);
+      exit(-1);
+    }
+#ifdef DIRECTIO_ON
+  r->direct = (directio(r->fd, DIRECTIO_ON) == 0);
+#endif /* DIRECTIO_ON */
+
+  r->limit = limit ? limit : ~(uint64_t)0;
+  for(i = 0; i < READER_DEPTH; i++)
+    {
+      r->block[i] = (char*)memalign(READER_ALIGN, READER_BLOCK);
+      assert(r->block[i]);
+    }
+
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->filled, NULL);
+  pthread_cond_init(&r->emptied, NULL);
+  i = pthread_create(&r->io, NULL, run_io, r);
+  assert(i == 0);
+  return r;
+}
+
+/*
+ * Widen the next n pairs of the file into dst, value into value1 .. 4.
+ * Returns how many there were, fewer than n only at the end.
+ */
+uint64_t ReaderPairs(Reader r, Tuple *dst, uint64_t n)
+{
+  register uint64_t i, take, done = 0;
+  register const uint64_t *p;
+  const size_t pair = 2 * sizeof(uint64_t);
+  hrtime_t start;
+
+  while(done < n && !r->ended)
+    {
+      if(!r->holding)
+	{
+	  pthread_mutex_lock(&r->lock);
+	  start = gethrtime();
+	  while(!r->full[r->using])
+	    pthread_cond_wait(&r->filled, &r->lock);
+	  r->wait += gethrtime() - start;
+	  pthread_mutex_unlock(&r->lock);
+
+	  if(r->size[r->using] == 0)
+	    {
+	      r->ended = true;
+	      break;
+	    }
+	  r->holding = true;
+	  r->pos = 0;
+	  r->bytes += r->size[r->using];
+	}
+
+      take = (r->size[r->using] - r->pos) / pair;
+      if(take > n - done)
+	take = n - done;
+      p = (const uint64_t*)(r->block[r->using] + r->pos);
+      for(i = 0; i < take; i++)
+	{
+	  dst[done + i].group = p[2*i];
+	  dst[done + i].value1 = dst[done + i].value2 = dst[done + i].value3 = dst[done + i].value4 = p[2*i+1];
+	}
+      done += take;
+      r->pos += take * pair;
+
+      /* done with the block (a torn pair at the end is dropped) */
+      if(r->size[r->using] - r->pos < pair)
+	{
+	  pthread_mutex_lock(&r->lock);
+	  r->full[r->using] = false;
+	  pthread_cond_signal(&r->emptied);
+	  pthread_mutex_unlock(&r->lock);
+	  r->using = (r->using + 1) % READER_DEPTH;
+	  r->holding = false;
+	}
+    }
+  return done;
+}
+
+/* Stop reading, adding what it cost to total (if not NULL) */
+void ReaderClose(Reader r, ReadStats *total)
+{
+  register int i;
+
+  pthread_mutex_lock(&r->lock);
+  r->quit = true;
+  pthread_cond_broadcast(&r->emptied);
+  pthread_mutex_unlock(&r->lock);
+  pthread_join(r->io, NULL);
+
+  if(total)
+    {
+      total->bytes += r->bytes;
+      total->busy += r->busy / 1000000000.0;
+      total->wait += r->wait / 1000000000.0;
+      total->files ++;
+      total->direct += r->direct ? 1 : 0;
+    }
+
+  close(r->fd);
+  free(r->path);
+  for(i = 0; i < READER_DEPTH; i++)
+    free(r->block[i]);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->filled);
+  pthread_cond_destroy(&r->emptied);
+  free(r);
+}
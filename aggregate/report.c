@@ -0,0 +1,103 @@
+/*
+ * File: report.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Metrics of the last run, printed after the result line as
+ * "# name<TAB>value" lines so that plotting scripts skip them.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <stdio.h>
+#include <strings.h>
+
+/* waits of any kind per global table update */
+double ContentionRate(const ContentionStats *c)
+{
+  if(c->updates == 0)
+    return 0.0;
+  return (double)(c->cas_failures + c->lock_waits + c->chain_retries) / c->updates;
+}
+
+/* Sum the contention counters of all threads into total */
+void AggregateContention(Aggregate a, ContentionStats *total)
+{
+  register int i;
+
+  bzero(total, sizeof(ContentionStats));
+  for(i = 0; i < a->n_threads; i++)
+    {
+      total->cas_failures += a->contention[i].cas_failures;
+      total->lock_waits += a->contention[i].lock_waits;
+      total->chain_retries += a->contention[i].chain_retries;
+      total->updates += a->contention[i].updates;
+    }
+}
+
+void AggregateReport(Aggregate a, FILE *f)
+{
+  register int i;
+  unsigned int switches = 0, steals = 0;
+  bool first;
+  ContentionStats total;
+
+  AggregateContention(a, &total);
+  for(i = 0; i < a->n_threads; i++)
+    {
+      switches += a->feedback_switches[i];
+      steals += a->steals[i];
+    }
+
+  fprintf(f, "# cas_failures\t%llu\n", (unsigned long long)total.cas_failures);
+  fprintf(f, "# lock_waits\t%llu\n", (unsigned long long)total.lock_waits);
+  fprintf(f, "# chain_retries\t%llu\n", (unsigned long long)total.chain_retries);
+  fprintf(f, "# global_updates\t%llu\n", (unsigned long long)total.updates);
+  fprintf(f, "# contention_rate\t%f\n", ContentionRate(&total));
+  fprintf(f, "# feedback_switches\t%u\n", switches);
+  fprintf(f, "# morsels\t%u\n", a->n_morsels);
+  fprintf(f, "# morsel_size\t%u\n", a->morsel_size);
+  fprintf(f, "# steals\t%u\n", steals);
+  fprintf(f, "# pipelined\t%s\n", a->opts.pipelined ? "yes" : "no");
+  fprintf(f, "# dop\t%u%s\n", a->dop, a->opts.auto_dop ? " (auto)" : "");
+  if(a->opts.auto_dop)
+    {
+      /* the thread counts the ramp measured */
+      fprintf(f, "# dop_throughput\t");
+      for(i = 1, first = true; i <= a->n_threads; i++)
+	if(a->dop_throughput[i] > 0.0)
+	  {
+	    fprintf(f, "%s%d:%.0f", first ? "" : ",", i, a->dop_throughput[i]);
+	    first = false;
+	  }
+      fprintf(f, "\n");
+    }
+  fprintf(f, "# interleave\t%u\n", (a->opts.interleave > INTERLEAVE_MAX) ? INTERLEAVE_MAX : a->opts.interleave);
+
+  fprintf(f, "# lock\t%s\n", LockName(a->opts.lock));
+  fprintf(f, "# affinity\t%s\n", AffinityName(a->opts.affinity));
+  fprintf(f, "# cpus\t");
+  for(i = 0; i < a->n_threads; i++)
+    {
+      if(a->cpu_of[i] < 0)
+	fprintf(f, "%s-", i ? "," : "");
+      else
+	fprintf(f, "%s%d%s", i ? "," : "", a->cpu_of[i], a->pool->pinned[i] ? "" : "?");
+    }
+  fprintf(f, "\n");
+
+  fprintf(f, "# nodes\t%u\n", a->n_nodes);
+  fprintf(f, "# global_tables\t%u\n", a->n_tables);
+  fprintf(f, "# input_placed\t%s\n", a->placed_input ? "yes" : "no");
+  fprintf(f, "# chunk_plans\t%u\n", a->n_chunks);
+
+  if(a->stream)
+    {
+      fprintf(f, "# stream_buffers\t%u\n", a->stream->n_slots);
+      fprintf(f, "# stream_tuples\t%llu\n", (unsigned long long)a->stream->n_read);
+      fprintf(f, "# reader_waits\t%u\n", a->stream->reader_waits);
+      fprintf(f, "# worker_waits\t%u\n", a->stream->worker_waits);
+      fprintf(f, "# emissions\t%u\n", a->stream->n_emits);
+    }
+}
@@ -0,0 +1,402 @@
+/*
+ * File: sample.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Turns the statistics gathered by AggregateSample into a choice of
+ * strategy. Shared by the adaptive and resample engines.
+ *
+ * In cooperative mode the threads publish their samples and build one
+ * pooled estimate. Contention is a property of the whole input, so the
+ * access counts of all private tables are summed bucket by bucket (every
+ * table uses the same hash function, so bucket i holds the same keys in
+ * every table) before looking for heavy hitters.
+ *
+ * Instead of sampling, the engines can estimate the same statistics from
+ * statistics of the chunks of the input that were gathered when it was
+ * written (AggregateEstimateChunks).
+ *
+ * With feedback on, a choice of the atomic strategy is checked against
+ * the contention the global table actually reports (see global_table.h)
+ * and abandoned for the hybrid strategy when the table is contended.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <atomic.h>
+#include <thread.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <mtmalloc.h>
+#include <strings.h>
+
+/* keep the N_MAX_ACCESS largest counts, sorted, in max */
+static inline void InsertMax(unsigned int *max, const unsigned int count)
+{
+  register int j, k;
+  for(j = 0; j < N_MAX_ACCESS; j++)
+    /* check all maxes */
+    if(max[j] < count)
+      {
+	/* found this value's spot */
+	/* slide all others down */
+	for(k = N_MAX_ACCESS-1; k > j; k--)
+	  max[k] = max[k-1];
+	max[j] = count;
+	break;
+      }
+}
+
+/* derive contention, run length and miss rate from the raw counts */
+static void EstimateFromCounts(SampleStats *s)
+{
+  register int i;
+  double f;
+
+  s->estimate_sum = 0.0;
+  for(i = 0; i < N_MAX_ACCESS; i++)
+    {
+      f = (double)s->max[i]/s->n_accesses;
+      if( f >= 1.0/7.58)
+	{
+	  s->estimate_sum += 25.1 *f - 3.31;
+	}
+      else
+	{
+	  break; //no subsequent max will meet the threshold, either.
+	}
+    }
+
+  s->avg_run_length = (double)s->n_accesses / s->num_runs;
+  s->missrate = ( (double)( s->n_samples - s->hits) )/(s->n_samples);
+}
+
+/*
+ * Build the statistics for thread id from its private table. n_samples
+ * tuples were checked for hits, n_accesses tuples (sample plus warmup)
+ * were counted in the access counts.
+ */
+void AggregateEstimate(Aggregate a, const int id,
+		       int hits, int num_runs, 
+		       int n_samples, int n_accesses, SampleStats *s)
+{
+  register unsigned int i, j;
+  PrivateHashBucket *buckets = a->private_buckets[id];
+
+  s->hits = hits;
+  s->num_runs = num_runs;
+  s->n_samples = n_samples;
+  s->n_accesses = n_accesses;
+  s->distinct = 0;
+
+  /* calculate the max accesses */
+  for(i = 0; i < N_MAX_ACCESS; i++)
+    s->max[i] = 0; //init to 0
+  for(i = 0; i < a->n_private_buckets; i++)
+    {
+      InsertMax(s->max, buckets[i].access_count);
+      for(j = 0; j < PRIVATE_BUCKET_SIZE && buckets[i].valid[j]; j++)
+	s->distinct ++;
+    }
+
+  EstimateFromCounts(s);
+}
+
+/*
+ * The statistics of [start, end] from the chunk statistics of the input
+ * (see AggregateChunks) instead of a sample. Every chunk that overlaps
+ * the range counts in full, so they describe whole chunks rather than
+ * their first few thousand tuples. The miss rate is what a private table
+ * that keeps the heavy hitters and an even share of the other keys would
+ * see. False if no chunk overlaps the range.
+ */
+bool AggregateEstimateChunks(Aggregate a, const unsigned int start, 
+			     const unsigned int end, SampleStats *s)
+{
+  register unsigned int c, d, h, k;
+  const TupFileShardStats *st;
+  uint64_t n = 0, runs = 0, heavy = 0, distinct = 0, sum = 0, first, last;
+  uint64_t key[4 * TUPFILE_HEAVY], count[4 * TUPFILE_HEAVY];
+  unsigned int n_keys = 0, smallest;
+  bool disjoint = true;
+  double capacity, missrate;
+
+  for(c = 0; c < a->n_chunks; c++)
+    {
+      first = a->chunks[c].first;
+      last = first + a->chunks[c].count - 1;
+      if(a->chunks[c].count == 0 || last < start || first > end)
+	continue;
+      st = &(a->chunk_stats[c]);
+      n += a->chunks[c].count;
+      runs += st->runs;
+      sum += st->distinct;
+      if(st->distinct > distinct)
+	distinct = st->distinct;
+
+      /* keys of chunks with disjoint key ranges are distinct, too */
+      for(d = 0; d < c && disjoint; d++)
+	if(a->chunks[d].count > 0 && a->chunks[d].first <= end 
+	   && a->chunks[d].first + a->chunks[d].count > start
+	   && a->chunk_stats[d].min_key <= st->max_key && st->min_key <= a->chunk_stats[d].max_key)
+	  disjoint = false;
+
+      /* the same heavy hitter may be heavy in several chunks */
+      for(h = 0; h < st->n_heavy && h < TUPFILE_HEAVY; h++)
+	{
+	  for(k = 0; k < n_keys && key[k] != st->heavy_key[h]; k++)
+	    ;
+	  if(k == n_keys && n_keys == 4 * TUPFILE_HEAVY)
+	    {
+	      /* full: replace the smallest, if this one is bigger */
+	      for(smallest = 0, k = 1; k < n_keys; k++)
+		if(count[k] < count[smallest])
+		  smallest = k;
+	      if(count[smallest] >= st->heavy_count[h])
+		continue;
+	      k = smallest;
+	      count[k] = 0;
+	    }
+	  else if(k == n_keys)
+	    count[n_keys++] = 0;
+	  key[k] = st->heavy_key[h];
+	  count[k] += st->heavy_count[h];
+	}
+    }
+  if(n == 0)
+    return false;
+  if(disjoint)
+    distinct = sum;
+
+  bzero(s, sizeof(SampleStats));
+  for(k = 0; k < n_keys; k++)
+    InsertMax(s->max, (unsigned int)count[k]);
+  for(k = 0; k < N_MAX_ACCESS; k++)
+    heavy += s->max[k];
+
+  /* cold misses, plus the keys that don't fit next to the heavy hitters */
+  capacity = (double)a->n_private_buckets * PRIVATE_BUCKET_SIZE;
+  missrate = (double)distinct / n;
+  if(distinct > capacity)
+    missrate += (1.0 - (double)heavy / n) * (1.0 - capacity / distinct);
+  if(missrate > 1.0)
+    missrate = 1.0;
+
+  s->n_samples = s->n_accesses = n;
+  s->num_runs = runs ? runs : 1;
+  s->hits = n - (int)(missrate * n);
+  s->distinct = (distinct > 0xffffffff) ? 0xffffffff : distinct;
+  EstimateFromCounts(s);
+  return true;
+}
+
+/*
+ * Count the distinct keys in bucket b across all private tables. A key is
+ * counted by the first table (in thread order) that holds it.
+ */
+static unsigned int DistinctInBucket(Aggregate a, const int b)
+{
+  register int t, u, j, k;
+  unsigned int distinct = 0;
+  PrivateHashBucket *bucket, *other;
+
+  for(t = 0; t < a->n_threads; t++)
+    {
+      bucket = &(a->private_buckets[t][b]);
+      for(j = 0; j < PRIVATE_BUCKET_SIZE && bucket->valid[j]; j++)
+	{
+	  bool seen = false;
+	  for(u = 0; u < t && !seen; u++)
+	    {
+	      other = &(a->private_buckets[u][b]);
+	      for(k = 0; k < PRIVATE_BUCKET_SIZE && other->valid[k]; k++)
+		if(other->data[k].key == bucket->data[j].key)
+		  {
+		    seen = true;
+		    break;
+		  }
+	    }
+	  if(!seen)
+	    distinct ++;
+	}
+    }
+  return distinct;
+}
+
+/*
+ * Publish the sample of thread id and compute the pooled estimate into
+ * global. Must be called by all n_threads threads; every thread combines
+ * the same published data, so they all arrive at the same estimate.
+ */
+void AggregateEstimateGlobal(Aggregate a, const int id,
+			     SampleStats *s, SampleStats *global)
+{
+  register unsigned int b, t, count;
+  unsigned int distinct;
+
+  const unsigned int chunkSize = a->n_private_buckets/a->n_threads;
+  const unsigned int start_bucket = id * chunkSize;
+  const unsigned int end_bucket = (id == a->n_threads-1) ? a->n_private_buckets : (id+1) * chunkSize;
+
+  a->samples[id] = *s;
+  pthread_barrier_wait(&a->sample_barrier);
+
+  /* combine my slice of the buckets across all private tables */
+  distinct = 0;
+  for(b = start_bucket; b < end_bucket; b++)
+    {
+      count = 0;
+      for(t = 0; t < a->n_threads; t++)
+	count += a->private_buckets[t][b].access_count;
+      a->global_access[b] = count;
+      distinct += DistinctInBucket(a, b);
+    }
+  a->distinct[id] = distinct;
+
+  pthread_barrier_wait(&a->sample_barrier);
+
+  bzero(global, sizeof(SampleStats));
+  for(t = 0; t < a->n_threads; t++)
+    {
+      global->hits += a->samples[t].hits;
+      global->num_runs += a->samples[t].num_runs;
+      global->n_samples += a->samples[t].n_samples;
+      global->n_accesses += a->samples[t].n_accesses;
+      global->distinct += a->distinct[t];
+    }
+  for(b = 0; b < a->n_private_buckets; b++)
+    InsertMax(global->max, a->global_access[b]);
+
+  EstimateFromCounts(global);
+}
+
+/* The threshold rules from the paper */
+Strategy AggregateChoose(const SampleStats *s)
+{
+  if(s->avg_run_length > 1.142857) // 8/7
+    {
+      /* Runs are present */
+      return STRATEGY_RUNS;
+    }
+  //  else if(missrate < 0.5 || max > (SAMPLE_SIZE + WARMUP)/16)
+  else if (s->missrate < 0.5 || s->estimate_sum >= 1.0)
+    {
+      /* locallity or contention */
+      return STRATEGY_HYBRID;
+    }
+  /* no locallity or contention, use global table */
+  return STRATEGY_ATOMIC;
+}
+
+/*
+ * Has the distribution moved away from the last full sample? The probe is
+ * small, so it only has to agree on the plan and roughly on the hit rate
+ * and run length.
+ */
+bool AggregateDrifted(const SampleStats *last, const SampleStats *probe)
+{
+  if(AggregateChoose(probe) != AggregateChoose(last))
+    return true;
+  if(fabs(probe->missrate - last->missrate) > DRIFT_TOLERANCE)
+    return true;
+  if(fabs(probe->avg_run_length - last->avg_run_length) > 
+     DRIFT_TOLERANCE * last->avg_run_length)
+    return true;
+  return false;
+}
+
+/* Pick a strategy for one thread given its own and the pooled sample */
+Strategy AggregateChooseCooperative(Aggregate a, const SampleStats *s,
+				    const SampleStats *global)
+{
+  Strategy strategy;
+
+  switch(a->opts.cooperative)
+    {
+    case COOP_CONSISTENT:
+      /* every thread runs the same plan */
+      strategy = AggregateChoose(global);
+      /* if all the groups seen fit in one private table, that's locality */
+      if(strategy == STRATEGY_ATOMIC 
+	 && global->distinct < a->n_private_buckets * PRIVATE_BUCKET_SIZE)
+	strategy = STRATEGY_HYBRID;
+      return strategy;
+
+    case COOP_HETEROGENEOUS:
+      /* runs and locality are properties of my chunk, contention isn't */
+      if(s->avg_run_length > 1.142857)
+	return STRATEGY_RUNS;
+      else if(s->missrate < 0.5 || global->estimate_sum >= 1.0)
+	return STRATEGY_HYBRID;
+      return STRATEGY_ATOMIC;
+
+    default:
+      return AggregateChoose(s);
+    }
+}
+
+/*
+ * The atomic strategy in blocks of FEEDBACK_BLOCK tuples. If a block
+ * measures more than FEEDBACK_THRESHOLD waits per update, the rest of the
+ * range goes through the private table instead. Returns the strategy
+ * that finished the range.
+ */
+static Strategy AggregateAtomicFeedback(Aggregate a, const int id,
+					const int start, const int end)
+{
+  register int block_start, block_end;
+  ContentionStats *c = &(a->contention[id]);
+  ContentionStats before, block;
+
+  for(block_start = start; block_start <= end; block_start = block_end + 1)
+    {
+      block_end = (end - block_start < FEEDBACK_BLOCK) ? end : block_start + FEEDBACK_BLOCK - 1;
+
+      before = *c;
+      AggregateAtomic(a, id, block_start, block_end);
+
+      block.cas_failures = c->cas_failures - before.cas_failures;
+      block.lock_waits = c->lock_waits - before.lock_waits;
+      block.chain_retries = c->chain_retries - before.chain_retries;
+      block.updates = c->updates - before.updates;
+
+      if(block_end < end && ContentionRate(&block) > FEEDBACK_THRESHOLD)
+	{
+	  a->feedback_switches[id] ++;
+	  AggregateHybrid(a, id, block_end + 1, end);
+	  return STRATEGY_HYBRID;
+	}
+    }
+  return STRATEGY_ATOMIC;
+}
+
+/* Run the chosen strategy over [start, end]; returns the strategy used */
+Strategy AggregateStrategy(Aggregate a, const int id, Strategy strategy,
+			   const int start, const int end)
+{
+  if(start > end)
+    return strategy;
+
+  switch(strategy)
+    {
+    case STRATEGY_RUNS:
+      AggregateRuns(a, id, start, end);
+      break;
+    case STRATEGY_HYBRID:
+      AggregateHybrid(a, id, start, end);
+      break;
+    case STRATEGY_PARTITIONED:
+      AggregateIndependent(a, id, start, end);
+      break;
+    default:
+      if(a->opts.feedback)
+	return AggregateAtomicFeedback(a, id, start, end);
+      AggregateAtomic(a, id, start, end);
+      break;
+    }
+  return strategy;
+}
@@ -0,0 +1,200 @@
+/*
+ * File: sched.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Running aggregates in steps. Every strategy splits its work into
+ *
+ *  - AggregatePrepare, what has to happen before the workers start,
+ *  - AggregateStep, one morsel for one worker, which returns false (after
+ *    the worker's own finishing work, e.g. a pipelined merge) once the
+ *    worker gets no more input, and
+ *  - AggregateMergeSteps merge steps. Every worker does its share of a
+ *    step in AggregateMergeStep, and a step starts only after every
+ *    worker finished the one before.
+ *
+ * AggregateFlush, which moves what one worker holds on its own into the
+ * global table between two steps, lets a stream emit results while it
+ * runs (see stream.c).
+ *
+ * AggregateRun and AggregateMerge run one aggregate on its pool this way.
+ * AggregateRunConcurrent runs several aggregates that share a pool at the
+ * same time. Each worker takes turns over the queries and does one step
+ * of each, so the queries get the workers in equal shares. A worker that
+ * is done with a phase of a query moves on to the other queries instead
+ * of waiting for the rest of the workers, so one query's merge overlaps
+ * the others' aggregation. The last worker to finish a phase moves the
+ * query to the next one.
+ *
+ * All queries in one process use the strategy the binary was linked with.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+#include "timer.h"
+
+#include <atomic.h>
+#include <thread.h>
+#include <assert.h>
+#include <stdlib.h>
+
+/* the queries of one AggregateRunConcurrent */
+typedef struct BatchCDT
+{
+  Aggregate *queries;
+  int n;
+  volatile unsigned int left; /* queries not done yet */
+} BatchCDT;
+
+typedef BatchCDT *Batch;
+
+/* stub for thread to start in for one merge step */
+static void * run_merge(void *v)
+{
+  ThreadInfo* info = (ThreadInfo*)v;
+  AggregateMergeStep(info->a, info->a->merge_step, info->id);
+  return NULL;
+}
+
+/* Run the merge steps of a on its pool, one after the other. Returns */
+/* the time they took. */
+double PoolMerge(Aggregate a)
+{
+  double elapsed;
+  Timer timer;
+  const unsigned int steps = AggregateMergeSteps(a);
+
+  if(steps == 0)
+    return 0.0;
+
+  timer = TimerCreate();
+  TimerStart(timer);
+
+  for(a->merge_step = 0; a->merge_step < steps; a->merge_step++)
+    PoolRun(a, run_merge);
+
+  TimerStop(timer);
+  elapsed = TimerElapsed(timer);
+
+  /* clean up */
+  TimerDelete(timer);
+
+  return elapsed;
+}
+
+/* Worker id is done with the current phase of a. The last one to finish */
+/* moves a to its next phase. */
+static void PhaseDone(Batch b, Aggregate a, const int id)
+{
+  hrtime_t now;
+
+  a->sched_done[id] ++;
+  /* publish my part of the phase before the others can see I'm done */
+  membar_producer();
+  if(atomic_dec_uint_nv(&(a->sched_left)) > 0)
+    return;
+  membar_consumer();
+
+  now = gethrtime();
+  if(a->sched_phase == 0)
+    a->sched_operated = now;
+  if(a->sched_phase == AggregateMergeSteps(a))
+    {
+      a->sched_merged = now;
+      atomic_dec_uint(&(b->left));
+    }
+  a->sched_left = a->n_threads;
+  membar_producer();
+  a->sched_phase ++;
+}
+
+/* One step of a for worker id, if there is one it may take now. Returns */
+/* false if the worker has to wait for the others. */
+static bool Visit(Batch b, Aggregate a, const int id)
+{
+  const unsigned int phase = a->sched_phase;
+
+  /* done, or I finished this phase and the rest haven't */
+  if(phase > AggregateMergeSteps(a) || a->sched_done[id] > phase)
+    return false;
+  /* see what the workers did in the phases before */
+  membar_consumer();
+
+  if(phase == 0)
+    {
+      if(!AggregateStep(a, id))
+	PhaseDone(b, a, id);
+    }
+  else
+    {
+      AggregateMergeStep(a, phase - 1, id);
+      PhaseDone(b, a, id);
+    }
+  return true;
+}
+
+/* stub for thread to start in: take turns over the queries */
+static void * run_batch(void *v)
+{
+  ThreadInfo* info = (ThreadInfo*)v;
+  Batch b = info->a->batch;
+  register int i;
+  bool progress;
+
+  while(b->left > 0)
+    {
+      progress = false;
+      /* workers start their rounds at different queries */
+      for(i = 0; i < b->n; i++)
+	progress |= Visit(b, b->queries[(info->id + i) % b->n], info->id);
+      if(!progress)
+	thr_yield();
+    }
+  return NULL;
+}
+
+/*
+ * Run and merge the n queries at the same time on the pool they share,
+ * that of queries[0]. Query i's aggregation time goes to exec[i] and its
+ * merge time to merge[i], both from the start of the batch.
+ */
+void AggregateRunConcurrent(Aggregate *queries, int n, double *exec, double *merge)
+{
+  register int i, j;
+  hrtime_t start;
+  BatchCDT batch;
+  Aggregate a;
+
+  assert(n > 0);
+  for(i = 0; i < n; i++)
+    {
+      a = queries[i];
+      assert(a->pool == queries[0]->pool);
+      /* these make the workers of a query wait for each other */
+      assert(!a->opts.auto_dop && a->opts.cooperative == COOP_OFF && !a->stream);
+
+      AggregatePrepare(a);
+      a->sched_phase = 0;
+      a->sched_left = a->n_threads;
+      for(j = 0; j < a->n_threads; j++)
+	a->sched_done[j] = 0;
+    }
+
+  batch.queries = queries;
+  batch.n = n;
+  batch.left = n;
+  queries[0]->batch = &batch;
+
+  start = gethrtime();
+  for(i = 0; i < n; i++)
+    queries[i]->sched_start = start;
+
+  PoolRun(queries[0], run_batch);
+  queries[0]->batch = NULL;
+
+  for(i = 0; i < n; i++)
+    {
+      exec[i] = (queries[i]->sched_operated - start)/1000000000.0;
+      merge[i] = (queries[i]->sched_merged - queries[i]->sched_operated)/1000000000.0;
+    }
+}
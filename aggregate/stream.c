@@ -0,0 +1,276 @@
+/*
+ * File: stream.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Input that is aggregated while it is being read. Reader threads fill
+ * empty buffers of a fixed ring and publish them; the aggregation
+ * workers take full buffers in the order they were published, aggregate
+ * them and hand them back when they ask for the next one. Readers block
+ * when every buffer is full or being aggregated, so the memory used for
+ * the input never exceeds the ring, however large the input is.
+ *
+ * The buffers are slices of one array that serves as the aggregate's
+ * input, so a buffer is just another morsel to the strategies: MorselNext
+ * hands out buffers instead of morsels when a stream is attached.
+ *
+ * Buffers change hands once per slot_size tuples, so a mutex and two
+ * condition variables are plenty.
+ *
+ * A stream need not end. StreamEmit writes what was aggregated so far
+ * while the workers keep going: they park at their next buffer, each
+ * flushing its private state into the global table first, the table is
+ * written, and they resume. Only the time of one buffer per worker is
+ * lost, and the ring keeps filling meanwhile.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <pthread.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mtmalloc.h>
+
+/* A ring of n_slots buffers of slot_size tuples, filled by writers threads */
+Stream StreamCreate(unsigned int n_slots, unsigned int slot_size, unsigned int writers)
+{
+  register int i;
+  Stream s;
+
+  assert(n_slots > 0 && slot_size > 0 && writers > 0);
+  s = (Stream)calloc(1, sizeof(StreamCDT));
+  assert(s);
+
+  s->n_slots = n_slots;
+  s->slot_size = slot_size;
+  s->tuples = (Tuple*)malloc(sizeof(Tuple) * n_slots * slot_size);
+  s->count = (unsigned int*)malloc(sizeof(unsigned int) * n_slots);
+  s->free_slots = (unsigned int*)malloc(sizeof(unsigned int) * n_slots);
+  s->full_slots = (unsigned int*)malloc(sizeof(unsigned int) * n_slots);
+  assert(s->tuples && s->count && s->free_slots && s->full_slots);
+
+  for(i = 0; i < n_slots; i++)
+    s->free_slots[i] = n_slots - 1 - i;
+  s->n_free = n_slots;
+  for(i = 0; i < MAX_THREADS; i++)
+    s->held[i] = -1;
+  s->writers = writers;
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->not_empty, NULL);
+  pthread_cond_init(&s->not_full, NULL);
+  pthread_cond_init(&s->parked_cond, NULL);
+  pthread_cond_init(&s->resume, NULL);
+  return s;
+}
+
+/* Wait for an empty buffer and return it. Its number goes to *slot. */
+Tuple *StreamAcquire(Stream s, unsigned int *slot)
+{
+  pthread_mutex_lock(&s->lock);
+  if(s->n_free == 0)
+    s->reader_waits ++;
+  while(s->n_free == 0)
+    pthread_cond_wait(&s->not_full, &s->lock);
+  *slot = s->free_slots[--s->n_free];
+  pthread_mutex_unlock(&s->lock);
+
+  return &(s->tuples[(uint64_t)*slot * s->slot_size]);
+}
+
+/* Hand the first n tuples of an acquired buffer to the workers. */
+/* An empty buffer just goes back to the ring. */
+void StreamPublish(Stream s, unsigned int slot, unsigned int n)
+{
+  assert(n <= s->slot_size);
+  pthread_mutex_lock(&s->lock);
+  if(n == 0)
+    {
+      s->free_slots[s->n_free++] = slot;
+      pthread_cond_signal(&s->not_full);
+    }
+  else
+    {
+      s->count[slot] = n;
+      s->full_slots[(s->full_head + s->n_full) % s->n_slots] = slot;
+      s->n_full ++;
+      s->n_buffers ++;
+      s->n_read += n;
+      pthread_cond_signal(&s->not_empty);
+    }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* A reader is done. Workers stop once every reader closed and the */
+/* ring has drained. */
+void StreamClose(Stream s)
+{
+  pthread_mutex_lock(&s->lock);
+  assert(s->writers > 0);
+  s->writers --;
+  pthread_cond_broadcast(&s->not_empty);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void StreamDelete(Stream s)
+{
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->not_empty);
+  pthread_cond_destroy(&s->not_full);
+  pthread_cond_destroy(&s->parked_cond);
+  pthread_cond_destroy(&s->resume);
+  free(s->tuples);
+  free(s->count);
+  free(s->free_slots);
+  free(s->full_slots);
+  free(s);
+}
+
+/* Aggregate the tuples of s instead of a fixed input. Call before AggregateRun. */
+void AggregateStream(Aggregate a, Stream s)
+{
+  a->stream = s;
+  a->input = s->tuples;
+  a->columns = RowColumns(s->tuples);
+  s->workers = a->n_threads;
+}
+
+/*
+ * Worker id stops for an emission: it flushes what it holds into the
+ * global table, reports and waits until the emission is written (or a
+ * later one has begun). Called and returns with s->lock held.
+ */
+static void StreamPark(Aggregate a, const int id)
+{
+  Stream s = a->stream;
+  const unsigned int epoch = s->epoch;
+
+  pthread_mutex_unlock(&s->lock);
+  AggregateFlush(a, id);
+  pthread_mutex_lock(&s->lock);
+
+  s->parked ++;
+  pthread_cond_signal(&s->parked_cond);
+  while(s->pause && s->epoch == epoch)
+    pthread_cond_wait(&s->resume, &s->lock);
+}
+
+/*
+ * The next buffer for worker id, handing back the one it had. Blocks
+ * until a buffer is full; returns false when the readers are done and
+ * nothing is left. *morsel numbers buffers in the order they are taken.
+ */
+bool StreamNext(Aggregate a, const int id,
+		unsigned int *morsel, unsigned int *start, unsigned int *end)
+{
+  Stream s = a->stream;
+  unsigned int slot;
+
+  pthread_mutex_lock(&s->lock);
+  if(s->held[id] >= 0)
+    {
+      s->free_slots[s->n_free++] = s->held[id];
+      s->held[id] = -1;
+      pthread_cond_signal(&s->not_full);
+    }
+
+  if(s->n_full == 0 && s->writers > 0)
+    s->worker_waits ++;
+  while(s->pause || (s->n_full == 0 && s->writers > 0))
+    {
+      if(s->pause)
+	StreamPark(a, id);
+      else
+	pthread_cond_wait(&s->not_empty, &s->lock);
+    }
+
+  if(s->n_full == 0)
+    {
+      s->finished ++;
+      pthread_mutex_unlock(&s->lock);
+      return false;
+    }
+
+  slot = s->full_slots[s->full_head];
+  s->full_head = (s->full_head + 1) % s->n_slots;
+  s->n_full --;
+  s->held[id] = slot;
+  *morsel = a->n_morsels ++;
+  pthread_mutex_unlock(&s->lock);
+
+  *start = slot * s->slot_size;
+  *end = *start + s->count[slot] - 1;
+  return true;
+}
+
+/*
+ * Write the groups of a's global table to f, one "key count sum squares"
+ * line each (of value1), after a line "# emit <n> <tuples> <groups>".
+ * tuples is how many were aggregated into it.
+ */
+void AggregateEmit(Aggregate a, FILE *f, unsigned int n, uint64_t tuples)
+{
+  register int i;
+  register HashCell *p;
+  uint64_t groups = 0;
+
+  for(i = 0; i < a->n_buckets; i++)
+    if(a->valid[i])
+      for(p = &(a->global_buckets[i]); p != NULL; p = p->next)
+	groups ++;
+
+  fprintf(f, "# emit\t%u\t%llu\t%llu\n", n, (unsigned long long)tuples, (unsigned long long)groups);
+  for(i = 0; i < a->n_buckets; i++)
+    if(a->valid[i])
+      for(p = &(a->global_buckets[i]); p != NULL; p = p->next)
+	fprintf(f, "%llu\t%llu\t%llu\t%llu\n", (unsigned long long)p->key,
+		(unsigned long long)p->count1, (unsigned long long)p->sum1, 
+		(unsigned long long)p->squares1);
+  fflush(f);
+}
+
+/*
+ * Write what the workers of a aggregated so far to f (AggregateEmit)
+ * while the stream runs. Any thread but a worker may call it. Returns
+ * false, writing nothing, once the stream is ending: a worker that found
+ * it done can't flush any more, and the final result follows anyway.
+ */
+bool StreamEmit(Aggregate a, FILE *f)
+{
+  Stream s = a->stream;
+  register unsigned int i;
+  uint64_t pending = 0, tuples;
+
+  pthread_mutex_lock(&s->lock);
+  if(s->writers == 0 || s->finished > 0)
+    {
+      pthread_mutex_unlock(&s->lock);
+      return false;
+    }
+
+  /* no worker can finish while paused, so all of them will park */
+  s->pause = true;
+  s->epoch ++;
+  s->parked = 0;
+  pthread_cond_broadcast(&s->not_empty);
+  while(s->parked < s->workers)
+    pthread_cond_wait(&s->parked_cond, &s->lock);
+
+  /* every buffer was handed back, only the full ones are left to do */
+  for(i = 0; i < s->n_full; i++)
+    pending += s->count[s->full_slots[(s->full_head + i) % s->n_slots]];
+  tuples = s->n_read - pending;
+  pthread_mutex_unlock(&s->lock);
+
+  /* the readers go on meanwhile */
+  AggregateEmit(a, f, s->n_emits, tuples);
+
+  pthread_mutex_lock(&s->lock);
+  s->n_emits ++;
+  s->pause = false;
+  pthread_cond_broadcast(&s->resume);
+  pthread_mutex_unlock(&s->lock);
+  return true;
+}
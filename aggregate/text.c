@@ -0,0 +1,376 @@
+/*
+ * File: text.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Delimited text input: one tuple per line, a group and a value as
+ * unsigned decimal numbers separated by anything that isn't a digit
+ * (comma, tab, spaces, ...). Further fields are ignored, and so is a
+ * first line that doesn't start with a digit (a header). Blank lines
+ * are skipped.
+ *
+ * The file is mapped and cut into one piece per thread at line
+ * boundaries. Every thread first counts the lines of its piece, so that
+ * it knows where its tuples go, then parses it in place. Both passes look
+ * at 8 bytes at a time in a 64 bit word (SWAR): counting tests all 8 for
+ * a newline at once, and parsing finds the length of a number and
+ * converts up to 8 of its digits with three multiplies, instead of a
+ * compare, branch and multiply per character.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <pthread.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <mtmalloc.h>
+
+#define ONES (0x0101010101010101ULL)
+#define HIGHS (0x8080808080808080ULL)
+
+static const uint64_t powers[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+/* below this, n * 10^k plus k more digits can't overflow, for any k <= 8 */
+#define SAFE_PREFIX (~(uint64_t)0 / 100000000)
+
+/* p[0..7] with p[0] in the low byte, whatever the byte order */
+static inline uint64_t TextLoad(const char *p)
+{
+  uint64_t w;
+
+  memcpy(&w, p, sizeof(w));
+#ifdef _BIG_ENDIAN
+  w = ((w & 0x00000000000000FFULL) << 56) | ((w & 0x000000000000FF00ULL) << 40) |
+    ((w & 0x0000000000FF0000ULL) << 24) | ((w & 0x00000000FF000000ULL) << 8) |
+    ((w & 0x000000FF00000000ULL) >> 8) | ((w & 0x0000FF0000000000ULL) >> 24) |
+    ((w & 0x00FF000000000000ULL) >> 40) | ((w & 0xFF00000000000000ULL) >> 56);
+#endif /* _BIG_ENDIAN */
+  return w;
+}
+
+/* the number of leading (low byte first) digits of w, 0 .. 8 */
+static inline unsigned int TextDigits(const uint64_t w)
+{
+  /* digits become 0 .. 9, which the add leaves below 0x80 */
+  const uint64_t x = w ^ (ONES * '0');
+  const uint64_t other = ((x + ONES * 0x76) | x) & HIGHS;
+  /* one 0x01 byte below the first other one; carries only come after it */
+  const uint64_t below = ((other & (~other + 1)) >> 7) - 1;
+
+  return (unsigned int)(((below & ONES) * ONES) >> 56);
+}
+
+/* the value of 8 digits, the first in the low byte; zero bytes count as 0 */
+static inline uint64_t TextValue8(uint64_t w)
+{
+  w = ((w & 0x0F0F0F0F0F0F0F0FULL) * (10 * 256 + 1)) >> 8;
+  w = ((w & 0x00FF00FF00FF00FFULL) * (100 * 65536 + 1)) >> 16;
+  w = ((w & 0x0000FFFF0000FFFFULL) * (10000 * 4294967296ULL + 1)) >> 32;
+  return w;
+}
+
+/* newlines in [p, end) */
+static uint64_t TextLines(const char *p, const char *end)
+{
+  register uint64_t n = 0, z;
+  uint64_t w;
+
+  for(; end - p >= 8; p += 8)
+    {
+      memcpy(&w, p, sizeof(w));
+      w ^= ONES * '\n';
+      /* 0x80 in every byte that was a newline (and so is now 0) */
+      z = ~(((w & ~HIGHS) + ~HIGHS) | w | ~HIGHS);
+      n += ((z >> 7) * ONES) >> 56;
+    }
+  for(; p < end; p++)
+    n += (*p == '\n');
+  return n;
+}
+
+static void TextMalformed(TextFile t, const char *p)
+{
+  fprintf(stderr, "Text file %s: line at byte %llu is not <group> <value> (below 2^64)\n",
+	  t->path, (unsigned long long)(p - t->map));
+  exit(-1);
+}
+
+/*
+ * Parse the number at p into *v; returns the character after it. Any
+ * number of leading zeros is fine, a value above 2^64 - 1 is malformed.
+ */
+static inline const char *TextNumber(TextFile t, const char *p, const char *end, uint64_t *v)
+{
+  register unsigned int k, digits = 0;
+  register uint64_t n = 0, w, x;
+
+  while(end - p >= 8)
+    {
+      w = TextLoad(p);
+      k = TextDigits(w);
+      if(k == 0)
+	break;
+      /* the digits to the top, the zeros below them are leading zeros */
+      x = TextValue8(w << (8 * (8 - k)));
+      if(n >= SAFE_PREFIX && n > (~(uint64_t)0 - x) / powers[k])
+	TextMalformed(t, p);
+      n = n * powers[k] + x;
+      p += k;
+      digits += k;
+      if(k < 8)
+	break;
+    }
+  /* the last few bytes of the file */
+  if(end - p < 8)
+    for(; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+      {
+	if(n >= SAFE_PREFIX && n > (~(uint64_t)0 - (*p - '0')) / 10)
+	  TextMalformed(t, p);
+	n = n * 10 + (*p - '0');
+      }
+
+  if(digits == 0)
+    TextMalformed(t, p);
+  *v = n;
+  return p;
+}
+
+typedef struct TextInfo
+{
+  TextFile t;
+  Tuple *tuples; /* rows, or NULL for columns */
+  uint64_t *group;
+  uint64_t *value;
+  const char *start; /* my piece of the file */
+  const char *end;
+  uint64_t first; /* my first tuple */
+  uint64_t n; /* lines, then tuples parsed */
+} TextInfo;
+
+/* stub for thread to start in: count the lines of my piece */
+static void * run_count(void *v)
+{
+  TextInfo *info = (TextInfo*)v;
+
+  info->n = TextLines(info->start, info->end);
+  /* a last line without a newline */
+  if(info->end > info->start && info->end[-1] != '\n')
+    info->n ++;
+  return NULL;
+}
+
+/* stub for thread to start in: parse my piece into tuples first, first + 1, ... */
+static void * run_parse(void *v)
+{
+  TextInfo *info = (TextInfo*)v;
+  TextFile t = info->t;
+  register const char *p = info->start;
+  const char *end = info->end;
+  register uint64_t i = info->first;
+  uint64_t group, value;
+
+  while(p < end)
+    {
+      if(*p == '\n' || *p == '\r')
+	{
+	  p++;
+	  continue;
+	}
+      p = TextNumber(t, p, end, &group);
+      while(p < end && (*p < '0' || *p > '9') && *p != '\n' && *p != '-')
+	p++;
+      if(p == end || *p == '\n' || *p == '-')
+	TextMalformed(t, p);
+      p = TextNumber(t, p, end, &value);
+      while(p < end && *p++ != '\n')
+	;
+
+      if(info->tuples)
+	{
+	  info->tuples[i].group = group;
+	  info->tuples[i].value1 = info->tuples[i].value2 = info->tuples[i].value3 = info->tuples[i].value4 = value;
+	}
+      else
+	{
+	  info->group[i] = group;
+	  info->value[i] = value;
+	}
+      i++;
+    }
+  info->n = i - info->first;
+  return NULL;
+}
+
+/* run task on n_threads threads, one per piece */
+static void TextThreads(TextInfo *info, int n_threads, void *(*task)(void *))
+{
+  register int i, r;
+  pthread_t threads[MAX_THREADS];
+
+  for(i = 0; i < n_threads; i++)
+    {
+      r = pthread_create(&threads[i], NULL, task, &info[i]);
+      assert(r==0);
+    }
+  for(i = 0; i < n_threads; i++)
+    pthread_join(threads[i], NULL);
+}
+
+/*
+ * Parse t with n_threads threads into rows (*tuples) or, if group is not
+ * NULL, columns (*group, *value), allocated here for as many tuples as
+ * there are lines. Sets t->n_tuples.
+ */
+static void TextRun(TextFile t, int n_threads, Tuple **tuples, uint64_t **group, uint64_t **value)
+{
+  register int i;
+  uint64_t lines = 0, n = 0;
+  const char *p, *end = t->map + t->size;
+  TextInfo info[MAX_THREADS];
+
+  assert(n_threads > 0 && n_threads <= MAX_THREADS);
+
+  /* pieces of about the same size, each starting at a line */
+  for(i = 0; i < n_threads; i++)
+    {
+      p = t->map + t->first + (t->size - t->first) * i / n_threads;
+      if(i > 0)
+	{
+	  if(p < info[i-1].start)
+	    p = info[i-1].start;
+	  while(p < end && p > t->map + t->first && p[-1] != '\n')
+	    p++;
+	  info[i-1].end = p;
+	}
+      info[i].t = t;
+      info[i].start = p;
+    }
+  info[n_threads-1].end = end;
+  TextThreads(info, n_threads, run_count);
+
+  for(i = 0; i < n_threads; i++)
+    {
+      info[i].first = lines;
+      lines += info[i].n;
+    }
+
+  /* one tuple per line, unless some are blank */
+  if(group)
+    {
+      *group = (uint64_t*)malloc(sizeof(uint64_t) * (lines ? lines : 1));
+      *value = (uint64_t*)malloc(sizeof(uint64_t) * (lines ? lines : 1));
+      assert(*group && *value);
+    }
+  else
+    {
+      *tuples = (Tuple*)malloc(sizeof(Tuple) * (lines ? lines : 1));
+      assert(*tuples);
+    }
+  for(i = 0; i < n_threads; i++)
+    {
+      info[i].tuples = group ? NULL : *tuples;
+      info[i].group = group ? *group : NULL;
+      info[i].value = group ? *value : NULL;
+    }
+  TextThreads(info, n_threads, run_parse);
+
+  /* close the gaps blank lines left */
+  for(i = 0; i < n_threads; i++)
+    {
+      if(info[i].first != n && info[i].n > 0)
+	{
+	  if(!group)
+	    memmove(&((*tuples)[n]), &((*tuples)[info[i].first]), sizeof(Tuple) * info[i].n);
+	  else
+	    {
+	      memmove(&((*group)[n]), &((*group)[info[i].first]), sizeof(uint64_t) * info[i].n);
+	      memmove(&((*value)[n]), &((*value)[info[i].first]), sizeof(uint64_t) * info[i].n);
+	    }
+	}
+      n += info[i].n;
+    }
+  t->n_tuples = n;
+}
+
+/* Map a text file and skip its header line, if it has one */
+TextFile TextOpen(const char *path)
+{
+  TextFile t;
+  struct stat st;
+  int fd;
+
+  t = (TextFile)calloc(1, sizeof(TextFileCDT));
+  assert(t);
+  t->path = path;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) != 0)
+    {
+      fprintf(stderr, "Could not open file: %s\n", path);
+      exit(-1);
+    }
+  t->size = st.st_size;
+  if(t->size > 0)
+    {
+      t->map = (char*)mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(t->map == (char*)MAP_FAILED)
+	{
+	  fprintf(stderr, "Could not map file: %s\n", path);
+	  exit(-1);
+	}
+      /* it is read front to back, by every thread */
+      madvise(t->map, t->size, MADV_SEQUENTIAL);
+    }
+  close(fd);
+
+  if(t->size > 0 && (t->map[0] < '0' || t->map[0] > '9'))
+    {
+      while(t->first < t->size && t->map[t->first] != '\n')
+	t->first ++;
+      if(t->first < t->size)
+	t->first ++;
+    }
+  return t;
+}
+
+/* The tuples of t, parsed by n_threads threads. Sets t->n_tuples. */
+Tuple *TextInput(TextFile t, int n_threads)
+{
+  Tuple *tuples;
+
+  TextRun(t, n_threads, &tuples, NULL, NULL);
+  return tuples;
+}
+
+/*
+ * The tuples of t as a group column and one value column that value1..4
+ * share, as GeneratorColumns. Sets t->n_tuples. Free columns->group.data
+ * and columns->value1.data when done.
+ */
+void TextColumns(TextFile t, int n_threads, InputColumns *columns)
+{
+  uint64_t *group, *value;
+  InputColumns c = {{0}};
+
+  TextRun(t, n_threads, NULL, &group, &value);
+
+  c.group.data = group;
+  c.value1.data = c.value2.data = c.value3.data = c.value4.data = value;
+  c.group.stride = c.value1.stride = c.value2.stride = c.value3.stride = c.value4.stride = 1;
+  *columns = c;
+}
+
+void TextClose(TextFile t)
+{
+  if(t->map)
+    munmap(t->map, t->size);
+  free(t);
+}
@@ -0,0 +1,148 @@
+/*
+ * File: trace.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * A per-thread record of the decisions made by the adaptive and resample
+ * engines: what each thread sampled, what it chose and how long the range
+ * took. Each thread appends to its own list, so no locking is needed.
+ * The lists are cleared at the start of every AggregateRun.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <strings.h>
+#include <mtmalloc.h>
+
+const char *StrategyName(Strategy strategy)
+{
+  switch(strategy)
+    {
+    case STRATEGY_RUNS:
+      return "runs";
+    case STRATEGY_HYBRID:
+      return "hybrid";
+    case STRATEGY_ATOMIC:
+      return "atomic";
+    case STRATEGY_PARTITIONED:
+      return "partitioned";
+    }
+  return "unknown";
+}
+
+/* Append a decision to the trace of thread id. s may be NULL if the */
+/* range was aggregated without sampling. */
+void TraceAdd(Aggregate a, const int id, const int partition,
+	      Strategy strategy, bool resampled, const SampleStats *s,
+	      const int start, const int end, double elapsed)
+{
+  TraceRecord *r;
+
+  if(!a->opts.trace)
+    return;
+
+  if(a->n_trace[id] == a->trace_capacity[id])
+    {
+      a->trace_capacity[id] = (a->trace_capacity[id] == 0) ? 16 : a->trace_capacity[id] * 2;
+      a->trace[id] = (TraceRecord*)realloc(a->trace[id], sizeof(TraceRecord) * a->trace_capacity[id]);
+      assert(a->trace[id]);
+    }
+
+  r = &(a->trace[id][a->n_trace[id]++]);
+  r->thread = id;
+  r->partition = partition;
+  r->strategy = strategy;
+  r->resampled = resampled;
+  r->start = start;
+  r->end = end;
+  r->elapsed = elapsed;
+  if(s)
+    r->sample = *s;
+  else
+    bzero(&(r->sample), sizeof(SampleStats));
+}
+
+void TraceReset(Aggregate a)
+{
+  register int i;
+  for(i = 0; i < a->n_threads; i++)
+    a->n_trace[i] = 0;
+}
+
+void TraceDelete(Aggregate a)
+{
+  register int i;
+  for(i = 0; i < a->n_threads; i++)
+    {
+      free(a->trace[i]);
+      a->trace[i] = NULL;
+      a->n_trace[i] = a->trace_capacity[i] = 0;
+    }
+}
+
+static void WriteCSV(Aggregate a, FILE *f)
+{
+  register int i, j, k;
+  TraceRecord *r;
+
+  fprintf(f, "thread,partition,strategy,resampled,start,end,elapsed,"
+	  "missrate,estimate_sum,avg_run_length");
+  for(k = 0; k < N_MAX_ACCESS; k++)
+    fprintf(f, ",max%d", k);
+  fprintf(f, "\n");
+
+  for(i = 0; i < a->n_threads; i++)
+    for(j = 0; j < a->n_trace[i]; j++)
+      {
+	r = &(a->trace[i][j]);
+	fprintf(f, "%d,%d,%s,%d,%u,%u,%.9f,%f,%f,%f",
+		r->thread, r->partition, StrategyName(r->strategy),
+		r->resampled, r->start, r->end, r->elapsed,
+		r->sample.missrate, r->sample.estimate_sum,
+		r->sample.avg_run_length);
+	for(k = 0; k < N_MAX_ACCESS; k++)
+	  fprintf(f, ",%u", r->sample.max[k]);
+	fprintf(f, "\n");
+      }
+}
+
+static void WriteJSON(Aggregate a, FILE *f)
+{
+  register int i, j, k;
+  bool first = true;
+  TraceRecord *r;
+
+  fprintf(f, "[\n");
+  for(i = 0; i < a->n_threads; i++)
+    for(j = 0; j < a->n_trace[i]; j++)
+      {
+	r = &(a->trace[i][j]);
+	fprintf(f, "%s  {\"thread\": %d, \"partition\": %d, \"strategy\": \"%s\", "
+		"\"resampled\": %s, \"start\": %u, \"end\": %u, \"elapsed\": %.9f, "
+		"\"missrate\": %f, \"estimate_sum\": %f, \"avg_run_length\": %f, "
+		"\"max\": [",
+		first ? "" : ",\n",
+		r->thread, r->partition, StrategyName(r->strategy),
+		r->resampled ? "true" : "false", r->start, r->end, r->elapsed,
+		r->sample.missrate, r->sample.estimate_sum,
+		r->sample.avg_run_length);
+	for(k = 0; k < N_MAX_ACCESS; k++)
+	  fprintf(f, "%s%u", k ? ", " : "", r->sample.max[k]);
+	fprintf(f, "]}");
+	first = false;
+      }
+  fprintf(f, "\n]\n");
+}
+
+/* Write the trace of the last run */
+void AggregateTraceWrite(Aggregate a, FILE *f, TraceFormat format)
+{
+  if(format == TRACE_JSON)
+    WriteJSON(a, f);
+  else
+    WriteCSV(a, f);
+}
@@ -0,0 +1,776 @@
+/*
+ * File: tupfile.c
+ * Author: John Cieslewicz [johnc@cs.columbia.edu]
+ * Copyright (c) 2007 The Trustees of Columbia University
+ *
+ * Reading and writing tuple files (see aggregate.h for the layout).
+ *
+ * A file is opened by mapping it read only. If its columns are laid out
+ * exactly like Tuple records, the mapping is the input: nothing is read
+ * or copied until the aggregation touches it, so a file in the page cache
+ * loads in no time. Any other layout, e.g. just the group and value1
+ * columns, is widened into Tuples by TupFileRead, which threads can call
+ * on disjoint ranges, or read in place as columns (TupFileColumns).
+ * Missing value columns repeat value1, as the generated inputs do.
+ *
+ * Key columns can be written bit-packed, as the difference to the
+ * smallest key in as few bits as the largest difference needs, or as
+ * codes into a sorted dictionary of the distinct keys, or run-length
+ * encoded, a key and the end of its run per run. Either way the kernels
+ * decode keys as they read them (see Column in global.h), so with -C a
+ * packed file is never expanded, and the run kernels take encoded runs
+ * as they are.
+ *
+ * Every shard is written with statistics of its keys: their range, an
+ * estimate of how many are distinct, how many runs they form and the
+ * most frequent ones. They cost a few passes over the shard when it is
+ * written and spare every later aggregation the sampling (see
+ * AggregateEstimateChunks). Version 2 files, without them, still open.
+ *
+ * The file can also be handed over in memory, by a process that built it
+ * in a shared memory segment or a memfd (TupFileAttach). It is mapped
+ * and used the same way, so the tuples never touch a disk and records
+ * are not even copied.
+ *
+ * Files are written in the byte order of the machine that writes them;
+ * opening one on a machine of the other byte order fails.
+ */
+
+#include "aggregate.h"
+#include "global.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define TUPFILE_HLL_BITS (10) /* 2^10 registers, about 3% error */
+
+static const char *field_names[5] = {"group", "value1", "value2", "value3", "value4"};
+
+static void TupFileError(const char *path, const char *what)
+{
+  fprintf(stderr, "Bad tuple file %s: %s\n", path, what);
+  exit(-1);
+}
+
+/* whether bytes bytes at offset are 8 byte aligned data of f */
+static bool TupFileHolds(TupFile f, uint64_t offset, uint64_t bytes)
+{
+  return offset >= f->header->header_size && offset % sizeof(uint64_t) == 0
+    && offset <= f->size && bytes <= f->size - offset;
+}
+
+/* packed words, with the spare one, of n numbers of bits bits */
+static uint64_t PackedWords(uint64_t n, unsigned int bits)
+{
+  return (n * bits + 63) / 64 + 1;
+}
+
+/* whether the runs of run-length column col end in order, the last at the last tuple */
+static bool TupFileRunsEnd(TupFile f, const TupFileColumn *col)
+{
+  register uint64_t r;
+  const uint64_t *ends = (const uint64_t*)(f->map + col->dict_offset);
+
+  for(r = 0; r < col->base; r++)
+    if(ends[r] <= ((r == 0) ? 0 : ends[r-1]))
+      return false;
+  return col->base == 0 || ends[col->base - 1] == f->header->n_tuples;
+}
+
+/* Map the tuple file open at fd, which is closed, and check its header */
+static TupFile TupFileMap(int fd, const char *path)
+{
+  register int c, k;
+  struct stat st;
+  TupFile f;
+  TupFileHeader *h;
+  TupFileColumn *col;
+
+  if(fstat(fd, &st) != 0)
+    {
+      fprintf(stderr, "Could not open file: %s\n", path);
+      exit(-1);
+    }
+  if(st.st_size < sizeof(TupFileHeader))
+    TupFileError(path, "too short");
+
+  f = (TupFile)calloc(1, sizeof(TupFileCDT));
+  assert(f);
+  f->size = st.st_size;
+  f->map = (char*)mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(f->map == (char*)MAP_FAILED)
+    TupFileError(path, "mmap failed");
+  /* the workers read it front to back, a chunk each */
+  madvise(f->map, f->size, MADV_WILLNEED);
+
+  h = f->header = (TupFileHeader*)f->map;
+  if(memcmp(h->magic, TUPFILE_MAGIC, sizeof(h->magic)) != 0)
+    TupFileError(path, "not a tuple file");
+  if(h->byte_order != TUPFILE_BYTE_ORDER)
+    TupFileError(path, "written on a machine of the other byte order");
+  if(h->version < TUPFILE_OLDEST_VERSION || h->version > TUPFILE_VERSION)
+    TupFileError(path, "unknown version");
+  if(h->n_columns > TUPFILE_MAX_COLUMNS 
+     || h->header_size > f->size
+     || sizeof(TupFileHeader) + h->n_columns * sizeof(TupFileColumn) 
+     + h->n_shards * (sizeof(TupFileShard) + ((h->version >= 3) ? sizeof(TupFileShardStats) : 0))
+     > h->header_size)
+    TupFileError(path, "bad header");
+
+  f->columns = (TupFileColumn*)(f->map + sizeof(TupFileHeader));
+  f->shards = (TupFileShard*)(f->columns + h->n_columns);
+  f->stats = (h->version >= 3 && h->n_shards > 0) ? (TupFileShardStats*)(f->shards + h->n_shards) : NULL;
+
+  /* find the columns we know and check they fit in the file */
+  for(k = 0; k < 5; k++)
+    f->field[k] = -1;
+  for(c = 0; c < h->n_columns; c++)
+    {
+      col = &(f->columns[c]);
+      switch(col->type)
+	{
+	case TUPFILE_UINT64:
+	  if(h->n_tuples > 0 
+	     && (col->stride < sizeof(uint64_t)
+		 || !TupFileHolds(f, col->offset, (h->n_tuples - 1) * col->stride + sizeof(uint64_t))))
+	    TupFileError(path, "column outside the file");
+	  break;
+	case TUPFILE_DICT:
+	  if(col->bits < 1 || col->bits > TUPFILE_MAX_DICT_BITS
+	     || !TupFileHolds(f, col->dict_offset, sizeof(uint64_t) << col->bits))
+	    TupFileError(path, "dictionary outside the file");
+	  /* fall through: the codes are packed */
+	case TUPFILE_PACKED:
+	  if(col->bits < 1 || col->bits > 64
+	     || !TupFileHolds(f, col->offset, PackedWords(h->n_tuples, col->bits) * sizeof(uint64_t)))
+	    TupFileError(path, "packed column outside the file");
+	  break;
+	case TUPFILE_RLE:
+	  if((h->n_tuples > 0) != (col->base > 0) || col->base > h->n_tuples
+	     || !TupFileHolds(f, col->offset, col->base * sizeof(uint64_t))
+	     || !TupFileHolds(f, col->dict_offset, col->base * sizeof(uint64_t)))
+	    TupFileError(path, "run-length column outside the file");
+	  if(!TupFileRunsEnd(f, col))
+	    TupFileError(path, "runs out of order");
+	  break;
+	default:
+	  TupFileError(path, "unknown column type");
+	}
+      for(k = 0; k < 5; k++)
+	if(strncmp(col->name, field_names[k], sizeof(col->name)) == 0)
+	  f->field[k] = c;
+    }
+  if(f->field[0] < 0 || f->field[1] < 0)
+    TupFileError(path, "needs a group and a value1 column");
+
+  for(c = 0; c < h->n_shards; c++)
+    if(f->shards[c].first + f->shards[c].count > h->n_tuples)
+      TupFileError(path, "shard outside the file");
+  /* chunks with statistics are planned one after the other */
+  for(c = 0; f->stats && c < h->n_shards; c++)
+    if(f->shards[c].first != ((c == 0) ? 0 : f->shards[c-1].first + f->shards[c-1].count)
+       || (c == h->n_shards - 1 && f->shards[c].first + f->shards[c].count != h->n_tuples))
+      TupFileError(path, "shards don't cover the file in order");
+
+  return f;
+}
+
+/* Map the tuple file at path and check its header */
+TupFile TupFileOpen(const char *path)
+{
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0)
+    {
+      fprintf(stderr, "Could not open file: %s\n", path);
+      exit(-1);
+    }
+  return TupFileMap(fd, path);
+}
+
+/* a file descriptor sent by whoever listens on the Unix socket at path */
+static int TupFileReceive(const char *path)
+{
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct iovec iov;
+  char byte;
+  int s, fd = -1;
+#ifdef CMSG_SPACE
+  union
+  {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+#endif /* CMSG_SPACE */
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path))
+    TupFileError(path, "socket path too long");
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(s < 0 || connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+      fprintf(stderr, "Could not connect to socket: %s\n", path);
+      exit(-1);
+    }
+
+  /* one byte of data, the descriptor rides along */
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+#ifdef CMSG_SPACE
+  msg.msg_control = control.space;
+  msg.msg_controllen = sizeof(control.space);
+#else
+  /* the old interface, e.g. Solaris without _XPG4_2 */
+  msg.msg_accrights = (caddr_t)&fd;
+  msg.msg_accrightslen = sizeof(fd);
+#endif /* CMSG_SPACE */
+  if(recvmsg(s, &msg, 0) <= 0)
+    TupFileError(path, "nothing received");
+#ifdef CMSG_SPACE
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+#endif /* CMSG_SPACE */
+  close(s);
+
+  if(fd < 0)
+    TupFileError(path, "no file descriptor received");
+  return fd;
+}
+
+/*
+ * Map a tuple file that another process put in memory: the POSIX shared
+ * memory segment name (e.g. /tuples), or, as unix:<path>, the memory
+ * file (memfd) or segment sent over the Unix socket at path. Like
+ * TupFileOpen otherwise, so records are aggregated where they lie.
+ */
+TupFile TupFileAttach(const char *name)
+{
+  int fd;
+
+  if(strncmp(name, TUPFILE_SOCKET, strlen(TUPFILE_SOCKET)) == 0)
+    return TupFileMap(TupFileReceive(name + strlen(TUPFILE_SOCKET)), name);
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0)
+    {
+      fprintf(stderr, "Could not open shared memory segment: %s\n", name);
+      exit(-1);
+    }
+  return TupFileMap(fd, name);
+}
+
+/* The tuples of f, if the file holds them as Tuple records; else NULL */
+Tuple *TupFileInPlace(TupFile f)
+{
+  register int k;
+  TupFileColumn *col;
+  static const size_t field_offset[5] = 
+    {offsetof(Tuple, group), offsetof(Tuple, value1), offsetof(Tuple, value2),
+     offsetof(Tuple, value3), offsetof(Tuple, value4)};
+  const uint64_t base = f->columns[f->field[0]].offset;
+
+  for(k = 0; k < 5; k++)
+    {
+      if(f->field[k] < 0)
+	return NULL;
+      col = &(f->columns[f->field[k]]);
+      if(col->type != TUPFILE_UINT64 
+	 || col->stride != sizeof(Tuple) || col->offset != base + field_offset[k])
+	return NULL;
+    }
+  return (Tuple*)(f->map + base);
+}
+
+/* how the kernels read column c of f */
+static Column TupFileColumnOf(TupFile f, int c)
+{
+  Column column = {0};
+  const TupFileColumn *col = &(f->columns[c]);
+
+  column.data = (const uint64_t*)(f->map + col->offset);
+  if(col->type == TUPFILE_UINT64)
+    column.stride = col->stride / sizeof(uint64_t);
+  else
+    column.bits = col->bits;
+  if(col->type == TUPFILE_PACKED)
+    column.base = col->base;
+  if(col->type == TUPFILE_DICT)
+    column.dict = (const uint64_t*)(f->map + col->dict_offset);
+  if(col->type == TUPFILE_RLE)
+    {
+      column.ends = (const uint64_t*)(f->map + col->dict_offset);
+      column.n_runs = col->base;
+    }
+  return column;
+}
+
+/*
+ * Point columns at the columns of f, so the kernels read the mapping
+ * whatever its layout; missing value columns share value1. False if a
+ * stride is not a whole number of values.
+ */
+bool TupFileColumns(TupFile f, InputColumns *columns)
+{
+  register int k, c;
+  Column *column = &(columns->group);
+
+  for(k = 0; k < 5; k++)
+    {
+      c = f->field[(f->field[k] < 0) ? 1 : k];
+      if(f->columns[c].type == TUPFILE_UINT64 && f->columns[c].stride % sizeof(uint64_t) != 0)
+	return false;
+      column[k] = TupFileColumnOf(f, c);
+    }
+  return true;
+}
+
+/* Widen tuples [start, end] of f into dst[start..end] */
+void TupFileRead(TupFile f, Tuple *dst, uint64_t start, uint64_t end)
+{
+  register uint64_t i, j, n;
+  register int k;
+  register const char *p;
+  uint32_t stride;
+  uint64_t *field, batch[COLUMN_BATCH];
+  Column packed;
+
+  assert(end < f->header->n_tuples || start > end);
+
+  /* one column at a time, each is a sequential scan */
+  for(k = 0; k < 5; k++)
+    {
+      if(f->field[k] < 0)
+	continue;
+      field = &(dst[0].group) + k;
+      if(f->columns[f->field[k]].type != TUPFILE_UINT64)
+	{
+	  packed = TupFileColumnOf(f, f->field[k]);
+	  for(i = start; i <= end; i += n)
+	    {
+	      n = (end - i + 1 < COLUMN_BATCH) ? end - i + 1 : COLUMN_BATCH;
+	      ColumnDecode(packed, i, n, batch);
+	      for(j = 0; j < n; j++)
+		field[(i + j) * (sizeof(Tuple)/sizeof(uint64_t))] = batch[j];
+	    }
+	  continue;
+	}
+      p = f->map + f->columns[f->field[k]].offset + start * f->columns[f->field[k]].stride;
+      stride = f->columns[f->field[k]].stride;
+      for(i = start; i <= end; i++, p += stride)
+	field[i * (sizeof(Tuple)/sizeof(uint64_t))] = *(const uint64_t*)p;
+    }
+
+  /* missing values repeat value1 */
+  for(k = 2; k < 5; k++)
+    if(f->field[k] < 0)
+      {
+	field = &(dst[0].group) + k;
+	for(i = start; i <= end; i++)
+	  field[i * (sizeof(Tuple)/sizeof(uint64_t))] = dst[i].value1;
+      }
+}
+
+void TupFileClose(TupFile f)
+{
+  munmap(f->map, f->size);
+  free(f);
+}
+
+/* bits needed for numbers up to max, at least 1 */
+static unsigned int BitsFor(uint64_t max)
+{
+  register unsigned int bits = 1;
+
+  while(bits < 64 && (max >> bits) != 0)
+    bits ++;
+  return bits;
+}
+
+/* packs numbers into 64 bit words on their way to a file */
+typedef struct BitWriter
+{
+  FILE *F;
+  uint64_t word;
+  unsigned int used; /* bits of word filled */
+} BitWriter;
+
+static void BitPut(BitWriter *w, uint64_t v, unsigned int bits)
+{
+  w->word |= v << w->used;
+  if(w->used + bits < 64)
+    {
+      w->used += bits;
+      return;
+    }
+  fwrite(&w->word, sizeof(uint64_t), 1, w->F);
+  /* what did not fit; nothing if the number ended on the word */
+  w->word = (w->used == 0) ? 0 : v >> (64 - w->used);
+  w->used = w->used + bits - 64;
+}
+
+/* write the last word and the spare one */
+static void BitFlush(BitWriter *w)
+{
+  const uint64_t spare = 0;
+
+  if(w->used > 0)
+    fwrite(&w->word, sizeof(uint64_t), 1, w->F);
+  fwrite(&spare, sizeof(uint64_t), 1, w->F);
+}
+
+static int CompareKeys(const void *x, const void *y)
+{
+  const uint64_t a = *(const uint64_t*)x, b = *(const uint64_t*)y;
+  return (a < b) ? -1 : (a > b);
+}
+
+/* the code of key in the n sorted keys of dict */
+static uint64_t DictCode(const uint64_t *dict, uint64_t n, uint64_t key)
+{
+  register uint64_t lo = 0, hi = n - 1, mid;
+
+  while(lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if(dict[mid] < key)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* a 64 bit mix of k, for the distinct count */
+static inline uint64_t Scramble(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xFF51AFD7ED558CCDULL;
+  k ^= k >> 33;
+  k *= 0xC4CEB9FE1A85EC53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/* the distinct keys of tuples [0, n), estimated by a HyperLogLog sketch */
+static uint64_t DistinctKeys(const Tuple *t, uint64_t n)
+{
+  register uint64_t i, h, rest;
+  register unsigned int rank;
+  unsigned char reg[1 << TUPFILE_HLL_BITS];
+  const double m = 1 << TUPFILE_HLL_BITS;
+  double sum = 0.0, estimate;
+  unsigned int zeros = 0;
+
+  memset(reg, 0, sizeof(reg));
+  for(i = 0; i < n; i++)
+    {
+      /* the top bits pick a register, which keeps the most leading */
+      /* zeros (plus one) seen in the rest */
+      h = Scramble(t[i].group);
+      rest = h << TUPFILE_HLL_BITS;
+      for(rank = 1; rank <= 64 - TUPFILE_HLL_BITS && !(rest >> 63); rest <<= 1)
+	rank ++;
+      h >>= 64 - TUPFILE_HLL_BITS;
+      if(rank > reg[h])
+	reg[h] = rank;
+    }
+  for(i = 0; i < (1 << TUPFILE_HLL_BITS); i++)
+    {
+      sum += 1.0 / ((uint64_t)1 << reg[i]);
+      zeros += (reg[i] == 0);
+    }
+  estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+  /* few keys: count the empty registers instead */
+  if(estimate <= 2.5 * m && zeros > 0)
+    estimate = m * log(m / zeros);
+  estimate += 0.5;
+  return (estimate > n) ? n : (uint64_t)estimate;
+}
+
+/*
+ * The statistics of tuples [0, n). Heavy hitter candidates are found in
+ * one pass with the Misra-Gries summary of TUPFILE_HEAVY counters, which
+ * keeps every key that is more than 1/(TUPFILE_HEAVY + 1) of the tuples,
+ * and then counted exactly in a second pass.
+ */
+static void ShardStats(const Tuple *t, uint64_t n, TupFileShardStats *st)
+{
+  register uint64_t i;
+  register unsigned int k, j, used = 0;
+  uint64_t key[TUPFILE_HEAVY], count[TUPFILE_HEAVY], swap;
+
+  memset(st, 0, sizeof(TupFileShardStats));
+  st->sorted = 1;
+  if(n == 0)
+    return;
+
+  st->min_key = st->max_key = t[0].group;
+  st->runs = 1;
+  for(i = 1; i < n; i++)
+    {
+      if(t[i].group < st->min_key)
+	st->min_key = t[i].group;
+      if(t[i].group > st->max_key)
+	st->max_key = t[i].group;
+      if(t[i].group != t[i-1].group)
+	st->runs ++;
+      if(t[i].group < t[i-1].group)
+	st->sorted = 0;
+    }
+  st->distinct = DistinctKeys(t, n);
+
+  /* candidates */
+  for(i = 0; i < n; i++)
+    {
+      for(k = 0; k < used && key[k] != t[i].group; k++)
+	;
+      if(k < used)
+	count[k] ++;
+      else if(used < TUPFILE_HEAVY)
+	{
+	  key[used] = t[i].group;
+	  count[used++] = 1;
+	}
+      else
+	for(k = 0; k < used; )
+	  if(--count[k] == 0)
+	    {
+	      key[k] = key[--used];
+	      count[k] = count[used];
+	    }
+	  else
+	    k ++;
+    }
+
+  /* their exact counts, largest first */
+  for(k = 0; k < used; k++)
+    count[k] = 0;
+  for(i = 0; i < n; i++)
+    for(k = 0; k < used; k++)
+      if(key[k] == t[i].group)
+	{
+	  count[k] ++;
+	  break;
+	}
+  for(k = 0; k < used; k++)
+    for(j = k + 1; j < used; j++)
+      if(count[j] > count[k])
+	{
+	  swap = count[j], count[j] = count[k], count[k] = swap;
+	  swap = key[j], key[j] = key[k], key[k] = swap;
+	}
+  st->n_heavy = used;
+  for(k = 0; k < used; k++)
+    {
+      st->heavy_key[k] = key[k];
+      st->heavy_count[k] = count[k];
+    }
+}
+
+/*
+ * Write n_tuples tuples to path. With rows the file holds Tuple records
+ * and can be aggregated in place; otherwise it holds only the group and
+ * value1 columns, since the generated inputs repeat value1, and the
+ * group column is stored as key_type. The shard index splits the tuples
+ * into n_shards equal ranges (none if 0), each with its statistics.
+ */
+void TupFileWrite(const char *path, const Tuple *tuples, uint64_t n_tuples, 
+		  bool rows, unsigned int n_shards, TupFileType key_type)
+{
+  register uint64_t i, j, n;
+  register int c;
+  TupFileHeader h;
+  TupFileColumn cols[5];
+  TupFileShard shard;
+  TupFileShardStats stats;
+  uint64_t *buffer, data, chunk, key_bytes, dict_bytes = 0;
+  uint64_t min = ~(uint64_t)0, max = 0, *dict = NULL, n_dict = 0, n_runs = 0, run_end;
+  unsigned int bits = 0;
+  char zero[TUPFILE_ALIGN];
+  const size_t buffer_size = 65536;
+  BitWriter w;
+  FILE *F;
+
+  assert(!rows || key_type == TUPFILE_UINT64);
+  F = fopen(path, "wb");
+  if(!F)
+    {
+      fprintf(stderr, "Could not open file: %s\n", path);
+      exit(-1);
+    }
+
+  /* size the key column */
+  key_bytes = n_tuples * sizeof(uint64_t);
+  if(key_type == TUPFILE_PACKED)
+    {
+      for(i = 0; i < n_tuples; i++)
+	{
+	  if(tuples[i].group < min)
+	    min = tuples[i].group;
+	  if(tuples[i].group > max)
+	    max = tuples[i].group;
+	}
+      if(n_tuples == 0)
+	min = max = 0;
+      bits = BitsFor(max - min);
+      key_bytes = PackedWords(n_tuples, bits) * sizeof(uint64_t);
+    }
+  else if(key_type == TUPFILE_DICT)
+    {
+      /* the distinct keys, sorted */
+      dict = (uint64_t*)malloc(sizeof(uint64_t) * (n_tuples + 1));
+      assert(dict);
+      for(i = 0; i < n_tuples; i++)
+	dict[i] = tuples[i].group;
+      qsort(dict, n_tuples, sizeof(uint64_t), CompareKeys);
+      for(i = 0; i < n_tuples; i++)
+	if(n_dict == 0 || dict[i] != dict[n_dict - 1])
+	  dict[n_dict++] = dict[i];
+      if(n_dict == 0)
+	dict[n_dict++] = 0;
+      bits = BitsFor(n_dict - 1);
+      if(bits > TUPFILE_MAX_DICT_BITS)
+	{
+	  fprintf(stderr, "Tuple file %s: %llu distinct keys are too many for a dictionary\n",
+		  path, (unsigned long long)n_dict);
+	  exit(-1);
+	}
+      dict_bytes = sizeof(uint64_t) << bits;
+      key_bytes = PackedWords(n_tuples, bits) * sizeof(uint64_t);
+    }
+  else if(key_type == TUPFILE_RLE)
+    {
+      /* a key and an end per run */
+      for(i = 0; i < n_tuples; i++)
+	if(i == 0 || tuples[i].group != tuples[i-1].group)
+	  n_runs ++;
+      key_bytes = 2 * n_runs * sizeof(uint64_t);
+    }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TUPFILE_MAGIC, sizeof(h.magic));
+  h.version = TUPFILE_VERSION;
+  h.byte_order = TUPFILE_BYTE_ORDER;
+  h.n_tuples = n_tuples;
+  h.n_columns = rows ? 5 : 2;
+  h.n_shards = n_shards;
+  h.header_size = sizeof(h) + h.n_columns * sizeof(TupFileColumn) 
+    + n_shards * (sizeof(TupFileShard) + sizeof(TupFileShardStats));
+  data = (h.header_size + TUPFILE_ALIGN - 1) / TUPFILE_ALIGN * TUPFILE_ALIGN;
+
+  /* columns: the dictionary, the group column, then value1 */
+  memset(cols, 0, sizeof(cols));
+  for(c = 0; c < h.n_columns; c++)
+    {
+      strncpy(cols[c].name, field_names[c], sizeof(cols[c].name));
+      cols[c].type = TUPFILE_UINT64;
+      cols[c].stride = rows ? sizeof(Tuple) : sizeof(uint64_t);
+      cols[c].offset = rows ? data + c * sizeof(uint64_t) : data + dict_bytes + c * key_bytes;
+    }
+  if(!rows)
+    {
+      cols[0].type = key_type;
+      cols[0].bits = bits;
+      cols[0].base = (key_type == TUPFILE_PACKED) ? min : (key_type == TUPFILE_RLE) ? n_runs : 0;
+      cols[0].dict_offset = (key_type == TUPFILE_DICT) ? data 
+	: (key_type == TUPFILE_RLE) ? data + n_runs * sizeof(uint64_t) : 0;
+      if(key_type != TUPFILE_UINT64)
+	cols[0].stride = 0;
+    }
+
+  fwrite(&h, sizeof(h), 1, F);
+  fwrite(cols, sizeof(TupFileColumn), h.n_columns, F);
+  chunk = (n_shards > 0) ? n_tuples / n_shards : 0;
+  for(c = 0; c < n_shards; c++)
+    {
+      shard.first = c * chunk;
+      shard.count = (c == n_shards - 1) ? n_tuples - shard.first : chunk;
+      fwrite(&shard, sizeof(shard), 1, F);
+    }
+  for(c = 0; c < n_shards; c++)
+    {
+      shard.first = c * chunk;
+      shard.count = (c == n_shards - 1) ? n_tuples - shard.first : chunk;
+      ShardStats(&tuples[shard.first], shard.count, &stats);
+      fwrite(&stats, sizeof(stats), 1, F);
+    }
+  memset(zero, 0, sizeof(zero));
+  fwrite(zero, 1, data - h.header_size, F);
+
+  if(rows)
+    fwrite(tuples, sizeof(Tuple), n_tuples, F);
+  else
+    {
+      if(key_type == TUPFILE_DICT)
+	{
+	  /* pad to 2^bits entries, so every code is a valid one */
+	  fwrite(dict, sizeof(uint64_t), n_dict, F);
+	  for(i = n_dict; i < ((uint64_t)1 << bits); i++)
+	    fwrite(&dict[n_dict - 1], sizeof(uint64_t), 1, F);
+	}
+      if(key_type == TUPFILE_RLE)
+	{
+	  /* the keys, then the ends */
+	  for(i = 0; i < n_tuples; i++)
+	    if(i == 0 || tuples[i].group != tuples[i-1].group)
+	      fwrite(&tuples[i].group, sizeof(uint64_t), 1, F);
+	  for(i = 1; i <= n_tuples; i++)
+	    if(i == n_tuples || tuples[i].group != tuples[i-1].group)
+	      {
+		run_end = i;
+		fwrite(&run_end, sizeof(uint64_t), 1, F);
+	      }
+	}
+      if(key_type == TUPFILE_PACKED || key_type == TUPFILE_DICT)
+	{
+	  w.F = F;
+	  w.word = 0;
+	  w.used = 0;
+	  for(i = 0; i < n_tuples; i++)
+	    BitPut(&w, (key_type == TUPFILE_DICT) 
+		   ? DictCode(dict, n_dict, tuples[i].group) : tuples[i].group - min, bits);
+	  BitFlush(&w);
+	}
+
+      buffer = (uint64_t*)malloc(buffer_size * sizeof(uint64_t));
+      assert(buffer);
+      for(c = (key_type == TUPFILE_UINT64) ? 0 : 1; c < 2; c++)
+	for(i = 0; i < n_tuples; i += n)
+	  {
+	    n = (n_tuples - i < buffer_size) ? n_tuples - i : buffer_size;
+	    for(j = 0; j < n; j++)
+	      buffer[j] = (c == 0) ? tuples[i + j].group : tuples[i + j].value1;
+	    fwrite(buffer, sizeof(uint64_t), n, F);
+	  }
+      free(buffer);
+    }
+  free(dict);
+
+  if(fclose(F) != 0)
+    {
+      fprintf(stderr, "Could not write file: %s\n", path);
+      exit(-1);
+    }
+}